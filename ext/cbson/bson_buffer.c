@@ -18,6 +18,7 @@
 #include <string.h>
 
 #include "bson_buffer.h"
+#include "bson_probes.h"
 
 #define INITIAL_BUFFER_SIZE 256
 #define DEFAULT_MAX_SIZE 4 * 1024 * 1024
@@ -91,6 +92,7 @@ static int buffer_grow(bson_buffer_t buffer, int min_length) {
         free(buffer);
         return 1;
     }
+    BSON_PROBE2(buffer__grow, buffer->size, size);
     buffer->size = size;
     return 0;
 }
@@ -0,0 +1,438 @@
+/*
+ * Copyright (C) 2009-2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include <math.h>
+
+#include "bson_ordering.h"
+
+/* BSON is little endian and the extension is only loaded on little endian
+ * hosts (see BSON.extension?), so fixed width values are read with memcpy. */
+
+static int read_int32(const char* p) {
+    int value;
+    memcpy(&value, p, 4);
+    return value;
+}
+
+static long long read_int64(const char* p) {
+    long long value;
+    memcpy(&value, p, 8);
+    return value;
+}
+
+static double read_double(const char* p) {
+    double value;
+    memcpy(&value, p, 8);
+    return value;
+}
+
+/* Length of the NUL terminated string at `p`, including the terminator,
+ * or -1 if it runs past `end`. */
+static int cstring_size(const char* p, const char* end) {
+    const char* nul = memchr(p, '\0', end - p);
+    return nul ? (int)(nul - p) + 1 : -1;
+}
+
+/* Size of a length prefixed string (int32 length, bytes, NUL) at `p`. */
+static int string_size(const char* p, const char* end) {
+    int length;
+    if (end - p < 5)
+        return -1;
+    length = read_int32(p);
+    if (length < 1 || length > end - p - 4 || p[4 + length - 1] != '\0')
+        return -1;
+    return 4 + length;
+}
+
+/* Size of an embedded document at `p`, checking its framing. */
+static int document_size(const char* p, const char* end) {
+    int length;
+    if (end - p < 5)
+        return -1;
+    length = read_int32(p);
+    if (length < 5 || length > end - p || p[length - 1] != '\0')
+        return -1;
+    return length;
+}
+
+/* Size of the value of type `type` at `p`, or -1 if it is malformed or
+ * the type is unknown. */
+static int value_size(unsigned char type, const char* p, const char* end) {
+    int size, extra;
+
+    switch (type) {
+    case 0x06: /* undefined */
+    case 0x0A: /* null */
+    case 0xFF: /* MinKey */
+    case 0x7F: /* MaxKey */
+        return 0;
+    case 0x08: /* boolean */
+        size = 1;
+        break;
+    case 0x10: /* int32 */
+        size = 4;
+        break;
+    case 0x01: /* double */
+    case 0x09: /* date */
+    case 0x11: /* timestamp */
+    case 0x12: /* int64 */
+        size = 8;
+        break;
+    case 0x07: /* ObjectId */
+        size = 12;
+        break;
+    case 0x02: /* string */
+    case 0x0D: /* code */
+    case 0x0E: /* symbol */
+        return string_size(p, end);
+    case 0x03: /* document */
+    case 0x04: /* array */
+    case 0x0F: /* code with scope */
+        return document_size(p, end);
+    case 0x05: /* binary */
+        if (end - p < 5)
+            return -1;
+        size = read_int32(p);
+        if (size < 0 || size > end - p - 5)
+            return -1;
+        return size + 5;
+    case 0x0B: /* regex */
+        if ((size = cstring_size(p, end)) < 0 ||
+            (extra = cstring_size(p + size, end)) < 0)
+            return -1;
+        return size + extra;
+    case 0x0C: /* DBPointer */
+        if ((size = string_size(p, end)) < 0 || end - p - size < 12)
+            return -1;
+        return size + 12;
+    default:
+        return -1;
+    }
+    return end - p < size ? -1 : size;
+}
+
+/* The sort bracket of each type. Types in the same bracket compare by
+ * value; otherwise the lower bracket sorts first. */
+static int canonical_type(unsigned char type) {
+    switch (type) {
+    case 0xFF: return -1;
+    case 0x06: return 0;
+    case 0x0A: return 5;
+    case 0x01:
+    case 0x10:
+    case 0x12: return 10;
+    case 0x02:
+    case 0x0E: return 15;
+    case 0x03: return 20;
+    case 0x04: return 25;
+    case 0x05: return 30;
+    case 0x07: return 35;
+    case 0x08: return 40;
+    case 0x09: return 45;
+    case 0x11: return 47;
+    case 0x0B: return 50;
+    case 0x0C: return 55;
+    case 0x0D: return 60;
+    case 0x0F: return 65;
+    case 0x7F: return 127;
+    default: return -2;
+    }
+}
+
+#define SIGN(a, b) (((a) > (b)) - ((a) < (b)))
+
+static int compare_bytes(const char* a, int a_len, const char* b, int b_len) {
+    int result = memcmp(a, b, a_len < b_len ? a_len : b_len);
+    if (result)
+        return result < 0 ? -1 : 1;
+    return SIGN(a_len, b_len);
+}
+
+/* Compare two length prefixed strings by their bytes, ignoring the NUL. */
+static int compare_strings(const char* a, const char* b) {
+    return compare_bytes(a + 4, read_int32(a) - 1, b + 4, read_int32(b) - 1);
+}
+
+/* Numbers of different types compare by value. NaN sorts below every
+ * other number and equal to itself. */
+static int compare_numbers(unsigned char a_type, const char* a,
+                           unsigned char b_type, const char* b) {
+    long long a_int, b_int;
+    long double a_num, b_num;
+
+    if (a_type != 0x01 && b_type != 0x01) {
+        a_int = a_type == 0x10 ? read_int32(a) : read_int64(a);
+        b_int = b_type == 0x10 ? read_int32(b) : read_int64(b);
+        return SIGN(a_int, b_int);
+    }
+
+    /* long double keeps int64 values exact on the platforms we build on,
+     * which a plain double would not. */
+    a_num = a_type == 0x01 ? (long double)read_double(a) :
+        (long double)(a_type == 0x10 ? read_int32(a) : read_int64(a));
+    b_num = b_type == 0x01 ? (long double)read_double(b) :
+        (long double)(b_type == 0x10 ? read_int32(b) : read_int64(b));
+
+    if (isnan(a_num))
+        return isnan(b_num) ? 0 : -1;
+    if (isnan(b_num))
+        return 1;
+    return SIGN(a_num, b_num);
+}
+
+int bson_compare_values(unsigned char a_type, const char* a, const char* a_end,
+                        unsigned char b_type, const char* b, const char* b_end,
+                        int* result) {
+    int a_rank = canonical_type(a_type);
+    int b_rank = canonical_type(b_type);
+    int a_size, b_size;
+
+    if (a_rank == -2 || b_rank == -2)
+        return 1;
+    if (a_rank != b_rank) {
+        *result = SIGN(a_rank, b_rank);
+        return 0;
+    }
+    if ((a_size = value_size(a_type, a, a_end)) < 0 ||
+        (b_size = value_size(b_type, b, b_end)) < 0)
+        return 1;
+
+    switch (a_type) {
+    case 0x06:
+    case 0x0A:
+    case 0xFF:
+    case 0x7F:
+        *result = 0;
+        return 0;
+    case 0x01:
+    case 0x10:
+    case 0x12:
+        *result = compare_numbers(a_type, a, b_type, b);
+        return 0;
+    case 0x02:
+    case 0x0D:
+    case 0x0E:
+        *result = compare_strings(a, b);
+        return 0;
+    case 0x03:
+    case 0x04:
+        return bson_compare_documents(a, a + a_size, b, b + b_size, result);
+    case 0x05:
+        /* Binary sorts by length first, then subtype, then bytes. */
+        if ((*result = SIGN(read_int32(a), read_int32(b))) ||
+            (*result = SIGN((unsigned char)a[4], (unsigned char)b[4])))
+            return 0;
+        *result = compare_bytes(a + 5, a_size - 5, b + 5, b_size - 5);
+        return 0;
+    case 0x07:
+        *result = compare_bytes(a, 12, b, 12);
+        return 0;
+    case 0x08:
+        *result = SIGN(a[0] != 0, b[0] != 0);
+        return 0;
+    case 0x09:
+        *result = SIGN(read_int64(a), read_int64(b));
+        return 0;
+    case 0x11:
+        *result = SIGN((unsigned long long)read_int64(a),
+                       (unsigned long long)read_int64(b));
+        return 0;
+    case 0x0B:
+        /* Pattern first, then options; both are NUL terminated. */
+        {
+            int a_pattern = cstring_size(a, a_end);
+            int b_pattern = cstring_size(b, b_end);
+            if ((*result = compare_bytes(a, a_pattern - 1, b, b_pattern - 1)))
+                return 0;
+            *result = compare_bytes(a + a_pattern, a_size - a_pattern - 1,
+                                    b + b_pattern, b_size - b_pattern - 1);
+            return 0;
+        }
+    case 0x0C:
+        if ((*result = compare_strings(a, b)))
+            return 0;
+        *result = compare_bytes(a + a_size - 12, 12, b + b_size - 12, 12);
+        return 0;
+    case 0x0F:
+        /* Code with scope: int32 total, code string, scope document. */
+        {
+            const char* a_scope;
+            const char* b_scope;
+            int a_code = string_size(a + 4, a + a_size);
+            int b_code = string_size(b + 4, b + b_size);
+            if (a_code < 0 || b_code < 0)
+                return 1;
+            if ((*result = compare_strings(a + 4, b + 4)))
+                return 0;
+            a_scope = a + 4 + a_code;
+            b_scope = b + 4 + b_code;
+            return bson_compare_documents(a_scope, a + a_size,
+                                          b_scope, b + b_size, result);
+        }
+    }
+    return 1;
+}
+
+int bson_compare_documents(const char* a, const char* a_end,
+                           const char* b, const char* b_end,
+                           int* result) {
+    int a_size = document_size(a, a_end);
+    int b_size = document_size(b, b_end);
+
+    if (a_size < 0 || b_size < 0)
+        return 1;
+    a_end = a + a_size - 1;
+    b_end = b + b_size - 1;
+    a += 4;
+    b += 4;
+
+    /* Elements compare pairwise by type bracket, field name and value; a
+     * document that is a prefix of the other sorts first. */
+    while (a < a_end && b < b_end) {
+        unsigned char a_type = (unsigned char)*a++;
+        unsigned char b_type = (unsigned char)*b++;
+        int a_name = cstring_size(a, a_end);
+        int b_name = cstring_size(b, b_end);
+        int a_size, b_size;
+
+        if (a_name < 0 || b_name < 0 ||
+            canonical_type(a_type) == -2 || canonical_type(b_type) == -2)
+            return 1;
+        if ((*result = SIGN(canonical_type(a_type), canonical_type(b_type))) ||
+            (*result = compare_bytes(a, a_name - 1, b, b_name - 1)))
+            return 0;
+        a += a_name;
+        b += b_name;
+        if (bson_compare_values(a_type, a, a_end, b_type, b, b_end, result))
+            return 1;
+        if (*result)
+            return 0;
+        if ((a_size = value_size(a_type, a, a_end)) < 0 ||
+            (b_size = value_size(b_type, b, b_end)) < 0)
+            return 1;
+        a += a_size;
+        b += b_size;
+    }
+    *result = SIGN(a < a_end, b < b_end);
+    return 0;
+}
+
+/* Size of the document at `p`, checking every element in it and in the
+ * documents it contains. A document whose first key is "$ref" must be laid
+ * out as the decoder expects a DBRef: a string "$ref" followed by "$id". */
+static int check_document(const char* p, const char* end) {
+    int size = document_size(p, end);
+    const char* doc_end;
+    int index = 0, dbref = 0;
+
+    if (size < 0)
+        return -1;
+    doc_end = p + size - 1;
+    p += 4;
+    while (p < doc_end) {
+        unsigned char type = (unsigned char)*p++;
+        int name = cstring_size(p, doc_end);
+        int value;
+
+        if (name < 0)
+            return -1;
+        if (index == 0 && name == 5 && memcmp(p, "$ref", 5) == 0) {
+            if (type != 0x02)
+                return -1;
+            dbref = 1;
+        } else if (index == 1 && dbref && (name != 4 || memcmp(p, "$id", 4) != 0)) {
+            return -1;
+        }
+        p += name;
+        if ((value = bson_check_value(type, p, doc_end)) < 0)
+            return -1;
+        p += value;
+        index++;
+    }
+    return dbref && index < 2 ? -1 : size;
+}
+
+int bson_check_value(unsigned char type, const char* value, const char* end) {
+    int size, code, scope;
+
+    switch (type) {
+    case 0x03:
+    case 0x04:
+        return check_document(value, end);
+    case 0x05:
+        /* The old binary subtype carries a second length inside. */
+        if ((size = value_size(type, value, end)) < 0 ||
+            ((unsigned char)value[4] == 0x02 && read_int32(value) < 4))
+            return -1;
+        return size;
+    case 0x0F:
+        /* int32 total, code string, scope document. */
+        if ((size = document_size(value, end)) < 14 ||
+            (code = string_size(value + 4, value + size)) < 0 ||
+            (scope = check_document(value + 4 + code, value + size)) < 0 ||
+            4 + code + scope != size)
+            return -1;
+        return size;
+    default:
+        return value_size(type, value, end);
+    }
+}
+
+int bson_find_path(const char* doc, const char* doc_end,
+                   const char* path, int path_len,
+                   unsigned char* type, const char** value) {
+    const char* segment_end = memchr(path, '.', path_len);
+    int segment_len = segment_end ? (int)(segment_end - path) : path_len;
+    int size = document_size(doc, doc_end);
+
+    *type = BSON_ORDERING_MISSING;
+    *value = NULL;
+    if (size < 0)
+        return 1;
+    doc_end = doc + size - 1;
+    doc += 4;
+
+    while (doc < doc_end) {
+        unsigned char element_type = (unsigned char)*doc++;
+        int name = cstring_size(doc, doc_end);
+        int matched;
+
+        if (name < 0)
+            return 1;
+        matched = name - 1 == segment_len && memcmp(doc, path, segment_len) == 0;
+        doc += name;
+        if (matched) {
+            if (!segment_end) {
+                if (value_size(element_type, doc, doc_end) < 0)
+                    return 1;
+                *type = element_type;
+                *value = doc;
+                return 0;
+            }
+            /* Only documents and arrays have fields to descend into;
+             * array elements are addressed by their index keys. */
+            if (element_type != 0x03 && element_type != 0x04)
+                return 0;
+            return bson_find_path(doc, doc_end, segment_end + 1,
+                                  path_len - segment_len - 1, type, value);
+        }
+        if ((size = value_size(element_type, doc, doc_end)) < 0)
+            return 1;
+        doc += size;
+    }
+    return 0;
+}
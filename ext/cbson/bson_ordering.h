@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2009-2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _BSON_ORDERING_H
+#define _BSON_ORDERING_H
+
+/* Comparison of raw BSON values using the server's sort order: values are
+ * first ranked by type bracket (MinKey, null, numbers, strings, objects,
+ * arrays, binary, ObjectId, booleans, dates, timestamps, regexes, ...,
+ * MaxKey) and only then compared within the bracket.
+ *
+ * None of these functions trust their input. Every read is checked
+ * against the end pointer of the enclosing buffer and a malformed value
+ * makes the function return non-zero. */
+
+/* The element type used for a sort key that is missing from a document.
+ * The server sorts missing fields as if they were null. */
+#define BSON_ORDERING_MISSING 0x0A
+
+/* Compare the value of type `a_type` at `a` with the value of type
+ * `b_type` at `b`, storing a negative, zero or positive number in
+ * `result`. Return non-zero if either value is malformed or of a type
+ * that has no defined order. */
+int bson_compare_values(unsigned char a_type, const char* a, const char* a_end,
+                        unsigned char b_type, const char* b, const char* b_end,
+                        int* result);
+
+/* Compare two complete documents field by field, as the server does
+ * when a sort key's value is an embedded document. */
+int bson_compare_documents(const char* a, const char* a_end,
+                           const char* b, const char* b_end,
+                           int* result);
+
+/* Size of the value of type `type` at `value`, checking the framing of
+ * everything inside it, including nested documents, so that it can be
+ * decoded without reading past `end`. Return -1 if it is malformed. */
+int bson_check_value(unsigned char type, const char* value, const char* end);
+
+/* Look up the dotted `path` (of `path_len` bytes) in the document at
+ * `doc`, descending through embedded documents and arrays. On success
+ * `type` and `value` describe the element; a missing path sets `type` to
+ * BSON_ORDERING_MISSING and `value` to NULL. Return non-zero if the
+ * document is malformed. */
+int bson_find_path(const char* doc, const char* doc_end,
+                   const char* path, int path_len,
+                   unsigned char* type, const char** value);
+
+#endif
@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2009-2013 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _BSON_PROBES_H
+#define _BSON_PROBES_H
+
+/* Static tracepoints (USDT) of the "bson" provider, for bpftrace, perf or
+ * SystemTap. Sizes are in bytes and durations in nanoseconds.
+ *
+ *   serialize__done(bytes, ns)       CBson.serialize
+ *   deserialize__done(bytes, ns)     CBson.deserialize
+ *   buffer__grow(old_size, new_size) a serialization buffer reallocation
+ *   socket__send(bytes, ns)          fired by the driver through CBson.fire_probe
+ *   socket__receive(bytes, ns)
+ *   pool__checkout(in_use, ns)
+ *
+ * Each probe has a semaphore that the tracer increments while attached,
+ * so timing is only measured when someone is listening. Without
+ * sys/sdt.h every probe compiles to nothing and is never enabled. */
+
+#ifdef HAVE_SYS_SDT_H
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define BSON_PROBE_SEMAPHORE(name) bson_##name##_semaphore
+#define BSON_PROBE_DEFINE(name) \
+    unsigned short BSON_PROBE_SEMAPHORE(name) __attribute__((section(".probes"), used)) = 0
+#define BSON_PROBE_ENABLED(name) __builtin_expect(BSON_PROBE_SEMAPHORE(name) != 0, 0)
+#define BSON_PROBE2(name, a, b) DTRACE_PROBE2(bson, name, a, b)
+
+extern unsigned short BSON_PROBE_SEMAPHORE(serialize__done);
+extern unsigned short BSON_PROBE_SEMAPHORE(deserialize__done);
+extern unsigned short BSON_PROBE_SEMAPHORE(buffer__grow);
+extern unsigned short BSON_PROBE_SEMAPHORE(socket__send);
+extern unsigned short BSON_PROBE_SEMAPHORE(socket__receive);
+extern unsigned short BSON_PROBE_SEMAPHORE(pool__checkout);
+
+#else
+
+#define BSON_PROBE_DEFINE(name) extern int bson_probes_unavailable
+#define BSON_PROBE_ENABLED(name) 0
+#define BSON_PROBE2(name, a, b) do { (void)(a); (void)(b); } while (0)
+
+#endif
+
+#endif
@@ -30,6 +30,10 @@
 # include <arpa/inet.h>
 #endif
 
+#if HAVE_PTHREAD_ATFORK
+# include <pthread.h>
+#endif
+
 /* Ensure compatibility with early releases of Ruby 1.8.5 */
 #ifndef RSTRING_PTR
 #  define RSTRING_PTR(v) RSTRING(v)->ptr
@@ -42,6 +46,10 @@
 #  define RSTRING_LENINT(v) (int)(RSTRING_LEN(v))
 #endif
 
+#ifndef RB_GC_GUARD
+#  define RB_GC_GUARD(v) (*(volatile VALUE *)&(v))
+#endif
+
 #ifndef RARRAY_LEN
 #  define RARRAY_LEN(v) RARRAY(v)->len
 #endif
@@ -70,7 +78,9 @@
 
 #include "version.h"
 #include "bson_buffer.h"
+#include "bson_probes.h"
 #include "encoding_helpers.h"
+#include "bson_ordering.h"
 
 #define SAFE_WRITE(buffer, data, size)                                  \
     if (bson_buffer_write((buffer), (data), (size)) != 0)                    \
@@ -82,16 +92,38 @@
 
 #define MAX_HOSTNAME_LENGTH 256
 
-static ID element_assignment_method;
+#if !HAVE_RUBY_ENCODING_H
+static ID ordered_keys_ivar;
+#endif
 static ID unpack_method;
 static ID utc_method;
-static ID lt_operator;
-static ID gt_operator;
+static ID data_ivar;
+static ID namespace_ivar;
+static ID object_id_ivar;
+static ID code_ivar;
+static ID scope_ivar;
+static ID seconds_ivar;
+static ID increment_ivar;
+
+static ID socket_send_probe;
+static ID socket_receive_probe;
+static ID pool_checkout_probe;
+
+BSON_PROBE_DEFINE(serialize__done);
+BSON_PROBE_DEFINE(deserialize__done);
+BSON_PROBE_DEFINE(buffer__grow);
+BSON_PROBE_DEFINE(socket__send);
+BSON_PROBE_DEFINE(socket__receive);
+BSON_PROBE_DEFINE(pool__checkout);
+
+static VALUE int64_max;
+static VALUE int64_min;
 
 static VALUE Binary;
 static VALUE ObjectId;
 static VALUE DBRef;
 static VALUE Code;
+static VALUE RawDocument;
 static VALUE MinKey;
 static VALUE MaxKey;
 static VALUE Timestamp;
@@ -104,6 +136,7 @@ static VALUE BSONRegex_DOTALL;
 static VALUE BSONRegex_LOCALE_DEPENDENT;
 static VALUE BSONRegex_UNICODE;
 static VALUE OrderedHash;
+static VALUE Column;
 static VALUE InvalidKeyName;
 static VALUE InvalidStringEncoding;
 static VALUE InvalidDocument;
@@ -115,6 +148,7 @@ static int max_bson_size;
 
 struct deserialize_opts {
     int compile_regex;
+    VALUE dbrefs;
 };
 
 #if HAVE_RUBY_ENCODING_H
@@ -214,7 +248,14 @@ static char zero = 0;
 static char one = 1;
 
 static char hostname_digest[17];
-static unsigned int object_id_inc = 0;
+
+/* Keys used for every document's _id, created once by Init_cbson. */
+static VALUE id_str = Qnil;
+static VALUE id_sym = Qnil;
+static VALUE ref_str = Qnil;
+static VALUE ref_id_str = Qnil;
+static volatile unsigned int object_id_inc = 0;
+static unsigned short object_id_pid = 0;
 
 static int cmp_char(const void* a, const void* b) {
     return *(char*)a - *(char*)b;
@@ -224,9 +265,23 @@ static void write_doc(bson_buffer_t buffer, VALUE hash, VALUE check_keys, VALUE
 static int write_element_with_id(VALUE key, VALUE value, VALUE extra);
 static int write_element_without_id(VALUE key, VALUE value, VALUE extra);
 static VALUE elements_to_hash(const char* buffer, int max, struct deserialize_opts * opts);
+static void collect_dbref(struct deserialize_opts * opts, unsigned char type,
+                          VALUE container, VALUE key, VALUE value);
 
-static VALUE pack_extra(bson_buffer_t buffer, VALUE check_keys) {
-    return rb_ary_new3(2, LL2NUM((long long)buffer), check_keys);
+/* Passed as the +extra+ argument of write_element, cast to a VALUE so it
+ * can go through rb_hash_foreach.
+ */
+struct write_state {
+    bson_buffer_t buffer;
+    VALUE check_keys;
+    VALUE mixed_id; /* for a document with both "_id" and :_id, the value of
+                     * :_id, written in place of "_id"; otherwise Qundef */
+};
+
+static void init_write_state(struct write_state* state, bson_buffer_t buffer, VALUE check_keys) {
+    state->buffer = buffer;
+    state->check_keys = check_keys;
+    state->mixed_id = Qundef;
 }
 
 static void write_name_and_type(bson_buffer_t buffer, VALUE name, char type) {
@@ -308,9 +363,31 @@ static void serialize_regex(bson_buffer_t buffer, VALUE key, VALUE pattern, long
 
 }
 
+/* Milliseconds since the epoch, rounded down, read from the Time's own
+ * seconds and nanoseconds rather than through a lossy double. */
+static long long time_to_millis(VALUE time) {
+#if HAVE_RB_TIME_TIMESPEC
+    struct timespec ts = rb_time_timespec(time);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#else
+    struct timeval tv = rb_time_timeval(time);
+    return (long long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+#endif
+}
+
 static int write_element(VALUE key, VALUE value, VALUE extra, int allow_id) {
-    bson_buffer_t buffer = (bson_buffer_t)NUM2LL(rb_ary_entry(extra, 0));
-    VALUE check_keys = rb_ary_entry(extra, 1);
+    struct write_state* state = (struct write_state*)extra;
+    bson_buffer_t buffer = state->buffer;
+    VALUE check_keys = state->check_keys;
+
+    if (state->mixed_id != Qundef) {
+        if (key == id_sym) {
+            return ST_CONTINUE;
+        }
+        if (TYPE(key) == T_STRING && RSTRING_LEN(key) == 3 && memcmp(RSTRING_PTR(key), "_id", 3) == 0) {
+            value = state->mixed_id;
+        }
+    }
 
     if (TYPE(key) == T_SYMBOL) {
         // TODO better way to do this... ?
@@ -343,8 +420,8 @@ static int write_element(VALUE key, VALUE value, VALUE extra, int allow_id) {
     switch(TYPE(value)) {
     case T_BIGNUM:
         {
-            if (rb_funcall(value, gt_operator, 1, LL2NUM(9223372036854775807LL)) == Qtrue ||
-                rb_funcall(value, lt_operator, 1, LL2NUM(-9223372036854775808ULL)) == Qtrue) {
+            if (FIX2INT(rb_big_cmp(value, int64_max)) > 0 ||
+                FIX2INT(rb_big_cmp(value, int64_min)) < 0) {
                 bson_buffer_free(buffer);
                 rb_raise(rb_eRangeError, "MongoDB can only handle 8-byte ints");
             }
@@ -417,7 +494,7 @@ static int write_element(VALUE key, VALUE value, VALUE extra, int allow_id) {
                 VALUE key;
                 INT2STRING(&name, i);
                 key = rb_str_new2(name);
-                write_element_with_id(key, rb_ary_entry(value, i), pack_extra(buffer, check_keys));
+                write_element_with_id(key, rb_ary_entry(value, i), extra);
                 FREE_INTSTRING(name);
             }
 
@@ -471,16 +548,18 @@ static int write_element(VALUE key, VALUE value, VALUE extra, int allow_id) {
             }
             if (strcmp(cls, "BSON::ObjectId") == 0) {
                 int i;
-                VALUE as_array = rb_funcall(value, rb_intern("to_a"), 0);
+                VALUE data = rb_ivar_get(value, data_ivar);
+                Check_Type(data, T_ARRAY);
                 write_name_and_type(buffer, key, 0x07);
                 for (i = 0; i < 12; i++) {
-                    char byte = (char)FIX2INT(rb_ary_entry(as_array, i));
+                    char byte = (char)FIX2INT(rb_ary_entry(data, i));
                     SAFE_WRITE(buffer, &byte, 1);
                 }
                 break;
             }
             if (strcmp(cls, "BSON::DBRef") == 0) {
                 bson_buffer_position length_location, start_position, obj_length;
+                struct write_state ref_state;
                 VALUE ns, oid;
                 write_name_and_type(buffer, key, 0x03);
 
@@ -492,10 +571,11 @@ static int write_element(VALUE key, VALUE value, VALUE extra, int allow_id) {
                     rb_raise(rb_eNoMemError, "failed to allocate memory in buffer.c");
                 }
 
-                ns = rb_funcall(value, rb_intern("namespace"), 0);
-                write_element_with_id(rb_str_new2("$ref"), ns, pack_extra(buffer, Qfalse));
-                oid = rb_funcall(value, rb_intern("object_id"), 0);
-                write_element_with_id(rb_str_new2("$id"), oid, pack_extra(buffer, Qfalse));
+                init_write_state(&ref_state, buffer, Qfalse);
+                ns = rb_ivar_get(value, namespace_ivar);
+                write_element_with_id(ref_str, ns, (VALUE)&ref_state);
+                oid = rb_ivar_get(value, object_id_ivar);
+                write_element_with_id(ref_id_str, oid, (VALUE)&ref_state);
 
                 // write null byte and fill in length
                 SAFE_WRITE(buffer, &zero, 1);
@@ -515,17 +595,25 @@ static int write_element(VALUE key, VALUE value, VALUE extra, int allow_id) {
                     rb_raise(rb_eNoMemError, "failed to allocate memory in buffer.c");
                 }
 
-                code_str = rb_funcall(value, rb_intern("code"), 0);
+                code_str = rb_ivar_get(value, code_ivar);
+                Check_Type(code_str, T_STRING);
                 length = RSTRING_LENINT(code_str) + 1;
                 SAFE_WRITE(buffer, (char*)&length, 4);
                 SAFE_WRITE(buffer, RSTRING_PTR(code_str), length - 1);
                 SAFE_WRITE(buffer, &zero, 1);
-                write_doc(buffer, rb_funcall(value, rb_intern("scope"), 0), Qfalse, Qfalse);
+                write_doc(buffer, rb_ivar_get(value, scope_ivar), Qfalse, Qfalse);
 
                 total_length = bson_buffer_get_position(buffer) - start_position;
                 SAFE_WRITE_AT_POS(buffer, length_location, (const char*)&total_length, 4);
                 break;
             }
+            if (strcmp(cls, "BSON::RawDocument") == 0) {
+                VALUE data = rb_ivar_get(value, data_ivar);
+                Check_Type(data, T_STRING);
+                write_name_and_type(buffer, key, 0x03);
+                SAFE_WRITE(buffer, RSTRING_PTR(data), RSTRING_LENINT(data));
+                break;
+            }
             if (strcmp(cls, "BSON::MaxKey") == 0) {
                 write_name_and_type(buffer, key, 0x7f);
                 break;
@@ -540,10 +628,8 @@ static int write_element(VALUE key, VALUE value, VALUE extra, int allow_id) {
 
                 write_name_and_type(buffer, key, 0x11);
 
-                seconds = NUM2UINT(
-                    rb_funcall(value, rb_intern("seconds"), 0));
-                increment = NUM2UINT(
-                    rb_funcall(value, rb_intern("increment"), 0));
+                seconds = NUM2UINT(rb_ivar_get(value, seconds_ivar));
+                increment = NUM2UINT(rb_ivar_get(value, increment_ivar));
 
                 SAFE_WRITE(buffer, (const char*)&increment, 4);
                 SAFE_WRITE(buffer, (const char*)&seconds, 4);
@@ -582,8 +668,7 @@ static int write_element(VALUE key, VALUE value, VALUE extra, int allow_id) {
         {
             const char* cls = rb_obj_classname(value);
             if (strcmp(cls, "Time") == 0) {
-                double t = NUM2DBL(rb_funcall(value, rb_intern("to_f"), 0));
-                long long time_since_epoch = (long long)round(t * 1000);
+                long long time_since_epoch = time_to_millis(value);
                 write_name_and_type(buffer, key, 0x09);
                 SAFE_WRITE(buffer, (const char*)&time_since_epoch, 8);
                 break;
@@ -629,67 +714,78 @@ static int write_element_with_id(VALUE key, VALUE value, VALUE extra) {
     return write_element(key, value, extra, 1);
 }
 
+/* Look up +key+ without calling methods on the hash or running its
+ * default proc. Returns Qundef if the key is absent.
+ */
+static VALUE hash_lookup(VALUE hash, VALUE key) {
+#if HAVE_RB_HASH_LOOKUP2
+    return rb_hash_lookup2(hash, key, Qundef);
+#else
+    if (rb_funcall(hash, rb_intern("has_key?"), 1, key) == Qtrue) {
+        return rb_hash_aref(hash, key);
+    }
+    return Qundef;
+#endif
+}
+
 static void write_doc(bson_buffer_t buffer, VALUE hash, VALUE check_keys, VALUE move_id) {
     bson_buffer_position start_position = bson_buffer_get_position(buffer);
     bson_buffer_position length_location = bson_buffer_save_space(buffer, 4);
     bson_buffer_position length;
-    int allow_id;
     int max_size;
     int (*write_function)(VALUE, VALUE, VALUE) = NULL;
-    VALUE id_str = rb_str_new2("_id");
-    VALUE id_sym = ID2SYM(rb_intern("_id"));
+    struct write_state state;
+    VALUE str_id_value, sym_id_value;
 
     if (length_location == -1) {
         rb_raise(rb_eNoMemError, "failed to allocate memory in buffer.c");
     }
+    if (rb_obj_is_kind_of(hash, RB_HASH) != Qtrue) {
+        bson_buffer_free(buffer);
+        rb_raise(InvalidDocument, "BSON.serialize takes a Hash but got a %s", rb_obj_classname(hash));
+    }
+
+    init_write_state(&state, buffer, check_keys);
+    str_id_value = hash_lookup(hash, id_str);
+    sym_id_value = hash_lookup(hash, id_sym);
 
     // write '_id' first if move_id is true. then don't allow an id to be written.
-    if(move_id == Qtrue) {
-        allow_id = 0;
-        if (rb_funcall(hash, rb_intern("has_key?"), 1, id_str) == Qtrue) {
-            VALUE id = rb_hash_aref(hash, id_str);
-            write_element_with_id(id_str, id, pack_extra(buffer, check_keys));
-        } else if (rb_funcall(hash, rb_intern("has_key?"), 1, id_sym) == Qtrue) {
-            VALUE id = rb_hash_aref(hash, id_sym);
-            write_element_with_id(id_sym, id, pack_extra(buffer, check_keys));
+    if (move_id == Qtrue) {
+        if (str_id_value != Qundef) {
+            write_element_with_id(id_str, str_id_value, (VALUE)&state);
+        } else if (sym_id_value != Qundef) {
+            write_element_with_id(id_sym, sym_id_value, (VALUE)&state);
         }
-    }
-    else {
-        allow_id = 1;
-        // Ensure that hash doesn't contain both '_id' and :_id
-        if ((rb_obj_classname(hash), "Hash") == 0) {
-            if ((rb_funcall(hash, rb_intern("has_key?"), 1, id_str) == Qtrue) &&
-                   (rb_funcall(hash, rb_intern("has_key?"), 1, id_sym) == Qtrue)) {
-                      VALUE oid_sym = rb_hash_delete(hash, id_sym);
-                      rb_funcall(hash, rb_intern("[]="), 2, id_str, oid_sym);
-            }
+        write_function = write_element_without_id;
+    } else {
+        // A hash with both '_id' and :_id is written with the value of :_id
+        // in the place of '_id', as the pure Ruby serializer does, but
+        // without modifying the hash.
+        if (str_id_value != Qundef && sym_id_value != Qundef) {
+            state.mixed_id = sym_id_value;
         }
-    }
-
-    if(allow_id == 1) {
         write_function = write_element_with_id;
     }
-    else {
-        write_function = write_element_without_id;
-    }
 
-    // we have to check for an OrderedHash and handle that specially
-    if (strcmp(rb_obj_classname(hash), "BSON::OrderedHash") == 0) {
+#if HAVE_RUBY_ENCODING_H
+    // Ruby 1.9 and later keep hashes in insertion order, so OrderedHash is
+    // a plain Hash and needs no special handling.
+    rb_hash_foreach(hash, write_function, (VALUE)&state);
+#else
+    // Under 1.8 OrderedHash keeps its order in @ordered_keys; read it directly
+    // rather than through #keys, which copies it.
+    if (rb_obj_is_kind_of(hash, OrderedHash) == Qtrue) {
+        VALUE keys = rb_iv_get(hash, "@ordered_keys");
         int i;
-        VALUE keys = rb_funcall(hash, rb_intern("keys"), 0);
 
         for(i = 0; i < RARRAY_LEN(keys); i++) {
             VALUE key = rb_ary_entry(keys, i);
-            VALUE value = rb_hash_aref(hash, key);
-
-            write_function(key, value, pack_extra(buffer, check_keys));
+            write_function(key, rb_hash_aref(hash, key), (VALUE)&state);
         }
-    } else if (rb_obj_is_kind_of(hash, RB_HASH) == Qtrue) {
-        rb_hash_foreach(hash, write_function, pack_extra(buffer, check_keys));
     } else {
-        bson_buffer_free(buffer);
-        rb_raise(InvalidDocument, "BSON.serialize takes a Hash but got a %s", rb_obj_classname(hash));
+        rb_hash_foreach(hash, write_function, (VALUE)&state);
     }
+#endif
 
     // write null byte and fill in length
     SAFE_WRITE(buffer, &zero, 1);
@@ -706,11 +802,37 @@ static void write_doc(bson_buffer_t buffer, VALUE hash, VALUE check_keys, VALUE
     SAFE_WRITE_AT_POS(buffer, length_location, (const char*)&length, 4);
 }
 
+/* A monotonic clock in nanoseconds, for probe durations. */
+static long long probe_clock(void) {
+#ifdef HAVE_SYS_SDT_H
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+#else
+    return 0;
+#endif
+}
+
 static VALUE method_serialize(VALUE self, VALUE doc, VALUE check_keys,
     VALUE move_id, VALUE max_size) {
 
     VALUE result;
-    bson_buffer_t buffer = bson_buffer_new();
+    long long started = BSON_PROBE_ENABLED(serialize__done) ? probe_clock() : 0;
+    bson_buffer_t buffer;
+
+    // A RawDocument is already serialized.
+    if (rb_obj_is_kind_of(doc, RawDocument) == Qtrue) {
+        VALUE data = rb_ivar_get(doc, data_ivar);
+        Check_Type(data, T_STRING);
+        if (RSTRING_LEN(data) > FIX2INT(max_size)) {
+            rb_raise(InvalidDocument,
+                "Document too large: This BSON document is limited to %d bytes.",
+                FIX2INT(max_size));
+        }
+        return rb_str_dup(data);
+    }
+
+    buffer = bson_buffer_new();
     if (buffer == NULL) {
         rb_raise(rb_eNoMemError, "failed to allocate memory in buffer.c");
     }
@@ -722,6 +844,9 @@ static VALUE method_serialize(VALUE self, VALUE doc, VALUE check_keys,
     if (bson_buffer_free(buffer) != 0) {
         rb_raise(rb_eRuntimeError, "failed to free buffer");
     }
+    if (BSON_PROBE_ENABLED(serialize__done)) {
+        BSON_PROBE2(serialize__done, RSTRING_LEN(result), probe_clock() - started);
+    }
     return result;
 }
 
@@ -792,6 +917,7 @@ static VALUE get_value(const char* buffer, int* position,
                 *position += key_size + 1; // just skip the key, they're in order.
                 to_append = get_value(buffer, position, type, opts);
                 rb_ary_push(value, to_append);
+                collect_dbref(opts, type, value, LONG2NUM(RARRAY_LEN(value) - 1), to_append);
             }
             (*position)++;
             break;
@@ -969,9 +1095,42 @@ static VALUE get_value(const char* buffer, int* position,
     return value;
 }
 
+/* Record where a decoded DBRef was stored, as [container, key, dbref], when
+ * the caller asked for them with the :dbrefs option. This lets the refs be
+ * resolved and replaced without walking the decoded document again.
+ */
+static void collect_dbref(struct deserialize_opts * opts, unsigned char type,
+                          VALUE container, VALUE key, VALUE value) {
+    if (NIL_P(opts->dbrefs) || (type != 3 && type != 12) || CLASS_OF(value) != DBRef) {
+        return;
+    }
+    rb_ary_push(opts->dbrefs, rb_ary_new3(3, container, key, value));
+}
+
+/* Build OrderedHash instances without calling #initialize and #[]=.
+ * Under 1.9 and later an OrderedHash is a plain Hash, so allocating it and
+ * using rb_hash_aset is all #initialize and #[]= would do. Under 1.8 the
+ * key order kept in @ordered_keys is maintained here as well. */
+static VALUE ordered_hash_new(void) {
+    VALUE hash = rb_obj_alloc(OrderedHash);
+#if !HAVE_RUBY_ENCODING_H
+    rb_ivar_set(hash, ordered_keys_ivar, rb_ary_new());
+#endif
+    return hash;
+}
+
+static void ordered_hash_aset(VALUE hash, VALUE key, VALUE value) {
+#if !HAVE_RUBY_ENCODING_H
+    if (!st_lookup(RHASH(hash)->tbl, key, 0)) {
+        rb_ary_push(rb_ivar_get(hash, ordered_keys_ivar), key);
+    }
+#endif
+    rb_hash_aset(hash, key, value);
+}
+
 static VALUE elements_to_hash(const char* buffer, int max, struct deserialize_opts * opts) {
     int position = 0;
-    VALUE hash = rb_class_new_instance(0, NULL, OrderedHash);
+    VALUE hash = ordered_hash_new();
     while (position < max) {
         VALUE value;
         unsigned char type = (unsigned char)buffer[position++];
@@ -979,7 +1138,8 @@ static VALUE elements_to_hash(const char* buffer, int max, struct deserialize_op
         VALUE name = STR_NEW(buffer + position, name_length);
         position += name_length + 1;
         value = get_value(buffer, &position, type, opts);
-        rb_funcall(hash, element_assignment_method, 2, name, value);
+        ordered_hash_aset(hash, name, value);
+        collect_dbref(opts, type, hash, name, value);
     }
     return hash;
 }
@@ -988,40 +1148,382 @@ static VALUE method_deserialize(VALUE self, VALUE bson, VALUE opts) {
     const char* buffer = RSTRING_PTR(bson);
     int remaining = RSTRING_LENINT(bson);
     struct deserialize_opts deserialize_opts;
+    long long started = BSON_PROBE_ENABLED(deserialize__done) ? probe_clock() : 0;
+    VALUE result;
 
     deserialize_opts.compile_regex = 1;
     if (rb_funcall(opts, rb_intern("has_key?"), 1, ID2SYM(rb_intern("compile_regex"))) == Qtrue &&
         rb_hash_aref(opts, ID2SYM(rb_intern("compile_regex"))) == Qfalse) {
         deserialize_opts.compile_regex = 0;
     }
+    deserialize_opts.dbrefs = rb_hash_aref(opts, ID2SYM(rb_intern("dbrefs")));
+    if (!NIL_P(deserialize_opts.dbrefs)) {
+        Check_Type(deserialize_opts.dbrefs, T_ARRAY);
+    }
 
     // NOTE we just swallow the size and end byte here
     buffer += 4;
     remaining -= 5;
 
-    return elements_to_hash(buffer, remaining, &deserialize_opts);
+    result = elements_to_hash(buffer, remaining, &deserialize_opts);
+    if (BSON_PROBE_ENABLED(deserialize__done)) {
+        BSON_PROBE2(deserialize__done, remaining + 5, probe_clock() - started);
+    }
+    return result;
 }
 
-static int legal_objectid_str(VALUE str) {
+/* Whether a tracer is attached to the driver-level probe `name`, one of
+ * :socket_send, :socket_receive or :pool_checkout. */
+static VALUE method_probe_enabled(VALUE self, VALUE name) {
+    ID id = SYM2ID(name);
+    if (id == socket_send_probe) {
+        return BSON_PROBE_ENABLED(socket__send) ? Qtrue : Qfalse;
+    } else if (id == socket_receive_probe) {
+        return BSON_PROBE_ENABLED(socket__receive) ? Qtrue : Qfalse;
+    } else if (id == pool_checkout_probe) {
+        return BSON_PROBE_ENABLED(pool__checkout) ? Qtrue : Qfalse;
+    }
+    return Qfalse;
+}
+
+/* Fire the driver-level probe `name` with two integer arguments. */
+static VALUE method_fire_probe(VALUE self, VALUE name, VALUE a, VALUE b) {
+    ID id = SYM2ID(name);
+    long long arg0 = NUM2LL(a);
+    long long arg1 = NUM2LL(b);
+    if (id == socket_send_probe) {
+        BSON_PROBE2(socket__send, arg0, arg1);
+    } else if (id == socket_receive_probe) {
+        BSON_PROBE2(socket__receive, arg0, arg1);
+    } else if (id == pool_checkout_probe) {
+        BSON_PROBE2(pool__checkout, arg0, arg1);
+    }
+    return Qnil;
+}
+
+/* Resolve the sort key `key` in the raw document `doc`. */
+static void compare_key(VALUE doc, VALUE key, unsigned char* type, const char** value) {
+    if (bson_find_path(RSTRING_PTR(doc), RSTRING_PTR(doc) + RSTRING_LEN(doc),
+                       RSTRING_PTR(key), RSTRING_LENINT(key), type, value)) {
+        rb_raise(InvalidDocument, "Cannot compare a malformed BSON document");
+    }
+}
+
+static VALUE method_compare(VALUE self, VALUE a, VALUE b, VALUE sort) {
+    const char *a_ptr, *a_end, *b_ptr, *b_end;
+    int result = 0;
     int i;
 
-    if (TYPE(str) != T_STRING) {
-        return 0;
+    StringValue(a);
+    StringValue(b);
+    a_ptr = RSTRING_PTR(a);
+    a_end = a_ptr + RSTRING_LEN(a);
+    b_ptr = RSTRING_PTR(b);
+    b_end = b_ptr + RSTRING_LEN(b);
+
+    if (NIL_P(sort)) {
+        if (bson_compare_documents(a_ptr, a_end, b_ptr, b_end, &result)) {
+            rb_raise(InvalidDocument, "Cannot compare a malformed BSON document");
+        }
+        return INT2FIX(result);
     }
 
-    if (RSTRING_LEN(str) != 24) {
-        return 0;
+    Check_Type(sort, T_ARRAY);
+    for (i = 0; i < RARRAY_LENINT(sort); i++) {
+        VALUE spec = rb_ary_entry(sort, i);
+        VALUE key;
+        unsigned char a_type, b_type;
+        const char *a_value, *b_value;
+
+        Check_Type(spec, T_ARRAY);
+        key = rb_ary_entry(spec, 0);
+        StringValue(key);
+        compare_key(a, key, &a_type, &a_value);
+        compare_key(b, key, &b_type, &b_value);
+        if (bson_compare_values(a_type, a_value, a_end, b_type, b_value, b_end, &result)) {
+            rb_raise(InvalidDocument, "Cannot compare values of key %s", StringValueCStr(key));
+        }
+        if (result) {
+            return INT2FIX(NUM2INT(rb_ary_entry(spec, 1)) < 0 ? -result : result);
+        }
     }
+    return INT2FIX(0);
+}
+
+/* The kinds of column built by decode_columns. An int64 column becomes a
+ * double column when it meets a double, and any column becomes an object
+ * column when it meets a value it cannot hold. */
+enum column_kind {
+    COLUMN_EMPTY,
+    COLUMN_INT64,
+    COLUMN_DOUBLE,
+    COLUMN_TIME,
+    COLUMN_OBJECT
+};
+
+struct column {
+    enum column_kind kind;
+    VALUE data;  /* 8 bytes per row, or an Array once kind is COLUMN_OBJECT */
+    VALUE nulls; /* one bit per row, set when the value is null or missing */
+};
 
-    for(i = 0; i < 24; i++) {
-        char c = RSTRING_PTR(str)[i];
+static int column_is_null(struct column* column, long row) {
+    return (RSTRING_PTR(column->nulls)[row >> 3] >> (row & 7)) & 1;
+}
 
-        if (!((c >= '0' && c <= '9') || (c >= 'A' && c <= 'F') || (c >= 'a' && c <= 'f'))) {
-            return 0;
+/* Turn the first `rows` rows of a packed column into Ruby values, decoding
+ * them again from the documents at `docs`, which have been checked, so
+ * that integers stay integers in a column that had become a double one. */
+static void column_to_objects(struct column* column, long rows, const char* docs,
+                              VALUE path, VALUE keep) {
+    struct deserialize_opts opts;
+    VALUE values = rb_ary_new2(rows);
+    long row;
+
+    opts.compile_regex = 1;
+    opts.dbrefs = Qnil;
+    for (row = 0; row < rows; row++) {
+        int length, position = 0;
+        unsigned char type;
+        const char* value;
+
+        memcpy(&length, docs, 4);
+        if (column_is_null(column, row)) {
+            rb_ary_push(values, Qnil);
+        } else {
+            bson_find_path(docs, docs + length, RSTRING_PTR(path), RSTRING_LENINT(path), &type, &value);
+            rb_ary_push(values, get_value(value, &position, type, &opts));
         }
+        docs += length;
     }
+    column->kind = COLUMN_OBJECT;
+    column->data = values;
+    rb_ary_push(keep, values);
+}
 
-    return 1;
+static void column_add(struct column* column, long row, unsigned char type,
+                       const char* value, const char* docs, VALUE path, VALUE keep) {
+    struct deserialize_opts opts;
+    enum column_kind kind;
+    int position = 0;
+
+    switch (type) {
+    case 0x0A:
+    case 0x06:
+        RSTRING_PTR(column->nulls)[row >> 3] |= (char)(1 << (row & 7));
+        if (column->kind == COLUMN_OBJECT) {
+            rb_ary_push(column->data, Qnil);
+        }
+        return;
+    case 0x10:
+    case 0x12:
+        kind = column->kind == COLUMN_DOUBLE ? COLUMN_DOUBLE : COLUMN_INT64;
+        break;
+    case 0x01:
+        kind = COLUMN_DOUBLE;
+        break;
+    case 0x09:
+        kind = COLUMN_TIME;
+        break;
+    default:
+        kind = COLUMN_OBJECT;
+        break;
+    }
+
+    if (column->kind == COLUMN_INT64 && kind == COLUMN_DOUBLE) {
+        long i;
+        for (i = 0; i < row; i++) {
+            long long l;
+            double d;
+            memcpy(&l, RSTRING_PTR(column->data) + i * 8, 8);
+            d = (double)l;
+            memcpy(RSTRING_PTR(column->data) + i * 8, &d, 8);
+        }
+        column->kind = COLUMN_DOUBLE;
+    } else if (column->kind == COLUMN_EMPTY && kind != COLUMN_OBJECT) {
+        column->kind = kind;
+    } else if (column->kind != kind && column->kind != COLUMN_OBJECT) {
+        column_to_objects(column, row, docs, path, keep);
+    }
+
+    switch (column->kind) {
+    case COLUMN_INT64:
+    case COLUMN_DOUBLE:
+    case COLUMN_TIME:
+        {
+            char* slot = RSTRING_PTR(column->data) + row * 8;
+            if (type == 0x10) {
+                int i;
+                memcpy(&i, value, 4);
+                if (column->kind == COLUMN_DOUBLE) {
+                    double d = (double)i;
+                    memcpy(slot, &d, 8);
+                } else {
+                    long long l = i;
+                    memcpy(slot, &l, 8);
+                }
+            } else if (type == 0x12 && column->kind == COLUMN_DOUBLE) {
+                long long l;
+                double d;
+                memcpy(&l, value, 8);
+                d = (double)l;
+                memcpy(slot, &d, 8);
+            } else {
+                memcpy(slot, value, 8);
+            }
+            break;
+        }
+    default:
+        opts.compile_regex = 1;
+        opts.dbrefs = Qnil;
+        rb_ary_push(column->data, get_value(value, &position, type, &opts));
+        break;
+    }
+}
+
+struct decode_columns_args {
+    VALUE bytes;
+    VALUE paths;
+    long rows;
+    int n;
+    struct column* columns;
+};
+
+static VALUE decode_columns(VALUE data) {
+    static const char* kind_names[] = { "object", "int64", "double", "time", "object" };
+    struct decode_columns_args* args = (struct decode_columns_args*)data;
+    struct column* columns = args->columns;
+    VALUE paths = args->paths;
+    long rows = args->rows, row;
+    int i, n = args->n;
+    const char *docs, *p, *end;
+    VALUE keep, result;
+
+    docs = p = RSTRING_PTR(args->bytes);
+    end = p + RSTRING_LEN(args->bytes);
+    keep = rb_ary_new2(n * 2);
+    for (i = 0; i < n; i++) {
+        Check_Type(rb_ary_entry(paths, i), T_STRING);
+        columns[i].kind = COLUMN_EMPTY;
+        columns[i].data = rb_str_new(NULL, rows * 8);
+        columns[i].nulls = rb_str_new(NULL, (rows + 7) / 8);
+        memset(RSTRING_PTR(columns[i].data), 0, rows * 8);
+        memset(RSTRING_PTR(columns[i].nulls), 0, (rows + 7) / 8);
+        rb_ary_push(keep, columns[i].data);
+        rb_ary_push(keep, columns[i].nulls);
+    }
+
+    for (row = 0; row < rows; row++) {
+        int length = 0;
+        if (end - p >= 5) {
+            memcpy(&length, p, 4);
+        }
+        if (length < 5 || length > end - p || p[length - 1] != '\0') {
+            rb_raise(InvalidDocument, "Cannot decode columns from a malformed BSON document");
+        }
+        for (i = 0; i < n; i++) {
+            VALUE path = rb_ary_entry(paths, i);
+            unsigned char type;
+            const char* value;
+            /* get_value trusts its input, so everything inside a value is
+             * checked before it is decoded. */
+            if (bson_find_path(p, p + length, RSTRING_PTR(path), RSTRING_LENINT(path), &type, &value) ||
+                (value && bson_check_value(type, value, p + length - 1) < 0)) {
+                rb_raise(InvalidDocument, "Cannot decode columns from a malformed BSON document");
+            }
+            column_add(&columns[i], row, type, value, docs, path, keep);
+        }
+        p += length;
+    }
+    if (p != end) {
+        rb_raise(InvalidDocument, "Found bytes after the last of %ld documents", rows);
+    }
+
+    result = rb_hash_new();
+    for (i = 0; i < n; i++) {
+        VALUE args[4];
+        if (columns[i].kind == COLUMN_EMPTY) {
+            column_to_objects(&columns[i], rows, docs, rb_ary_entry(paths, i), keep);
+        }
+        args[0] = ID2SYM(rb_intern(kind_names[columns[i].kind]));
+        args[1] = columns[i].data;
+        args[2] = columns[i].nulls;
+        args[3] = LONG2NUM(rows);
+        rb_hash_aset(result, rb_ary_entry(paths, i), rb_class_new_instance(4, args, Column));
+    }
+    RB_GC_GUARD(keep);
+    return result;
+}
+
+static VALUE free_columns(VALUE columns) {
+    xfree((struct column*)columns);
+    return Qnil;
+}
+
+static VALUE method_decode_columns(VALUE self, VALUE bytes, VALUE count, VALUE paths) {
+    struct decode_columns_args args;
+    long length;
+
+    StringValue(bytes);
+    Check_Type(paths, T_ARRAY);
+    args.bytes = bytes;
+    args.paths = paths;
+    args.rows = NUM2LONG(count);
+    length = RSTRING_LEN(bytes);
+    if (args.rows < 0 || args.rows > length / 5) {
+        rb_raise(InvalidDocument, "Cannot decode %ld documents from %ld bytes", args.rows, length);
+    }
+
+    /* The number of paths is up to the caller, so the columns go on the
+     * heap and are freed however decoding ends. */
+    args.n = RARRAY_LENINT(paths);
+    args.columns = ALLOC_N(struct column, args.n);
+    return rb_ensure(decode_columns, (VALUE)&args, free_columns, (VALUE)args.columns);
+}
+
+/* Value of each hex digit, or -1 for any other byte. Filled in by Init_cbson. */
+static signed char hex_values[256];
+static const char hex_digits[] = "0123456789abcdef";
+
+/* Parse 24 hex digits into 12 bytes. Validation and parsing are done in
+ * the same pass: any invalid digit makes the OR of the looked up values
+ * negative.
+ *
+ * Returns 1 if the string is a legal ObjectId.
+ */
+static int parse_objectid_hex(const char* hex, unsigned char* bytes) {
+    int i, bad = 0;
+
+    for (i = 0; i < 12; i++) {
+        signed char high = hex_values[(unsigned char)hex[2 * i]];
+        signed char low = hex_values[(unsigned char)hex[2 * i + 1]];
+        bad |= high | low;
+        bytes[i] = (unsigned char)((high << 4) | (low & 0x0F));
+    }
+    return bad >= 0;
+}
+
+static void format_objectid_hex(const unsigned char* bytes, char* hex) {
+    int i;
+
+    for (i = 0; i < 12; i++) {
+        hex[2 * i] = hex_digits[bytes[i] >> 4];
+        hex[2 * i + 1] = hex_digits[bytes[i] & 0x0F];
+    }
+}
+
+static int legal_objectid_str(VALUE str) {
+    unsigned char bytes[12];
+
+    if (TYPE(str) != T_STRING) {
+        return 0;
+    }
+
+    if (RSTRING_LEN(str) != 24) {
+        return 0;
+    }
+
+    return parse_objectid_hex(RSTRING_PTR(str), bytes);
 }
 
 static VALUE objectid_legal(VALUE self, VALUE str)
@@ -1031,94 +1533,156 @@ static VALUE objectid_legal(VALUE self, VALUE str)
     return Qfalse;
 }
 
-static char hexbyte( char hex ) {
-    if (hex >= '0' && hex <= '9')
-        return (hex - '0');
-    else if (hex >= 'A' && hex <= 'F')
-        return (hex - 'A' + 10);
-    else if (hex >= 'a' && hex <= 'f')
-        return (hex - 'a' + 10);
-    else
-        return 0x0;
-}
-
-static VALUE objectid_from_string(VALUE self, VALUE str)
+static VALUE objectid_data_from_string(VALUE str)
 {
     VALUE oid;
+    unsigned char bytes[12];
     int i;
 
-    if (!legal_objectid_str(str)) {
-      if (TYPE(str) == T_STRING) {
-        rb_raise(InvalidObjectId, "illegal ObjectId format: %s", RSTRING_PTR(str));
-      } else {
+    if (TYPE(str) != T_STRING) {
         VALUE inspect;
         inspect = rb_funcall(str, rb_intern("to_s"), 0);
-        rb_raise(InvalidObjectId, "not a String: %s", (char *)inspect);
-      }
+        rb_raise(InvalidObjectId, "not a String: %s", RSTRING_PTR(inspect));
+    }
+    if (RSTRING_LEN(str) != 24 || !parse_objectid_hex(RSTRING_PTR(str), bytes)) {
+        rb_raise(InvalidObjectId, "illegal ObjectId format: %s", RSTRING_PTR(str));
     }
 
     oid = rb_ary_new2(12);
-
     for(i = 0; i < 12; i++) {
-        rb_ary_store(oid, i, INT2FIX( (unsigned)(hexbyte( RSTRING_PTR(str)[2*i] ) << 4 ) | hexbyte( RSTRING_PTR(str)[2*i + 1] )));
+        rb_ary_store(oid, i, INT2FIX((unsigned int)bytes[i]));
     }
+    return oid;
+}
 
+static VALUE objectid_from_string(VALUE self, VALUE str)
+{
+    VALUE oid = objectid_data_from_string(str);
     return rb_class_new_instance(1, &oid, ObjectId);
 }
 
-static VALUE objectid_to_s(VALUE self)
+/* Convert an array of hex strings in one call. The data arrays are
+ * already validated, so the ObjectIds are allocated without running
+ * #initialize.
+ */
+static VALUE objectid_from_strings(VALUE self, VALUE strings)
+{
+    VALUE result;
+    long i;
+
+    Check_Type(strings, T_ARRAY);
+    result = rb_ary_new2(RARRAY_LEN(strings));
+    for (i = 0; i < RARRAY_LEN(strings); i++) {
+        VALUE oid = rb_obj_alloc(ObjectId);
+        rb_iv_set(oid, "@data", objectid_data_from_string(rb_ary_entry(strings, i)));
+        rb_ary_push(result, oid);
+    }
+    return result;
+}
+
+static VALUE objectid_hex_string(VALUE oid)
 {
     VALUE data;
-    char cstr[25];
-    VALUE rstr;
-    VALUE *data_arr;
+    unsigned char bytes[12];
+    char cstr[24];
+    int i;
 
-    data = rb_iv_get(self, "@data");
-    data_arr = RARRAY_PTR(data);
+    data = rb_iv_get(oid, "@data");
+    if (TYPE(data) != T_ARRAY || RARRAY_LEN(data) != 12) {
+        rb_raise(InvalidObjectId, "ObjectId requires 12 byte array");
+    }
+    for (i = 0; i < 12; i++) {
+        bytes[i] = (unsigned char)NUM2INT(RARRAY_PTR(data)[i]);
+    }
+    format_objectid_hex(bytes, cstr);
+    return rb_str_new(cstr, 24);
+}
 
-    sprintf(cstr, "%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x",
-        (unsigned)NUM2INT(data_arr[0]), (unsigned)NUM2INT(data_arr[1]), (unsigned)NUM2INT(data_arr[2]), (unsigned)NUM2INT(data_arr[3]),
-        (unsigned)NUM2INT(data_arr[4]), (unsigned)NUM2INT(data_arr[5]), (unsigned)NUM2INT(data_arr[6]), (unsigned)NUM2INT(data_arr[7]),
-        (unsigned)NUM2INT(data_arr[8]), (unsigned)NUM2INT(data_arr[9]), (unsigned)NUM2INT(data_arr[10]), (unsigned)NUM2INT(data_arr[11]));
+static VALUE objectid_to_s(VALUE self)
+{
+    return objectid_hex_string(self);
+}
 
-    rstr = rb_str_new(cstr, 24);
+static VALUE objectid_to_strings(VALUE self, VALUE oids)
+{
+    VALUE result;
+    long i;
+
+    Check_Type(oids, T_ARRAY);
+    result = rb_ary_new2(RARRAY_LEN(oids));
+    for (i = 0; i < RARRAY_LEN(oids); i++) {
+        VALUE oid = rb_ary_entry(oids, i);
+        if (!RTEST(rb_obj_is_kind_of(oid, ObjectId))) {
+            rb_raise(rb_eTypeError, "not a BSON::ObjectId");
+        }
+        rb_ary_push(result, objectid_hex_string(oid));
+    }
+    return result;
+}
+
+/* Reserve +count+ consecutive counter values and return the first.
+ *
+ * The counter is bumped atomically where the compiler supports it, so ids
+ * stay unique for callers that do not hold the GVL. Only the low three
+ * bytes are used, so wrapping the unsigned int is harmless.
+ */
+static unsigned int objectid_reserve(unsigned int count)
+{
+#if defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 1))
+    return __sync_add_and_fetch(&object_id_inc, count) - count + 1;
+#else
+    /* MRI global interpreter lock guarantees serializability. */
+    unsigned int first = object_id_inc + 1;
+    object_id_inc += count;
+    return first;
+#endif
+}
+
+/* The pid is cached, and refreshed in the child after a fork. */
+static void objectid_reset_pid(void)
+{
+    object_id_pid = htons((unsigned short)getpid());
+}
+
+/* Fill in the timestamp, machine and pid bytes shared by ids generated
+ * in the same second.
+ */
+static void objectid_prefix(unsigned char* oid_bytes, unsigned long seconds)
+{
+    unsigned long t = htonl(seconds);
+    unsigned short pid;
 
-    return rstr;
+#if HAVE_PTHREAD_ATFORK
+    pid = object_id_pid;
+#else
+    pid = htons((unsigned short)getpid());
+#endif
+    MEMCPY(oid_bytes, &t, unsigned char, 4);
+    MEMCPY(&oid_bytes[4], hostname_digest, unsigned char, 3);
+    MEMCPY(&oid_bytes[7], &pid, unsigned char, 2);
 }
 
+static void objectid_counter(unsigned char* oid_bytes, unsigned int inc)
+{
+    oid_bytes[9]  = (unsigned char)(inc >> 16);
+    oid_bytes[10] = (unsigned char)(inc >> 8);
+    oid_bytes[11] = (unsigned char)inc;
+}
 
 static VALUE objectid_generate(int argc, VALUE* args, VALUE self)
 {
     VALUE oid;
     unsigned char oid_bytes[12];
-    unsigned long t, inc;
-    unsigned short pid;
+    unsigned long t;
     int i;
 
     if(argc == 0 || (argc == 1 && *args == Qnil)) {
-        t = htonl((int)time(NULL));
+        t = (unsigned long)time(NULL);
     } else {
-        t = htonl(NUM2UINT(rb_funcall(*args, rb_intern("to_i"), 0)));
+        t = NUM2UINT(rb_funcall(*args, rb_intern("to_i"), 0));
     }
-    MEMCPY(&oid_bytes, &t, unsigned char, 4);
-
-    MEMCPY(&oid_bytes[4], hostname_digest, unsigned char, 3);
-
-    pid = htons(getpid());
-    MEMCPY(&oid_bytes[7], &pid, unsigned char, 2);
-
-    /* No need to synchronize modification of this counter between threads;
-     * MRI global interpreter lock guarantees serializability.
-     *
-     * Compiler should optimize out impossible branch.
-     */
-    if (sizeof(unsigned int) == 4) {
-        object_id_inc++;
-    } else {
-        object_id_inc = (object_id_inc + 1) % 0xFFFFFF;
-    }
-    inc = htonl(object_id_inc);
-    MEMCPY(&oid_bytes[9], ((unsigned char*)&inc + 1), unsigned char, 3);
+    objectid_prefix(oid_bytes, t);
+    objectid_counter(oid_bytes, objectid_reserve(1));
 
     oid = rb_ary_new2(12);
     for(i = 0; i < 12; i++) {
@@ -1127,6 +1691,33 @@ static VALUE objectid_generate(int argc, VALUE* args, VALUE self)
     return oid;
 }
 
+/* Generate +count+ ids into one string of 12-byte ids. The clock is read
+ * and the counter reserved once for the whole batch.
+ */
+static VALUE objectid_generate_packed(VALUE self, VALUE count)
+{
+    VALUE packed;
+    unsigned char prefix[9];
+    unsigned char* out;
+    unsigned int inc;
+    long n = NUM2LONG(count);
+    long i;
+
+    if (n < 0 || n > 0xFFFFFF) {
+        rb_raise(rb_eArgError, "count must be between 0 and 16777215");
+    }
+    packed = rb_str_new(NULL, n * 12);
+    out = (unsigned char*)RSTRING_PTR(packed);
+
+    objectid_prefix(prefix, (unsigned long)time(NULL));
+    inc = objectid_reserve((unsigned int)n);
+    for (i = 0; i < n; i++, out += 12) {
+        MEMCPY(out, prefix, unsigned char, 9);
+        objectid_counter(out, inc + (unsigned int)i);
+    }
+    return packed;
+}
+
 static VALUE method_update_max_bson_size(VALUE self, VALUE connection) {
     max_bson_size = FIX2INT(rb_funcall(connection, rb_intern("max_bson_size"), 0));
     return INT2FIX(max_bson_size);
@@ -1139,12 +1730,28 @@ static VALUE method_max_bson_size(VALUE self) {
 void Init_cbson() {
     VALUE bson, CBson, Digest, ext_version, digest;
     static char hostname[MAX_HOSTNAME_LENGTH];
+    int i;
 
-    element_assignment_method = rb_intern("[]=");
+#if !HAVE_RUBY_ENCODING_H
+    ordered_keys_ivar = rb_intern("@ordered_keys");
+#endif
     unpack_method = rb_intern("unpack");
     utc_method = rb_intern("utc");
-    lt_operator = rb_intern("<");
-    gt_operator = rb_intern(">");
+    data_ivar = rb_intern("@data");
+    namespace_ivar = rb_intern("@namespace");
+    object_id_ivar = rb_intern("@object_id");
+    code_ivar = rb_intern("@code");
+    scope_ivar = rb_intern("@scope");
+    seconds_ivar = rb_intern("@seconds");
+    increment_ivar = rb_intern("@increment");
+    socket_send_probe = rb_intern("socket_send");
+    socket_receive_probe = rb_intern("socket_receive");
+    pool_checkout_probe = rb_intern("pool_checkout");
+
+    int64_max = LL2NUM(9223372036854775807LL);
+    rb_global_variable(&int64_max);
+    int64_min = LL2NUM(-9223372036854775807LL - 1);
+    rb_global_variable(&int64_min);
 
     bson = rb_const_get(rb_cObject, rb_intern("BSON"));
     rb_require("bson/types/binary");
@@ -1155,6 +1762,8 @@ void Init_cbson() {
     DBRef = rb_const_get(bson, rb_intern("DBRef"));
     rb_require("bson/types/code");
     Code = rb_const_get(bson, rb_intern("Code"));
+    rb_require("bson/types/raw_document");
+    RawDocument = rb_const_get(bson, rb_intern("RawDocument"));
     rb_require("bson/types/min_max_keys");
     MinKey = rb_const_get(bson, rb_intern("MinKey"));
     MaxKey = rb_const_get(bson, rb_intern("MaxKey"));
@@ -1176,6 +1785,8 @@ void Init_cbson() {
     InvalidObjectId = rb_const_get(bson, rb_intern("InvalidObjectId"));
     rb_require("bson/ordered_hash");
     OrderedHash = rb_const_get(bson, rb_intern("OrderedHash"));
+    rb_require("bson/column");
+    Column = rb_const_get(bson, rb_intern("Column"));
     RB_HASH = rb_const_get(bson, rb_intern("Hash"));
 
     CBson = rb_define_module("CBson");
@@ -1185,6 +1796,26 @@ void Init_cbson() {
     rb_define_module_function(CBson, "deserialize", method_deserialize, 2);
     rb_define_module_function(CBson, "max_bson_size", method_max_bson_size, 0);
     rb_define_module_function(CBson, "update_max_bson_size", method_update_max_bson_size, 1);
+    rb_define_module_function(CBson, "compare", method_compare, 3);
+    rb_define_module_function(CBson, "decode_columns", method_decode_columns, 3);
+    rb_define_module_function(CBson, "probe_enabled?", method_probe_enabled, 1);
+    rb_define_module_function(CBson, "fire_probe", method_fire_probe, 3);
+
+    memset(hex_values, -1, sizeof(hex_values));
+    for (i = 0; i < 10; i++) {
+        hex_values['0' + i] = (signed char)i;
+    }
+    for (i = 0; i < 6; i++) {
+        hex_values['a' + i] = hex_values['A' + i] = (signed char)(10 + i);
+    }
+
+    id_str = rb_obj_freeze(rb_str_new2("_id"));
+    rb_global_variable(&id_str);
+    id_sym = ID2SYM(rb_intern("_id"));
+    ref_str = rb_obj_freeze(rb_str_new2("$ref"));
+    rb_global_variable(&ref_str);
+    ref_id_str = rb_obj_freeze(rb_str_new2("$id"));
+    rb_global_variable(&ref_id_str);
 
     rb_require("digest/md5");
     Digest = rb_const_get(rb_cObject, rb_intern("Digest"));
@@ -1192,8 +1823,16 @@ void Init_cbson() {
 
     rb_define_singleton_method(ObjectId, "legal?", objectid_legal, 1);
     rb_define_singleton_method(ObjectId, "from_string", objectid_from_string, 1);
+    rb_define_singleton_method(ObjectId, "from_strings", objectid_from_strings, 1);
+    rb_define_singleton_method(ObjectId, "to_strings", objectid_to_strings, 1);
     rb_define_method(ObjectId, "to_s", objectid_to_s, 0);
     rb_define_method(ObjectId, "generate", objectid_generate, -1);
+    rb_define_singleton_method(ObjectId, "generate_packed", objectid_generate_packed, 1);
+
+    objectid_reset_pid();
+#if HAVE_PTHREAD_ATFORK
+    pthread_atfork(NULL, NULL, objectid_reset_pid);
+#endif
 
     if (gethostname(hostname, MAX_HOSTNAME_LENGTH) != 0) {
         rb_raise(rb_eRuntimeError, "failed to get hostname");
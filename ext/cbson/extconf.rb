@@ -1,10 +1,14 @@
 require 'mkmf'
 
 have_func("asprintf")
+have_func("pthread_atfork", "pthread.h")
+have_func("rb_hash_lookup2")
+have_func("rb_time_timespec")
 
 have_header("ruby/st.h") || have_header("st.h")
 have_header("ruby/regex.h") || have_header("regex.h")
 have_header("ruby/encoding.h")
+have_header("sys/sdt.h")
 
 dir_config('cbson')
 create_makefile('bson_ext/cbson')
@@ -23,6 +23,32 @@ module BSON
     BSON_CODER.deserialize(buf, opts)
   end
 
+  # Compares two serialized documents in the server's sort order without
+  # deserializing them.
+  #
+  # @param [String] a a serialized BSON document.
+  # @param [String] b a serialized BSON document.
+  # @param [Array] sort an array of [key, direction] pairs, or nil to compare
+  #   the documents in full.
+  #
+  # @return [Integer] -1, 0 or 1.
+  def self.compare(a, b, sort=nil)
+    BSON_CODER.compare(a, b, sort)
+  end
+
+  # Decodes the given fields of a batch of serialized documents into one
+  # Column per field, without building a Hash for each document.
+  #
+  # @param [String] bytes +count+ serialized documents, one after another,
+  #   as in the body of a query reply.
+  # @param [Integer] count the number of documents.
+  # @param [Array] paths the fields to decode, as dotted paths.
+  #
+  # @return [Hash] a Column for each path.
+  def self.decode_columns(bytes, count, paths)
+    BSON_CODER.decode_columns(bytes, count, paths)
+  end
+
   # Reads a single BSON document from an IO object.
   # This method is used in the executable b2json, bundled with
   # the bson gem, for reading a file of bson documents.
@@ -101,6 +127,8 @@ end
 
 require 'base64'
 require 'bson/bson_ruby'
+require 'bson/ordering'
+require 'bson/column'
 require 'bson/byte_buffer'
 require 'bson/exceptions'
 require 'bson/ordered_hash'
@@ -110,4 +138,5 @@ require 'bson/types/dbref'
 require 'bson/types/min_max_keys'
 require 'bson/types/regex'
 require 'bson/types/object_id'
+require 'bson/types/raw_document'
 require 'bson/types/timestamp'
@@ -24,6 +24,14 @@ module BSON
       CBson.deserialize(ByteBuffer.new(buf).to_s, opts)
     end
 
+    def self.compare(a, b, sort=nil)
+      CBson.compare(a.to_s, b.to_s, sort && sort.map { |key, direction| [key.to_s, direction] })
+    end
+
+    def self.decode_columns(bytes, count, paths)
+      CBson.decode_columns(bytes.to_s, count, paths.map { |path| path.to_s })
+    end
+
     def self.max_bson_size
       warn "BSON::BSON_CODER.max_bson_size is deprecated and will be removed in v2.0."
       CBson.max_bson_size
@@ -36,6 +36,14 @@ module BSON
       callback.get
     end
 
+    def self.compare(a, b, sort=nil)
+      Ordering.compare(a.to_s, b.to_s, sort)
+    end
+
+    def self.decode_columns(bytes, count, paths)
+      Column.decode(bytes, count, paths.map { |path| path.to_s })
+    end
+
     def self.max_bson_size
       warn "BSON::BSON_CODER.max_bson_size is deprecated and will be removed in v2.0."
       Java::OrgJbson::RubyBSONEncoder.max_bson_size(self)
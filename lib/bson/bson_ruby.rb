@@ -41,7 +41,7 @@ module BSON
     NUMBER_LONG  = 18
     MAXKEY       = 127
 
-    INT32_MIN = -(1 << 31) + 1
+    INT32_MIN = -(1 << 31)
     INT32_MAX =  (1 << 31) - 1
     INT64_MIN = -2**64 / 2
     INT64_MAX =  2**64 / 2 - 1
@@ -112,7 +112,16 @@ module BSON
       new.deserialize(buf, opts)
     end
 
+    def self.compare(a, b, sort=nil)
+      Ordering.compare(a.to_s, b.to_s, sort)
+    end
+
+    def self.decode_columns(bytes, count, paths)
+      Column.decode(bytes, count, paths.map { |path| path.to_s })
+    end
+
     def serialize(obj, check_keys=false, move_id=false)
+      return serialize_raw_document(obj) if obj.is_a?(RawDocument)
       raise(InvalidDocument, "BSON.serialize takes a Hash but got a #{obj.class}") unless obj.is_a?(Hash)
       raise "Document is null" unless obj
 
@@ -144,6 +153,17 @@ module BSON
       @buf
     end
 
+    # A RawDocument is copied as it is.
+    def serialize_raw_document(doc)
+      if doc.size > @buf.max_size
+        raise InvalidDocument, "Document is too large (#{doc.size}). " +
+         "This BSON document is limited to #{@buf.max_size} bytes."
+      end
+      @buf.rewind
+      @buf.put_binary(doc.to_s)
+      @buf
+    end
+
     # Returns the array stored in the buffer.
     # Implemented to ensure an API compatible with BSON extension.
     def unpack
@@ -240,6 +260,7 @@ module BSON
         when OBJECT
           key = deserialize_cstr(@buf)
           doc[key] = deserialize_object_data(@buf, opts)
+          collect_dbref(opts, doc, key)
         when BOOLEAN
           key = deserialize_cstr(@buf)
           doc[key] = deserialize_boolean_data(@buf)
@@ -255,6 +276,7 @@ module BSON
         when REF
           key = deserialize_cstr(@buf)
           doc[key] = deserialize_dbref_data(@buf)
+          collect_dbref(opts, doc, key)
         when BINARY
           key = deserialize_cstr(@buf)
           doc[key] = deserialize_binary_data(@buf)
@@ -328,12 +350,27 @@ module BSON
     end
 
     def deserialize_array_data(buf, opts={})
+      collected = opts[:dbrefs] && opts[:dbrefs].size
       h = deserialize_object_data(buf, opts)
       a = []
       h.each { |k, v| a[k.to_i] = v }
+      if collected
+        # Point refs stored directly in the array at the array.
+        opts[:dbrefs][collected..-1].each do |entry|
+          entry[0], entry[1] = a, entry[1].to_i if entry[0].equal?(h)
+        end
+      end
       a
     end
 
+    # Record where a DBRef was stored, as [container, key, dbref], when the
+    # :dbrefs option asks for them.
+    def collect_dbref(opts, doc, key)
+      if opts[:dbrefs] && doc[key].is_a?(DBRef)
+        opts[:dbrefs] << [doc, key, doc[key]]
+      end
+    end
+
     def deserialize_regex_data(buf, opts={})
       compile = opts.key?(:compile_regex) ? opts[:compile_regex] : true
       compile = true if compile.nil?
@@ -445,7 +482,8 @@ module BSON
     def serialize_date_element(buf, key, val)
       buf.put(DATE)
       self.class.serialize_key(buf, key)
-      millisecs = (val.to_f * 1000).to_i
+      # Whole milliseconds, rounded down, computed without going through a Float.
+      millisecs = val.to_i * 1000 + val.usec / 1000
       buf.put_long(millisecs)
     end
 
@@ -473,7 +511,11 @@ module BSON
     def serialize_object_element(buf, key, val, check_keys, opcode=OBJECT)
       buf.put(opcode)
       self.class.serialize_key(buf, key)
-      buf.put_array(@encoder.new.serialize(val, check_keys).to_a)
+      if val.is_a?(RawDocument)
+        buf.put_binary(val.to_s)
+      else
+        buf.put_array(@encoder.new.serialize(val, check_keys).to_a)
+      end
     end
 
     def serialize_array_element(buf, key, val, check_keys)
@@ -614,7 +656,7 @@ module BSON
         BOOLEAN
       when Time
         DATE
-      when Hash
+      when Hash, RawDocument
         OBJECT
       when Symbol
         SYMBOL
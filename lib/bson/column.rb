@@ -0,0 +1,151 @@
+# Copyright (C) 2009-2013 MongoDB, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+module BSON
+
+  # The values of one field across a batch of documents, as decoded by
+  # BSON.decode_columns.
+  #
+  # A column holding only integers, only doubles and integers, or only
+  # dates is packed: +data+ is a binary String of one little-endian 8-byte
+  # value per row, an int64 for +:int64+, a double for +:double+ and
+  # milliseconds since the epoch for +:time+. Any other column has type
+  # +:object+ and +data+ is an Array of the decoded values. In every case
+  # bit +i+ of +nulls+ (least significant bit first) is set when row +i+ is
+  # null or missing; packed columns hold 0 in those rows.
+  #
+  # Each batch is typed on its own, so the same field can decode to
+  # different types in different batches.
+  class Column
+    include Enumerable
+
+    attr_reader :type, :data, :nulls, :size
+
+    def initialize(type, data, nulls, size)
+      @type  = type
+      @data  = data
+      @nulls = nulls
+      @size  = size
+    end
+
+    def packed?
+      @type != :object
+    end
+
+    def null?(row)
+      (@nulls.unpack("@#{row >> 3}C")[0] >> (row & 7)) & 1 == 1
+    end
+
+    def null_count
+      (0...@size).inject(0) { |count, row| null?(row) ? count + 1 : count }
+    end
+
+    # The value of a row, or nil if it is null or missing.
+    def [](row)
+      return nil if row < 0 || row >= @size || null?(row)
+      case @type
+      when :object then @data[row]
+      when :double then @data.unpack("@#{row * 8}E")[0]
+      when :int64  then Ordering.int64(@data, row * 8)
+      when :time
+        millis = Ordering.int64(@data, row * 8)
+        Time.at(millis / 1000, (millis % 1000) * 1000).utc
+      end
+    end
+
+    def each
+      (0...@size).each { |row| yield self[row] }
+      self
+    end
+
+    def to_a
+      @type == :object ? @data.dup : super
+    end
+
+    def inspect
+      "#<BSON::Column #{@type} (#{@size} rows)>"
+    end
+
+    # The pure Ruby implementation of BSON.decode_columns, used when the C
+    # extension is not loaded.
+    def self.decode(bytes, count, paths)
+      bytes = Ordering.binary(bytes.to_s)
+      if count < 0 || count > bytes.length / 5
+        raise InvalidDocument, "Cannot decode #{count} documents from #{bytes.length} bytes"
+      end
+
+      found = paths.map { [] }
+      pos   = 0
+      count.times do
+        length = bytes.length - pos >= 5 ? Ordering.int32(bytes, pos) : 0
+        if length < 5 || length > bytes.length - pos || Ordering.byte(bytes, pos + length - 1) != 0
+          raise InvalidDocument, "Cannot decode columns from a malformed BSON document"
+        end
+        doc = bytes[pos, length]
+        paths.each_with_index { |path, i| found[i] << Ordering.find_path(doc, 0, path).push(doc) }
+        pos += length
+      end
+      raise InvalidDocument, "Found bytes after the last of #{count} documents" if pos != bytes.length
+
+      result = {}
+      paths.each_with_index { |path, i| result[path] = build(found[i]) }
+      result
+    rescue ArgumentError, TypeError, NoMethodError, RuntimeError => e
+      raise if e.is_a?(InvalidDocument)
+      raise InvalidDocument, "Cannot decode columns from a malformed BSON document"
+    end
+
+    # Build a column from the [type, offset, document] found in each row.
+    def self.build(rows)
+      null_types = [BSON_RUBY::NULL, BSON_RUBY::UNDEFINED]
+      int_types  = [BSON_RUBY::NUMBER_INT, BSON_RUBY::NUMBER_LONG]
+
+      nulls = Array.new((rows.size + 7) / 8, 0)
+      rows.each_with_index { |(type, _, _), row| nulls[row >> 3] |= 1 << (row & 7) if null_types.include?(type) }
+      types = rows.map { |type, _, _| type }.uniq - null_types
+      nulls = nulls.pack("C*")
+
+      kind = if types.empty? then :object
+             elsif (types - int_types).empty? then :int64
+             elsif (types - int_types - [BSON_RUBY::NUMBER]).empty? then :double
+             elsif types == [BSON_RUBY::DATE] then :time
+             else :object
+             end
+
+      data = rows.map do |type, pos, doc|
+        if null_types.include?(type)
+          kind == :object ? nil : 0
+        elsif kind == :object
+          value(type, doc, pos)
+        elsif type == BSON_RUBY::DATE
+          Ordering.int64(doc, pos)
+        else
+          Ordering.number(type, doc, pos)
+        end
+      end
+      unless kind == :object
+        data = data.map do |n|
+          kind == :double ? [n.to_f].pack("E") : [n & 0xFFFFFFFF, (n >> 32) & 0xFFFFFFFF].pack("VV")
+        end.join
+      end
+      new(kind, data, nulls, rows.size)
+    end
+
+    # Decode a single value by wrapping it in a one element document.
+    def self.value(type, doc, pos)
+      element = [type].pack("C") + "v\x00" + doc[pos, Ordering.value_size(type, doc, pos)]
+      BSON_RUBY.deserialize([element.length + 5].pack("V") + element + "\x00")['v']
+    end
+  end
+end
@@ -20,6 +20,10 @@
 module BSON
   class OrderedHash < Hash
 
+    # The serialized document this one was decoded from, kept by cursors
+    # created with the :track_changes option. See Collection#save_changes.
+    attr_accessor :original_bson
+
     def ==(other)
       begin
         case other
@@ -0,0 +1,249 @@
+# Copyright (C) 2009-2013 MongoDB, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+module BSON
+
+  # Compares serialized BSON documents using the server's sort order,
+  # without deserializing them. This is the pure Ruby counterpart of
+  # ext/cbson/bson_ordering.c and is used when the C extension is not loaded.
+  #
+  # Values are ranked by type bracket first (MinKey, null, numbers, strings,
+  # objects, arrays, binary, ObjectId, booleans, dates, timestamps, regexes,
+  # ..., MaxKey) and compared by value within a bracket. Integers and doubles
+  # share a bracket and compare numerically. A sort key missing from a
+  # document sorts as null. Unlike the server, a sort key holding an array is
+  # compared as a whole array rather than by its smallest or largest element.
+  module Ordering
+    NUL          = "\x00"
+    MINKEY_BYTE  = 255
+
+    RANKS = {
+      MINKEY_BYTE                => -1,
+      BSON_RUBY::UNDEFINED       => 0,
+      BSON_RUBY::NULL            => 5,
+      BSON_RUBY::NUMBER          => 10,
+      BSON_RUBY::NUMBER_INT      => 10,
+      BSON_RUBY::NUMBER_LONG     => 10,
+      BSON_RUBY::STRING          => 15,
+      BSON_RUBY::SYMBOL          => 15,
+      BSON_RUBY::OBJECT          => 20,
+      BSON_RUBY::ARRAY           => 25,
+      BSON_RUBY::BINARY          => 30,
+      BSON_RUBY::OID             => 35,
+      BSON_RUBY::BOOLEAN         => 40,
+      BSON_RUBY::DATE            => 45,
+      BSON_RUBY::TIMESTAMP       => 47,
+      BSON_RUBY::REGEX           => 50,
+      BSON_RUBY::REF             => 55,
+      BSON_RUBY::CODE            => 60,
+      BSON_RUBY::CODE_W_SCOPE    => 65,
+      BSON_RUBY::MAXKEY          => 127
+    }
+
+    # Compare two serialized documents.
+    #
+    # @param [String] a a serialized BSON document.
+    # @param [String] b a serialized BSON document.
+    # @param [Array] sort an array of [key, direction] pairs, where key may be
+    #   a dotted path and direction is 1 or -1. When nil the documents are
+    #   compared in full, field by field.
+    #
+    # @return [Integer] -1, 0 or 1.
+    #
+    # @raise [InvalidDocument] if either document is malformed.
+    def self.compare(a, b, sort=nil)
+      a, b = binary(a), binary(b)
+      unless framed?(a) && framed?(b)
+        raise InvalidDocument, "Cannot compare a malformed BSON document"
+      end
+      return compare_documents(a, 0, b, 0) unless sort
+
+      sort.each do |key, direction|
+        path = binary(key.to_s)
+        a_type, a_pos = find_path(a, 0, path)
+        b_type, b_pos = find_path(b, 0, path)
+        result = compare_values(a_type, a, a_pos, b_type, b, b_pos)
+        return direction < 0 ? -result : result unless result == 0
+      end
+      0
+    rescue ArgumentError, TypeError, NoMethodError
+      raise InvalidDocument, "Cannot compare a malformed BSON document"
+    end
+
+    if RUBY_VERSION >= '1.9'
+      def self.binary(str)
+        str.encoding == BSON_RUBY::BINARY_ENCODING ? str : str.dup.force_encoding(BSON_RUBY::BINARY_ENCODING)
+      end
+    else
+      def self.binary(str)
+        str
+      end
+    end
+
+    def self.framed?(str)
+      str.length >= 5 && int32(str, 0) == str.length && byte(str, str.length - 1) == 0
+    end
+
+    def self.rank(type)
+      RANKS[type] or raise InvalidDocument, "Cannot compare values of BSON type #{type}"
+    end
+
+    def self.byte(str, pos)
+      str.unpack("@#{pos}C")[0]
+    end
+
+    def self.int32(str, pos)
+      value = str.unpack("@#{pos}V")[0]
+      value >= 2**31 ? value - 2**32 : value
+    end
+
+    def self.uint64(str, pos)
+      low, high = str.unpack("@#{pos}VV")
+      (high << 32) | low
+    end
+
+    def self.int64(str, pos)
+      value = uint64(str, pos)
+      value >= 2**63 ? value - 2**64 : value
+    end
+
+    def self.cstring(str, pos)
+      str[pos...str.index(NUL, pos)]
+    end
+
+    def self.string(str, pos)
+      str[pos + 4, int32(str, pos) - 1]
+    end
+
+    def self.number(type, str, pos)
+      case type
+      when BSON_RUBY::NUMBER then str.unpack("@#{pos}E")[0]
+      when BSON_RUBY::NUMBER_INT then int32(str, pos)
+      else int64(str, pos)
+      end
+    end
+
+    def self.value_size(type, str, pos)
+      case type
+      when BSON_RUBY::UNDEFINED, BSON_RUBY::NULL, MINKEY_BYTE, BSON_RUBY::MAXKEY then 0
+      when BSON_RUBY::BOOLEAN then 1
+      when BSON_RUBY::NUMBER_INT then 4
+      when BSON_RUBY::NUMBER, BSON_RUBY::DATE, BSON_RUBY::TIMESTAMP, BSON_RUBY::NUMBER_LONG then 8
+      when BSON_RUBY::OID then 12
+      when BSON_RUBY::STRING, BSON_RUBY::CODE, BSON_RUBY::SYMBOL then 4 + int32(str, pos)
+      when BSON_RUBY::OBJECT, BSON_RUBY::ARRAY, BSON_RUBY::CODE_W_SCOPE then int32(str, pos)
+      when BSON_RUBY::BINARY then 5 + int32(str, pos)
+      when BSON_RUBY::REGEX then str.index(NUL, str.index(NUL, pos) + 1) + 1 - pos
+      when BSON_RUBY::REF then 16 + int32(str, pos)
+      else raise InvalidDocument, "Cannot compare values of BSON type #{type}"
+      end
+    end
+
+    # Returns the type and offset of the value at the dotted path, or
+    # [NULL, nil] when the path is missing.
+    def self.find_path(str, pos, path)
+      name, rest = path.split('.', 2)
+      stop = pos + int32(str, pos) - 1
+      pos += 4
+
+      while pos < stop
+        type = byte(str, pos)
+        key = cstring(str, pos + 1)
+        pos += key.length + 2
+        if key == name
+          return [type, pos] unless rest
+          break unless type == BSON_RUBY::OBJECT || type == BSON_RUBY::ARRAY
+          return find_path(str, pos, rest)
+        end
+        pos += value_size(type, str, pos)
+      end
+      [BSON_RUBY::NULL, nil]
+    end
+
+    def self.compare_numbers(a, b)
+      a_nan = a.is_a?(Float) && a.nan?
+      b_nan = b.is_a?(Float) && b.nan?
+      return (a_nan ? 0 : 1) <=> (b_nan ? 0 : 1) if a_nan || b_nan
+      a <=> b
+    end
+
+    def self.compare_values(a_type, a, a_pos, b_type, b, b_pos)
+      result = rank(a_type) <=> rank(b_type)
+      return result unless result == 0
+
+      case a_type
+      when BSON_RUBY::NUMBER, BSON_RUBY::NUMBER_INT, BSON_RUBY::NUMBER_LONG
+        compare_numbers(number(a_type, a, a_pos), number(b_type, b, b_pos))
+      when BSON_RUBY::STRING, BSON_RUBY::SYMBOL, BSON_RUBY::CODE
+        string(a, a_pos) <=> string(b, b_pos)
+      when BSON_RUBY::OBJECT, BSON_RUBY::ARRAY
+        compare_documents(a, a_pos, b, b_pos)
+      when BSON_RUBY::BINARY
+        # Length first, then subtype, then the bytes themselves.
+        [int32(a, a_pos), byte(a, a_pos + 4), a[a_pos + 5, int32(a, a_pos)]] <=>
+          [int32(b, b_pos), byte(b, b_pos + 4), b[b_pos + 5, int32(b, b_pos)]]
+      when BSON_RUBY::OID
+        a[a_pos, 12] <=> b[b_pos, 12]
+      when BSON_RUBY::BOOLEAN
+        (byte(a, a_pos) == 0 ? 0 : 1) <=> (byte(b, b_pos) == 0 ? 0 : 1)
+      when BSON_RUBY::DATE
+        int64(a, a_pos) <=> int64(b, b_pos)
+      when BSON_RUBY::TIMESTAMP
+        uint64(a, a_pos) <=> uint64(b, b_pos)
+      when BSON_RUBY::REGEX
+        a_pattern, b_pattern = cstring(a, a_pos), cstring(b, b_pos)
+        [a_pattern, cstring(a, a_pos + a_pattern.length + 1)] <=>
+          [b_pattern, cstring(b, b_pos + b_pattern.length + 1)]
+      when BSON_RUBY::REF
+        a_size, b_size = value_size(a_type, a, a_pos), value_size(b_type, b, b_pos)
+        [string(a, a_pos), a[a_pos + a_size - 12, 12]] <=>
+          [string(b, b_pos), b[b_pos + b_size - 12, 12]]
+      when BSON_RUBY::CODE_W_SCOPE
+        result = string(a, a_pos + 4) <=> string(b, b_pos + 4)
+        return result unless result == 0
+        compare_documents(a, a_pos + 8 + int32(a, a_pos + 4), b, b_pos + 8 + int32(b, b_pos + 4))
+      else
+        0
+      end
+    end
+
+    # Elements compare pairwise by type bracket, field name and value; a
+    # document that is a prefix of the other sorts first.
+    def self.compare_documents(a, a_pos, b, b_pos)
+      a_stop = a_pos + int32(a, a_pos) - 1
+      b_stop = b_pos + int32(b, b_pos) - 1
+      a_pos += 4
+      b_pos += 4
+
+      while a_pos < a_stop && b_pos < b_stop
+        a_type, b_type = byte(a, a_pos), byte(b, b_pos)
+        result = rank(a_type) <=> rank(b_type)
+        return result unless result == 0
+
+        a_name, b_name = cstring(a, a_pos + 1), cstring(b, b_pos + 1)
+        result = a_name <=> b_name
+        return result unless result == 0
+
+        a_pos += a_name.length + 2
+        b_pos += b_name.length + 2
+        result = compare_values(a_type, a, a_pos, b_type, b, b_pos)
+        return result unless result == 0
+
+        a_pos += value_size(a_type, a, a_pos)
+        b_pos += value_size(b_type, b, b_pos)
+      end
+      (a_pos < a_stop ? 1 : 0) <=> (b_pos < b_stop ? 1 : 0)
+    end
+  end
+end
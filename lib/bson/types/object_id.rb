@@ -51,7 +51,7 @@ module BSON
     #
     # @return [Boolean]
     def self.legal?(str)
-      str =~ /\A[0-9a-f]{24}\z/i ? true : false
+      str.is_a?(String) && str =~ /\A[0-9a-f]{24}\z/i ? true : false
     end
 
     # Create an object id from the given time. This is useful for doing range
@@ -79,6 +79,23 @@ module BSON
       end
     end
 
+    # Generate many object ids at once. The clock is read and the counter
+    # advanced once for the whole batch, which makes this much cheaper than
+    # calling ObjectId.new in a loop when minting ids for bulk loads.
+    #
+    # @param [Integer] count the number of ids to generate, at most 16777215
+    #   so that ids in one batch cannot collide.
+    #
+    # @option opts [Boolean] :packed (false) return the ids as a single binary
+    #   string of consecutive 12-byte ids rather than as ObjectId instances.
+    #
+    # @return [Array<BSON::ObjectId>, String]
+    def self.generate_many(count, opts={})
+      packed = generate_packed(count)
+      return packed if opts[:packed]
+      packed.unpack("C*").each_slice(12).map { |data| self.new(data) }
+    end
+
     # Adds a primary key to the given document if needed.
     #
     # @param [Hash] doc a document requiring an _id.
@@ -120,18 +137,37 @@ module BSON
     # @return [BSON::ObjectId]
     def self.from_string(str)
       raise InvalidObjectId, "illegal ObjectId format: #{str}" unless legal?(str)
-      data = []
-      12.times do |i|
-        data[i] = str[i * 2, 2].to_i(16)
+      self.new([str].pack("H24").unpack("C12"))
+    end
+
+    # Convert an array of hex strings to object ids.
+    #
+    # @param [Array<String>] strings
+    #
+    # @raise [InvalidObjectId] if any string is not a legal object id.
+    #
+    # @return [Array<BSON::ObjectId>]
+    def self.from_strings(strings)
+      strings.map { |str| from_string(str) }
+    end
+
+    # Convert an array of object ids to hex strings.
+    #
+    # @param [Array<BSON::ObjectId>] object_ids
+    #
+    # @return [Array<String>]
+    def self.to_strings(object_ids)
+      object_ids.map do |object_id|
+        raise TypeError, "not a BSON::ObjectId" unless object_id.is_a?(ObjectId)
+        object_id.to_s
       end
-      self.new(data)
     end
 
     # Get a string representation of this object id.
     #
     # @return [String]
     def to_s
-      @data.map {|e| v=e.to_s(16); v.size == 1 ? "0#{v}" : v }.join
+      @data.pack("C12").unpack("H24")[0]
     end
 
     def inspect
@@ -183,6 +219,13 @@ module BSON
         oid.unpack("C12")
       end
 
+      def self.generate_packed(count)
+        raise ArgumentError, "count must be between 0 and 16777215" unless (0..0xFFFFFF).include?(count)
+        packed = ''
+        count.times { packed << new.data.pack("C12") }
+        packed
+      end
+
     else
       @@lock  = Mutex.new
       @@index = 0
@@ -220,6 +263,24 @@ module BSON
             @@index = (@@index + 1) % 0xFFFFFF
           end
         end
+
+        # Reserves a block of +count+ counters with a single lock acquisition.
+        # This gets overwritten by the C extension if it loads.
+        def self.generate_packed(count)
+          raise ArgumentError, "count must be between 0 and 16777215" unless (0..0xFFFFFF).include?(count)
+          first = @@lock.synchronize do
+            start = @@index
+            @@index = (@@index + count) % 0xFFFFFF
+            start + 1
+          end
+
+          prefix = [Time.new.to_i].pack("N") + @@machine_id + [Process.pid % 0xFFFF].pack("n")
+          packed = ''
+          count.times do |i|
+            packed << prefix << [(first + i) % 0xFFFFFF].pack("N")[1, 3]
+          end
+          packed
+        end
       end
     end
   end
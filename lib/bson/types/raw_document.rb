@@ -0,0 +1,74 @@
+# Copyright (C) 2009-2013 MongoDB, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+module BSON
+
+  # A document that has already been serialized.
+  #
+  # The serializers copy its bytes unchanged wherever it appears: as the
+  # document being serialized, as an embedded document or as an element of
+  # an array. Only the length prefix and terminating null are checked, so
+  # keys are not validated and _id is not moved to the front.
+  #
+  # @example Serialize once, insert into several collections:
+  #   doc = BSON::RawDocument.new(BSON::BSON_CODER.serialize(event, true, true))
+  #   db['events'].insert(doc)
+  #   db['audit'].insert(doc)
+  class RawDocument
+
+    # @return [String] the serialized document.
+    attr_reader :data
+
+    # @param [String, ByteBuffer] bson a serialized document.
+    #
+    # @raise [InvalidDocument] if the length prefix does not match.
+    def initialize(bson)
+      @data = bson.to_s
+      @data.force_encoding('binary') if @data.respond_to?(:force_encoding)
+
+      unless @data.size >= 5 && @data.unpack('V')[0] == @data.size && @data[-1, 1] == NULL_BYTE
+        raise InvalidDocument, "BSON::RawDocument takes a serialized document"
+      end
+    end
+
+    def to_s
+      @data
+    end
+
+    def size
+      @data.size
+    end
+
+    # @return [Hash] the document, deserialized the first time it is needed.
+    def to_hash
+      @document ||= BSON::BSON_CODER.deserialize(@data)
+    end
+
+    def [](key)
+      to_hash[key.to_s]
+    end
+
+    def keys
+      to_hash.keys
+    end
+
+    def ==(other)
+      other.class == RawDocument && other.data == @data
+    end
+
+    def inspect
+      "<BSON::RawDocument:#{object_id} #{to_hash.inspect}>"
+    end
+  end
+end
@@ -36,13 +36,14 @@ module Mongo
 
   module Constants
     OP_REPLY        = 1
-    OP_MSG          = 1000
+    OP_LEGACY_MSG   = 1000
     OP_UPDATE       = 2001
     OP_INSERT       = 2002
     OP_QUERY        = 2004
     OP_GET_MORE     = 2005
     OP_DELETE       = 2006
     OP_KILL_CURSORS = 2007
+    OP_MSG          = 2013
 
     OP_QUERY_TAILABLE          = 2 ** 1
     OP_QUERY_SLAVE_OK          = 2 ** 2
@@ -87,11 +88,18 @@ require 'mongo/functional'
 require 'mongo/connection'
 require 'mongo/collection_writer'
 require 'mongo/collection'
+require 'mongo/coalescing_writer'
+require 'mongo/batch_loader'
+require 'mongo/importer'
 require 'mongo/bulk_write_collection_view'
 require 'mongo/cursor'
+require 'mongo/merged_cursor'
+require 'mongo/prepared_query'
+require 'mongo/query_cache'
 require 'mongo/db'
 require 'mongo/gridfs'
 require 'mongo/networking'
+require 'mongo/async'
 require 'mongo/mongo_client'
 require 'mongo/mongo_replica_set_client'
 require 'mongo/mongo_sharded_client'
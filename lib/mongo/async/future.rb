@@ -0,0 +1,160 @@
+# Copyright (C) 2009-2013 MongoDB, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+module Mongo
+
+  # The eventual result of an operation issued through a Reactor.
+  #
+  # Futures are returned by the *_async methods on Collection, DB and
+  # Cursor. Calling Future#value drives the reactor of the thread that
+  # issued the operation until this future, and any replies that arrive
+  # ahead of it, have been processed.
+  #
+  # Futures are not shared across threads: resolve them on the thread
+  # that created them.
+  #
+  # @example Issue several lookups and wait for all of them
+  #   futures = ids.map { |id| users.find_one_async(:_id => id) }
+  #   docs    = futures.map(&:value)
+  class Future
+
+    attr_reader :reactor
+
+    # Create a future that is already resolved with the given value.
+    #
+    # @return [Future]
+    def self.resolved(reactor, value)
+      future = new(reactor)
+      future.resolve(value)
+      future
+    end
+
+    def initialize(reactor)
+      @reactor   = reactor
+      @done      = false
+      @value     = nil
+      @error     = nil
+      @callbacks = []
+    end
+
+    # Whether the operation has completed, successfully or not.
+    #
+    # @return [Boolean]
+    def ready?
+      @done
+    end
+
+    # Whether the operation completed with an error.
+    #
+    # @return [Boolean]
+    def failed?
+      @done && !@error.nil?
+    end
+
+    # The error the operation failed with, if any. Does not block.
+    #
+    # @return [Exception, nil]
+    def error
+      @error
+    end
+
+    # Block until the operation completes.
+    #
+    # @return [Future] self
+    def wait
+      @reactor.run_until { @done } unless @done
+      self
+    end
+
+    # Block until the operation completes and return its result.
+    #
+    # @raise [Exception] the error the operation failed with.
+    def value
+      wait
+      raise @error if @error
+      @value
+    end
+
+    # Return a new future resolved with the result of the block applied to
+    # this future's value. Errors propagate to the new future untouched.
+    #
+    # @return [Future]
+    def then(&block)
+      chained = Future.new(@reactor)
+      on_complete do |value, error|
+        error ? chained.reject(error) : chained.complete { block.call(value) }
+      end
+      chained
+    end
+
+    # Return a new future which, if this one fails, is resolved with the
+    # result of the block applied to the error. The block may re-raise.
+    #
+    # @return [Future]
+    def recover(&block)
+      chained = Future.new(@reactor)
+      on_complete do |value, error|
+        error ? chained.complete { block.call(error) } : chained.resolve(value)
+      end
+      chained
+    end
+
+    # Register a block to be called with (value, error) once the operation
+    # completes. Runs immediately if it has already completed.
+    #
+    # @return [Future] self
+    def on_complete(&block)
+      @done ? block.call(@value, @error) : @callbacks << block
+      self
+    end
+
+    # Resolve this future with the value of the block, or reject it with
+    # whatever the block raises.
+    #
+    # @private
+    def complete
+      begin
+        value = yield
+      rescue => ex
+        return reject(ex)
+      end
+      resolve(value)
+    end
+
+    # @private
+    def resolve(value)
+      finish(value, nil)
+    end
+
+    # @private
+    def reject(error)
+      finish(nil, error)
+    end
+
+    def inspect
+      state = @done ? (@error ? "failed" : "resolved") : "pending"
+      "#<Mongo::Future:0x#{self.object_id.to_s(16)} #{state}>"
+    end
+
+    private
+
+    def finish(value, error)
+      return false if @done
+      @value, @error, @done = value, error, true
+      callbacks, @callbacks = @callbacks, []
+      callbacks.each { |callback| callback.call(value, error) }
+      true
+    end
+  end
+end
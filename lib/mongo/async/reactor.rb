@@ -0,0 +1,232 @@
+# Copyright (C) 2009-2013 MongoDB, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+module Mongo
+
+  # Multiplexes asynchronous operations for a single thread.
+  #
+  # Each thread gets its own reactor per client (see MongoClient#reactor).
+  # Operations are written to a socket as soon as they are dispatched and
+  # their replies are read later, when a future is waited on, by selecting
+  # over every socket that has replies outstanding. A reactor holds up to
+  # +max_sockets_per_pool+ sockets per pool and pipelines further requests
+  # on the least busy of them, so a single thread can keep dozens of
+  # operations in flight. Sockets are returned to their pools once all of
+  # their replies have been read.
+  class Reactor
+
+    DEFAULT_MAX_SOCKETS_PER_POOL = 4
+
+    attr_reader :client, :max_sockets_per_pool
+
+    # @param [MongoClient] client
+    #
+    # @option opts [Integer] :max_sockets_per_pool (4) The number of sockets
+    #   this reactor may hold per pool before it starts pipelining requests.
+    def initialize(client, opts={})
+      @client               = client
+      @max_sockets_per_pool = opts.fetch(:max_sockets_per_pool, DEFAULT_MAX_SOCKETS_PER_POOL)
+      @sockets              = {}
+      @in_flight            = {}
+    end
+
+    # Write a message to a socket from the given pool and return a future
+    # for its reply. The block, if given, receives the decoded reply as
+    # (documents, number_received, cursor_id) and its return value becomes
+    # the value of the future.
+    #
+    # @param [Pool] pool
+    # @param [Integer] operation a MongoDB opcode.
+    # @param [BSON::ByteBuffer] message
+    #
+    # @option opts [String] :gle_db (nil) Follow the message with a
+    #   getlasterror on this database and wait for that reply instead.
+    # @option opts [Hash] :write_concern the getlasterror write concern.
+    # @option opts [Boolean] :compile_regex (true) whether BSON regex objects
+    #   should be compiled into Ruby regexes.
+    # @option opts [Boolean] :raw (false) leave reply documents serialized.
+    #
+    # @return [Future]
+    def dispatch(pool, operation, message, opts={}, &block)
+      future = Future.new(self)
+      socket = nil
+      begin
+        socket = acquire_socket(pool)
+        request_id = @client.dispatch_message(operation, message, socket,
+                                              opts[:gle_db], opts[:write_concern])
+      rescue => ex
+        abandon(socket, ex) if socket
+        future.reject(ex)
+        return future
+      end
+
+      read_opts = { :compile_regex => opts.fetch(:compile_regex, true),
+                    :raw           => opts.fetch(:raw, false) }
+      (@in_flight[socket] ||= []) << [request_id, future, read_opts, block]
+      future
+    end
+
+    # Write a message that expects no reply, such as an unacknowledged
+    # write, and return a future that is already resolved.
+    #
+    # @return [Future]
+    def dispatch_and_forget(pool, operation, message)
+      future = Future.new(self)
+      socket = nil
+      future.complete do
+        begin
+          socket = acquire_socket(pool)
+          @client.dispatch_message(operation, message, socket)
+        rescue => ex
+          abandon(socket, ex) if socket
+          raise ex
+        end
+        release(socket) unless busy?(socket)
+        true
+      end
+      future
+    end
+
+    # Return a future completed with the value of the block, for operations
+    # that can be answered without waiting on the network.
+    #
+    # @return [Future]
+    def immediate(&block)
+      future = Future.new(self)
+      future.complete(&block)
+      future
+    end
+
+    # Number of operations whose replies have not been read yet.
+    #
+    # @return [Integer]
+    def pending
+      @in_flight.values.inject(0) { |sum, queue| sum + queue.size }
+    end
+
+    # Process replies until the block returns true.
+    #
+    # @raise [InvalidOperation] if the block can never become true because
+    #   nothing is left in flight.
+    def run_until
+      until yield
+        if @in_flight.empty?
+          raise InvalidOperation, "No operations in flight on this thread's reactor. " +
+            "Futures must be resolved on the thread that created them."
+        end
+        run_once
+      end
+    end
+
+    # Wait for at least one socket to become readable and read one reply
+    # from each readable socket.
+    def run_once(timeout=@client.op_timeout)
+      sockets = @in_flight.keys
+      begin
+        readable, _, errored = IO.select(sockets, nil, sockets, timeout)
+      rescue IOError, SystemCallError => ex
+        sockets.each { |socket| fail_socket(socket, ConnectionFailure.new(ex.message)) }
+        return
+      end
+
+      unless readable
+        sockets.each do |socket|
+          fail_socket(socket, OperationTimeout.new("Timed out waiting on socket read."))
+        end
+        return
+      end
+
+      (readable | errored).each { |socket| read_reply(socket) }
+    end
+
+    # Fail every outstanding operation and return all held sockets.
+    def close
+      @in_flight.keys.each do |socket|
+        fail_socket(socket, ConnectionFailure.new("Reactor closed."))
+      end
+      @sockets.values.flatten.each { |socket| socket.checkin }
+      @sockets.clear
+    end
+
+    def inspect
+      "#<Mongo::Reactor:0x#{self.object_id.to_s(16)} @pending=#{pending} " +
+        "@sockets=#{@sockets.values.flatten.size}>"
+    end
+
+    private
+
+    def read_reply(socket)
+      request_id, future, read_opts, block = @in_flight[socket].first
+      begin
+        reply = @client.receive_reply(socket, request_id, read_opts.dup)
+      rescue ConnectionFailure, OperationTimeout, OperationFailure,
+             SystemCallError, IOError => ex
+        fail_socket(socket, ex)
+        return
+      end
+
+      @in_flight[socket].shift
+      if @in_flight[socket].empty?
+        @in_flight.delete(socket)
+        release(socket)
+      end
+      future.complete { block ? block.call(*reply) : reply }
+    end
+
+    # Fails every operation waiting on the socket. Once a read has gone
+    # wrong the stream can no longer be trusted, so the socket is closed.
+    def fail_socket(socket, error)
+      queue = @in_flight.delete(socket) || []
+      socket.close unless socket.closed?
+      release(socket)
+      queue.each { |_, future, _, _| future.reject(error) }
+    end
+
+    # A write failed on this socket. If other replies are pending on it they
+    # are lost along with the stream; otherwise just hand the socket back.
+    def abandon(socket, error)
+      if busy?(socket)
+        fail_socket(socket, error) if socket.closed?
+      else
+        release(socket)
+      end
+    end
+
+    # Sockets are handed back as soon as their last reply has been read, so
+    # every socket we hold is busy. Take another one from the pool while we
+    # are under the limit, and only then pipeline on the least busy one.
+    def acquire_socket(pool)
+      held = (@sockets[pool] ||= [])
+      if held.size < @max_sockets_per_pool
+        socket = pool.checkout_unpinned(held.empty?)
+        if socket
+          held << socket
+          return socket
+        end
+      end
+
+      held.min_by { |socket| @in_flight[socket].size }
+    end
+
+    def release(socket)
+      held = @sockets[socket.pool]
+      held.delete(socket) if held
+      socket.checkin
+    end
+
+    def busy?(socket)
+      @in_flight.key?(socket)
+    end
+  end
+end
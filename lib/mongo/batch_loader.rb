@@ -0,0 +1,159 @@
+# Copyright (C) 2009-2013 MongoDB, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+module Mongo
+
+  # Combines point lookups made by concurrent threads into one query.
+  #
+  # The first thread to call #load opens a batch and waits up to +:window+
+  # seconds for other threads to add their keys, or until +:max_batch+
+  # keys have been collected. It then runs a single +$in+ query on the key
+  # field and hands every waiting thread its document. No background
+  # thread is involved: the thread that opened a batch runs it.
+  #
+  # Callers wait on a Mutex and ConditionVariable, so under a fiber
+  # scheduler non-blocking fibers share batches just as threads do. Without
+  # a scheduler, fibers of one thread run one at a time and each load runs
+  # its own batch.
+  #
+  # Each loader uses one read preference, so a batch never mixes reads
+  # that should go to different servers. Documents are matched to callers
+  # by the value of the key field, so keys should be of the type stored
+  # in the collection. Callers asking for the same key receive the same
+  # document object.
+  #
+  # @see Collection#batch_loader
+  class BatchLoader
+    DEFAULT_WINDOW    = 0.002
+    DEFAULT_MAX_BATCH = 1000
+
+    # Keys waiting for one query, and the results once it has run.
+    class Batch
+      attr_accessor :keys, :results, :error, :done
+      attr_reader :ready
+
+      def initialize
+        @keys    = []
+        @seen    = {}
+        @results = {}
+        @done    = false
+        @ready   = ConditionVariable.new
+      end
+
+      def add(key)
+        return if @seen[key]
+        @seen[key] = true
+        @keys << key
+      end
+    end
+
+    attr_reader :collection, :key, :window, :max_batch
+
+    # @param [Collection] collection
+    #
+    # @option opts [String] :key ('_id') the field looked up.
+    # @option opts [Float] :window (0.002) seconds a batch waits for more keys.
+    # @option opts [Integer] :max_batch (1000) keys after which a batch is sent at once.
+    # @option opts [Symbol] :read, :tag_sets, :fields any option accepted by
+    #   Collection#find, applied to every batch. :fields must include the key.
+    def initialize(collection, opts={})
+      opts        = opts.dup
+      @collection = collection
+      @key        = (opts.delete(:key) || '_id').to_s
+      @window     = opts.delete(:window)    || DEFAULT_WINDOW
+      @max_batch  = opts.delete(:max_batch) || DEFAULT_MAX_BATCH
+      @find_opts  = opts
+      @mutex      = Mutex.new
+      @batch      = nil
+      @counts     = { :loads => 0, :queries => 0 }
+    end
+
+    # Look up a single document by key, waiting for the batch it joins.
+    #
+    # @return [Hash, nil] the document, or nil if there is none.
+    def load(value)
+      load_many([value]).first
+    end
+
+    # Look up several documents by key. They join the same batch, which is
+    # sent at once if they fill it.
+    #
+    # @param [Array] values
+    #
+    # @return [Array] a document or nil for each value, in order.
+    def load_many(values)
+      batch = nil
+      leader = false
+      @mutex.synchronize do
+        batch = @batch
+        unless batch
+          batch  = @batch = Batch.new
+          leader = true
+        end
+        values.each { |value| batch.add(value) }
+        @counts[:loads] += values.size
+        if batch.keys.size >= @max_batch && @batch.equal?(batch)
+          @batch = nil
+          batch.ready.broadcast
+        end
+      end
+
+      leader ? run(batch) : wait(batch)
+      raise batch.error if batch.error
+      values.map { |value| batch.results[value] }
+    end
+
+    # @return [Hash] the number of keys loaded and queries sent.
+    def stats
+      @mutex.synchronize { @counts.dup }
+    end
+
+    private
+
+    # Wait out the window, or until another caller fills the batch and
+    # closes it, then run the query. Waiting on the batch's condition
+    # variable under the mutex means a batch filled at any point is seen.
+    def run(batch)
+      @mutex.synchronize do
+        deadline = Time.now + @window
+        while @batch.equal?(batch) && (remaining = deadline - Time.now) > 0
+          batch.ready.wait(@mutex, remaining)
+        end
+        @batch = nil if @batch.equal?(batch)
+        @counts[:queries] += 1
+      end
+
+      begin
+        batch.keys.each_slice(@max_batch) do |keys|
+          @collection.find({ @key => { '$in' => keys } }, @find_opts).each do |doc|
+            batch.results[doc[@key]] = doc
+          end
+        end
+      rescue => ex
+        batch.error = ex
+      ensure
+        @mutex.synchronize do
+          batch.done = true
+          batch.ready.broadcast
+        end
+      end
+    end
+
+    def wait(batch)
+      @mutex.synchronize do
+        batch.ready.wait(@mutex) until batch.done
+      end
+    end
+  end
+end
@@ -215,16 +215,29 @@ module Mongo
     # but the selector and upsert settings are preserved.
     #
     # @return [BulkWriteCollectionView]
+    #
+    # @raise [ConnectionFailure] if the connection fails partway through an
+    #   unordered bulk on a server without write commands. Its result holds
+    #   the counts and write errors of the operations already acknowledged.
     def execute(opts = {})
       raise MongoArgumentError, EMPTY_BATCH_MSG if @ops.empty?
       write_concern = get_write_concern(opts, @collection)
       @ops.each_with_index{|op, index| op.last.merge!(:ord => index)} # infuse ordinal here to avoid issues with upsert
-      if @collection.db.connection.use_write_command?(write_concern)
-        errors, write_concern_errors, exchanges = @collection.command_writer.bulk_execute(@ops, @options, opts)
-      else
-        errors, write_concern_errors, exchanges = @collection.operation_writer.bulk_execute(@ops, @options, opts)
+      begin
+        if @collection.db.connection.use_write_command?(write_concern)
+          errors, write_concern_errors, exchanges = @collection.command_writer.bulk_execute(@ops, @options, opts)
+        else
+          errors, write_concern_errors, exchanges, failure = @collection.operation_writer.bulk_execute(@ops, @options, opts)
+        end
+      ensure
+        @collection.expire_query_cache
       end
       @ops = []
+      if failure
+        ex = ConnectionFailure.new(failure.message, failure.error_code, merge_result(errors + write_concern_errors, exchanges))
+        ex.set_backtrace(failure.backtrace)
+        raise ex
+      end
       return true if errors.empty? && (exchanges.empty? || exchanges.first[:response] == true) # w 0 without GLE
       result = merge_result(errors + write_concern_errors, exchanges)
       raise BulkWriteError.new(MULTIPLE_ERRORS_MSG, Mongo::ErrorCode::MULTIPLE_ERRORS_OCCURRED, result) if !errors.empty? || !write_concern_errors.empty?
@@ -0,0 +1,265 @@
+# Copyright (C) 2009-2013 MongoDB, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+module Mongo
+
+  # Buffers unacknowledged (w: 0) writes to one collection and sends them in
+  # batches from a background thread.
+  #
+  # Documents are serialized when they are written, and consecutive inserts
+  # are packed into a single OP_INSERT. A flush sends every buffered message
+  # in one socket write, either once +:flush_bytes+ have accumulated or every
+  # +:flush_interval+ seconds, whichever comes first. Writes are sent in the
+  # order they were made.
+  #
+  # At most +:max_buffer_bytes+ of serialized writes are held at once, plus
+  # the batch being sent. When the buffer is full, the +:overflow+ policy
+  # decides whether a write waits for the next flush (+:block+) or is
+  # discarded (+:drop+). Writes that cannot be sent because the server is
+  # unreachable are counted as failed and discarded, as they would be with
+  # w: 0. Pending writes are flushed by #close. Writers still open when the
+  # process exits are closed by a single at_exit hook shared by all of them.
+  #
+  # @see Collection#coalescing_writer
+  class CoalescingWriter
+    DEFAULT_FLUSH_BYTES      = 256 * 1024
+    DEFAULT_FLUSH_INTERVAL   = 0.1
+    DEFAULT_MAX_BUFFER_BYTES = 16 * 1024 * 1024
+    OVERFLOW_POLICIES        = [:block, :drop]
+
+    attr_reader :collection, :flush_bytes, :flush_interval, :max_buffer_bytes, :overflow
+
+    @open_writers  = {}
+    @registry_lock = Mutex.new
+    @exit_hook     = false
+
+    class << self
+      # Track an open writer so that it is closed at exit. The at_exit
+      # hook is installed by the first writer.
+      def register(writer)
+        @registry_lock.synchronize do
+          unless @exit_hook
+            at_exit { close_all }
+            @exit_hook = true
+          end
+          @open_writers[writer] = true
+        end
+      end
+
+      # Stop tracking a writer once it has been closed.
+      def unregister(writer)
+        @registry_lock.synchronize { @open_writers.delete(writer) }
+      end
+
+      # Close every writer that is still open.
+      def close_all
+        writers = @registry_lock.synchronize { @open_writers.keys }
+        writers.each { |writer| writer.close }
+      end
+    end
+
+    # @param [Collection] collection
+    #
+    # @option opts [Integer] :flush_bytes (256KB) flush once this many bytes are buffered.
+    # @option opts [Float] :flush_interval (0.1) seconds between background flushes.
+    # @option opts [Integer] :max_buffer_bytes (16MB) most bytes of writes held at once.
+    # @option opts [Symbol] :overflow (:block) what a write does when the buffer is
+    #   full: +:block+ until the next flush, or +:drop+ the write.
+    def initialize(collection, opts={})
+      @collection       = collection
+      @connection       = collection.db.connection
+      @ns               = "#{collection.db.name}.#{collection.name}"
+      @flush_bytes      = opts[:flush_bytes]      || DEFAULT_FLUSH_BYTES
+      @flush_interval   = opts[:flush_interval]   || DEFAULT_FLUSH_INTERVAL
+      @max_buffer_bytes = opts[:max_buffer_bytes] || DEFAULT_MAX_BUFFER_BYTES
+      @overflow         = opts[:overflow]         || :block
+
+      unless OVERFLOW_POLICIES.include?(@overflow)
+        raise MongoArgumentError, "Overflow policy must be one of #{OVERFLOW_POLICIES.inspect}"
+      end
+
+      @buffer_mutex = Mutex.new
+      @send_mutex   = Mutex.new
+      @drained      = ConditionVariable.new
+      @messages     = []
+      @insert_batch = nil
+      @buffered     = 0
+      @counts       = { :written => 0, :flushed => 0, :dropped => 0, :failed => 0 }
+      @closed       = false
+      @thread       = nil
+
+      CoalescingWriter.register(self)
+    end
+
+    # Buffer one or more documents for insertion. An _id is assigned to each
+    # document as in Collection#insert.
+    #
+    # @return [ObjectId, Array, nil] the _id or _ids of the documents, or nil
+    #   if they were dropped because the buffer was full.
+    def insert(doc_or_docs)
+      docs = [doc_or_docs].flatten(1)
+      docs.each { |doc| @collection.pk_factory.create_pk(doc) }
+      serialized = docs.collect do |doc|
+        BSON::BSON_CODER.serialize(doc, true, true, @connection.max_bson_size).to_s
+      end
+
+      buffered = enqueue(serialized.inject(0) { |size, bson| size + bson.bytesize }, docs.size) do
+        serialized.each { |bson| append_insert(bson) }
+      end
+      return nil unless buffered
+
+      ids = docs.collect { |doc| doc[:_id] || doc['_id'] }
+      doc_or_docs.respond_to?(:collect!) ? ids : ids.first
+    end
+    alias_method :<<, :insert
+
+    # Buffer an update. Options are as for Collection#update.
+    #
+    # @option opts [Boolean] :upsert (false)
+    # @option opts [Boolean] :multi (false)
+    #
+    # @return [Boolean] false if the update was dropped because the buffer was full.
+    def update(selector, document, opts={})
+      message = BSON::ByteBuffer.new
+      message.put_int(0)
+      BSON::BSON_RUBY.serialize_cstr(message, @ns)
+      update_options  = 0
+      update_options += 1 if opts[:upsert]
+      update_options += 2 if opts[:multi]
+      message.put_int(update_options)
+      message.put_binary(BSON::BSON_CODER.serialize(selector, false, true, @connection.max_bson_size).to_s)
+      check_keys = !document.keys.first.to_s.start_with?("$")
+      message.put_binary(BSON::BSON_CODER.serialize(document, check_keys, true, @connection.max_bson_size).to_s)
+
+      enqueue(message.size, 1) do
+        @insert_batch = nil
+        @messages << [Mongo::Constants::OP_UPDATE, message, 1]
+      end
+    end
+
+    # Send every buffered write now.
+    #
+    # @return [Integer] the number of writes sent.
+    def flush
+      @send_mutex.synchronize do
+        messages = @buffer_mutex.synchronize { take_messages }
+        send_batch(messages)
+      end
+    end
+
+    # Flush pending writes and stop the background thread. Further writes
+    # raise InvalidOperation.
+    def close
+      thread = @buffer_mutex.synchronize do
+        return if @closed
+        @closed = true
+        @drained.broadcast
+        @thread
+      end
+      wake(thread)
+      thread.join if thread && thread != Thread.current
+      flush
+    ensure
+      CoalescingWriter.unregister(self)
+    end
+
+    def closed?
+      @closed
+    end
+
+    # @return [Hash] bytes currently buffered and the number of writes
+    #   accepted, sent, dropped on overflow and lost to send failures.
+    def stats
+      @buffer_mutex.synchronize { @counts.merge(:buffered_bytes => @buffered) }
+    end
+
+    private
+
+    # Add a write of +bytes+ bytes to the buffer, applying the overflow
+    # policy. A single write larger than the whole buffer is accepted once
+    # the buffer is empty.
+    def enqueue(bytes, count)
+      @buffer_mutex.synchronize do
+        raise InvalidOperation, "This coalescing writer has been closed." if @closed
+
+        while @buffered > 0 && @buffered + bytes > @max_buffer_bytes
+          if @overflow == :drop
+            @counts[:dropped] += count
+            return false
+          end
+          wake(@thread)
+          @drained.wait(@buffer_mutex)
+          raise InvalidOperation, "This coalescing writer has been closed." if @closed
+        end
+
+        yield
+        @buffered += bytes
+        @counts[:written] += count
+        start unless @thread && @thread.alive?
+        wake(@thread) if @buffered >= @flush_bytes
+      end
+      true
+    end
+
+    def append_insert(bson)
+      if @insert_batch.nil? || @insert_batch.size + bson.bytesize > @connection.max_message_size - 16
+        @insert_batch = BSON::ByteBuffer.new
+        @insert_batch.put_int(0)
+        BSON::BSON_RUBY.serialize_cstr(@insert_batch, @ns)
+        @messages << [Mongo::Constants::OP_INSERT, @insert_batch, 0]
+      end
+      @insert_batch.put_binary(bson)
+      @messages.last[2] += 1
+    end
+
+    # Must be called with the buffer mutex held.
+    def take_messages
+      messages, @messages = @messages, []
+      @insert_batch = nil
+      @buffered     = 0
+      @drained.broadcast
+      messages
+    end
+
+    def send_batch(messages)
+      return 0 if messages.empty?
+      count = messages.inject(0) { |sum, message| sum + message[2] }
+      begin
+        @connection.send_messages(messages.collect { |op, message, _| [op, message] })
+        @buffer_mutex.synchronize { @counts[:flushed] += count }
+      rescue ConnectionFailure, OperationTimeout, SystemCallError, IOError => ex
+        @buffer_mutex.synchronize { @counts[:failed] += count }
+        @connection.logger.warn("MONGODB coalescing writer: #{ex.message}") if @connection.logger
+      ensure
+        @collection.expire_query_cache
+      end
+      count
+    end
+
+    def start
+      @thread = Thread.new do
+        until @closed
+          sleep(@flush_interval)
+          flush
+        end
+      end
+    end
+
+    def wake(thread)
+      thread.wakeup if thread && thread.alive?
+    rescue ThreadError
+      # The thread finished between the check and the wakeup.
+    end
+  end
+end
@@ -26,7 +26,8 @@ module Mongo
                 :write_concern,
                 :capped,
                 :operation_writer,
-                :command_writer
+                :command_writer,
+                :query_cache
 
     # Read Preference
     attr_accessor :read,
@@ -62,6 +63,10 @@ module Mongo
     #   to one of the closest available secondary nodes. If a secondary node cannot be located, the
     #   read will be sent to the primary. If this option is left unspecified, the value of the read
     #   preference for this collection's associated Mongo::DB object will be used.
+    # @option opts [Boolean, Hash] :query_cache (nil) answer repeated finds and counts from
+    #   replies kept on the client, until they expire or the collection is written to through
+    #   the client. Pass true for the defaults or a Hash with :ttl and :max_bytes; see QueryCache.
+    #   A find racing an unacknowledged write may cache the collection as it was before the write.
     #
     # @raise [InvalidNSName]
     #   if collection name is empty, contains '$', or starts or ends with '.'
@@ -117,6 +122,11 @@ module Mongo
       @hint = nil
       @operation_writer = CollectionOperationWriter.new(self)
       @command_writer = CollectionCommandWriter.new(self)
+      @batch_loaders = {}
+      @batch_loader_lock = Mutex.new
+      if opts.is_a?(Hash) && (cache_opts = opts[:query_cache]) # assignment
+        @query_cache = @connection.query_cache("#{@db.name}.#{@name}", cache_opts.is_a?(Hash) ? cache_opts : {})
+      end
     end
 
     # Indicate whether this is a capped collection.
@@ -225,6 +235,18 @@ module Mongo
     # @option opts [String] :comment (nil) a comment to include in profiling logs
     # @option opts [Boolean] :compile_regex (true) whether BSON regex objects should be compiled into Ruby regexes.
     #   If false, a BSON::Regex object will be returned instead.
+    # @option opts [Boolean] :raw (false) if true, the cursor returns each document as a serialized BSON
+    #   string, leaving deserialization to the caller. See MergedCursor.
+    # @option opts [Boolean, Hash] :adaptive_batch (nil) size each getMore from the observed document
+    #   size and reply latency instead of a fixed :batch_size. Pass true for the defaults or a Hash
+    #   with :target_bytes, :latency_ms and :max_batch_size; see BatchSizer and Cursor#batch_stats.
+    # @option opts [Boolean, Hash] :dereference (nil) replace the DBRefs in each batch with the
+    #   documents they point to, fetched with one query per collection; see DB#dereference_all.
+    #   Pass a Hash to give options to dereference_all, such as :parallel.
+    # @option opts [Boolean] :track_changes (false) keep the serialized form of each document
+    #   returned, so that Collection#save_changes can send only the fields changed since.
+    # @option opts [Boolean] :query_cache (true) whether to use the collection's query cache,
+    #   if it was created with one.
     #
     # @raise [ArgumentError]
     #   if timeout is set to false and find is not invoked in a block
@@ -252,6 +274,11 @@ module Mongo
       tag_sets           = opts.delete(:tag_sets) || @tag_sets
       acceptable_latency = opts.delete(:acceptable_latency) || @acceptable_latency
       compile_regex      = opts.key?(:compile_regex) ? opts.delete(:compile_regex) : true
+      raw                = opts.delete(:raw)
+      adaptive_batch     = opts.delete(:adaptive_batch)
+      dereference        = opts.delete(:dereference)
+      track_changes      = opts.delete(:track_changes)
+      query_cache        = opts.key?(:query_cache) ? opts.delete(:query_cache) : true
 
       if timeout == false && !block_given?
         raise ArgumentError, "Collection#find must be invoked with a block when timeout is disabled."
@@ -283,7 +310,12 @@ module Mongo
         :tag_sets           => tag_sets,
         :comment            => comment,
         :acceptable_latency => acceptable_latency,
-        :compile_regex      => compile_regex
+        :compile_regex      => compile_regex,
+        :raw                => raw,
+        :adaptive_batch     => adaptive_batch,
+        :dereference        => dereference,
+        :track_changes      => track_changes,
+        :query_cache        => query_cache && @query_cache
       })
 
       if block_given?
@@ -314,21 +346,47 @@ module Mongo
     # @raise [TypeError]
     #   if the argument is of an improper type.
     def find_one(spec_or_object_id=nil, opts={})
-      spec = case spec_or_object_id
-             when nil
-               {}
-             when BSON::ObjectId
-               {:_id => spec_or_object_id}
-             when Hash
-               spec_or_object_id
-             else
-               raise TypeError, "spec_or_object_id must be an instance of ObjectId or Hash, or nil"
-             end
+      spec = find_one_spec(spec_or_object_id)
       timeout = opts.delete(:max_time_ms)
       cursor = find(spec, opts.merge(:limit => -1))
       timeout ? cursor.max_time_ms(timeout).next_document : cursor.next_document
     end
 
+    # Asynchronous version of Collection#find_one.
+    #
+    # The query is written through the current thread's Reactor, so many
+    # lookups can be in flight at once; the document is returned when the
+    # value of the future is read. Takes the same arguments as find_one.
+    #
+    # @example Look up several users concurrently from one thread
+    #   futures = ids.map { |id| @users.find_one_async(id) }
+    #   users   = futures.map(&:value)
+    #
+    # @return [Mongo::Future] resolving to a Hash or nil.
+    def find_one_async(spec_or_object_id=nil, opts={})
+      spec = find_one_spec(spec_or_object_id)
+      timeout = opts.delete(:max_time_ms)
+      cursor = find(spec, opts.merge(:limit => -1))
+      timeout ? cursor.max_time_ms(timeout).next_async : cursor.next_async
+    end
+
+    # Prepare a query to be run many times with different values. The
+    # query message is serialized once; each run only writes the parameter
+    # values into it.
+    #
+    # @example Look up documents by _id
+    #   by_id = collection.prepare('_id' => Mongo::PreparedQuery.param(:id))
+    #   by_id.find_one(:id => id)
+    #
+    # @param [Hash] selector a selector template whose values may be
+    #   placeholders made with PreparedQuery.param.
+    # @param [Hash] opts any options accepted by Collection#find.
+    #
+    # @return [Mongo::PreparedQuery]
+    def prepare(selector, opts={})
+      PreparedQuery.new(self, selector, opts)
+    end
+
     # Save a document to this collection.
     #
     # @param [Hash] doc
@@ -365,10 +423,50 @@ module Mongo
       end
     end
 
+    # Save a document read with the :track_changes option, sending only what
+    # changed since it was read: the fields set, changed or removed become a
+    # $set and $unset update, computed by DocumentDiff. Nothing is sent if
+    # the document is unchanged.
+    #
+    # The whole document is saved, as by Collection#save, if it was not read
+    # with :track_changes, if its _id has changed, or if the update would be
+    # larger than :diff_threshold of the document. Fields are matched by name,
+    # so a change in the order of fields alone is not saved.
+    #
+    # @param [Hash] doc
+    #
+    # @option opts [Float] :diff_threshold (0.5) the fraction of the document's
+    #   size above which the whole document is sent instead of an update.
+    #
+    #   Other options are as for Collection#save.
+    #
+    # @return [ObjectId] the _id of the saved document.
+    #
+    # @raise [Mongo::OperationFailure] will be raised iff :w > 0 and the operation fails.
+    def save_changes(doc, opts={})
+      original = doc.respond_to?(:original_bson) && doc.original_bson
+      opts = opts.dup
+      threshold = opts.delete(:diff_threshold) || DocumentDiff::DEFAULT_THRESHOLD
+      return save(doc, opts) unless original
+
+      current = BSON::BSON_CODER.serialize(doc, true, false, @connection.max_bson_size).to_s
+      changes = DocumentDiff.update(original, current)
+      id = doc[:_id] || doc['_id']
+      if changes && changes.size <= threshold * current.size
+        update({:_id => id}, BSON::RawDocument.new(changes), opts)
+      elsif !changes.nil?
+        save(doc, opts)
+      end
+      doc.original_bson = current
+      id
+    end
+
     # Insert one or more documents into the collection.
     #
-    # @param [Hash, Array] doc_or_docs
-    #   a document (as a hash) or array of documents to be inserted.
+    # @param [Hash, BSON::RawDocument, Array] doc_or_docs
+    #   a document (as a hash) or array of documents to be inserted. A document
+    #   already serialized as a BSON::RawDocument is sent as it is, and must
+    #   carry its own _id since none can be added.
     #
     # @return [ObjectId, Array]
     #   The _id of the inserted document or a list of _ids of all inserted documents.
@@ -407,7 +505,7 @@ module Mongo
     # @raise [Mongo::OperationFailure] will be raised iff :w > 0 and the operation fails.
     def insert(doc_or_docs, opts={})
       if doc_or_docs.respond_to?(:collect!)
-        doc_or_docs.collect! { |doc| @pk_factory.create_pk(doc) }
+        doc_or_docs.collect! { |doc| create_pk(doc) }
         error_docs, errors, write_concern_errors, rest_ignored = batch_write(:insert, doc_or_docs, true, opts)
         errors = write_concern_errors + errors
         raise errors.last if !opts[:collect_on_error] && !errors.empty?
@@ -415,13 +513,65 @@ module Mongo
         inserted_ids = inserted_docs.collect {|o| o[:_id] || o['_id']}
         opts[:collect_on_error] ? [inserted_ids, error_docs] : inserted_ids
       else
-        @pk_factory.create_pk(doc_or_docs)
+        create_pk(doc_or_docs)
         send_write(:insert, nil, doc_or_docs, true, opts)
         return doc_or_docs[:_id] || doc_or_docs['_id']
       end
     end
     alias_method :<<, :insert
 
+    # Asynchronous version of Collection#insert. Options are as for insert,
+    # except that :collect_on_error is not supported and an array of
+    # documents must fit in a single message.
+    #
+    # @return [Mongo::Future] resolving to the _id (or array of _ids) of the
+    #   inserted documents.
+    def insert_async(doc_or_docs, opts={})
+      docs = [doc_or_docs].flatten(1)
+      docs.collect! { |doc| create_pk(doc) }
+      send_write_async(:insert, nil, docs, true, opts).then do
+        ids = docs.collect { |o| o[:_id] || o['_id'] }
+        doc_or_docs.respond_to?(:collect!) ? ids : ids.first
+      end
+    end
+
+    # A writer that buffers unacknowledged inserts and updates to this
+    # collection and sends them in batches from a background thread. The
+    # writer belongs to this Collection object and is created on first use,
+    # so options are only read then.
+    #
+    # @option opts [Integer] :flush_bytes (256KB) flush once this many bytes are buffered.
+    # @option opts [Float] :flush_interval (0.1) seconds between background flushes.
+    # @option opts [Integer] :max_buffer_bytes (16MB) most bytes of writes held at once.
+    # @option opts [Symbol] :overflow (:block) +:block+ or +:drop+ writes when the buffer is full.
+    #
+    # @return [Mongo::CoalescingWriter]
+    def coalescing_writer(opts={})
+      @coalescing_writer = nil if @coalescing_writer && @coalescing_writer.closed?
+      @coalescing_writer ||= CoalescingWriter.new(self, opts)
+    end
+
+    # A loader that combines point lookups made by concurrent threads into
+    # a single +$in+ query. Loaders are created on first use, one per read
+    # preference, so options other than :read are only read then.
+    #
+    # @example Look up users by _id from many threads
+    #   users.batch_loader.load(id)
+    #
+    # @option opts [String] :key ('_id') the field looked up.
+    # @option opts [Float] :window (0.002) seconds a batch waits for more keys.
+    # @option opts [Integer] :max_batch (1000) keys after which a batch is sent at once.
+    # @option opts [Symbol] :read (nil) the read preference for the batches,
+    #   defaulting to this collection's.
+    #
+    # @return [Mongo::BatchLoader]
+    def batch_loader(opts={})
+      read = opts[:read] || @read
+      @batch_loader_lock.synchronize do
+        @batch_loaders[read] ||= BatchLoader.new(self, opts.merge(:read => read))
+      end
+    end
+
     # Remove all documents from this collection.
     #
     # @param [Hash] selector
@@ -459,6 +609,13 @@ module Mongo
       send_write(:delete, selector, nil, nil, opts)
     end
 
+    # Asynchronous version of Collection#remove.
+    #
+    # @return [Mongo::Future] resolving to the value remove would return.
+    def remove_async(selector={}, opts={})
+      send_write_async(:delete, selector, nil, nil, opts)
+    end
+
     # Update one or more documents in this collection.
     #
     # @param [Hash] selector
@@ -497,6 +654,13 @@ module Mongo
       send_write(:update, selector, document, !document.keys.first.to_s.start_with?("$"), opts)
     end
 
+    # Asynchronous version of Collection#update.
+    #
+    # @return [Mongo::Future] resolving to the value update would return.
+    def update_async(selector, document, opts={})
+      send_write_async(:update, selector, document, !document.keys.first.to_s.start_with?("$"), opts)
+    end
+
     # Create a new index.
     #
     # @param [String, Array] spec
@@ -628,6 +792,8 @@ module Mongo
     # Drop the entire collection. USE WITH CAUTION.
     def drop
       @db.drop_collection(@name)
+    ensure
+      expire_query_cache
     end
 
     # Atomically update and return a document using MongoDB's findAndModify command. (MongoDB > 1.3.0)
@@ -665,6 +831,8 @@ module Mongo
         Mongo::Support.format_order_clause(opts[:sort]) if opts[:sort]
 
       full_response ? @db.command(cmd) : @db.command(cmd)['value']
+    ensure
+      expire_query_cache
     end
 
     # Perform an aggregation using the aggregation framework on the current collection.
@@ -1021,8 +1189,18 @@ module Mongo
         raise Mongo::InvalidNSName, "collection names must not start or end with '.'"
       end
 
-      @db.rename_collection(@name, new_name)
+      begin
+        @db.rename_collection(@name, new_name)
+      ensure
+        expire_query_cache
+      end
       @name = new_name
+      if @query_cache
+        @query_cache = @connection.query_cache("#{@db.name}.#{@name}",
+                                               :ttl => @query_cache.ttl, :max_bytes => @query_cache.max_bytes)
+      end
+      expire_query_cache
+      @name
     end
 
     # Get information on the indexes for this collection.
@@ -1072,6 +1250,14 @@ module Mongo
     end
     alias :size :count
 
+    # Empty the query cache of this collection, which is shared by every
+    # Collection object for it on this client. Writes made through the
+    # driver do this themselves; call it after changing the collection by
+    # other means, such as DB#command.
+    def expire_query_cache
+      @connection.expire_query_cache("#{@db.name}.#{@name}")
+    end
+
     protected
 
     # Provide required command options if they are missing in the command options hash.
@@ -1098,6 +1284,10 @@ module Mongo
 
     private
 
+    def create_pk(doc)
+      doc.is_a?(BSON::RawDocument) ? doc : @pk_factory.create_pk(doc)
+    end
+
     def send_write(op_type, selector, doc_or_docs, check_keys, opts, collection_name=@name)
       write_concern = get_write_concern(opts, self)
       if @db.connection.use_write_command?(write_concern)
@@ -1105,6 +1295,34 @@ module Mongo
       else
         @operation_writer.send_write_operation(op_type, selector, doc_or_docs, check_keys, opts, write_concern, collection_name)
       end
+    ensure
+      expire_query_cache
+    end
+
+    # An unacknowledged write completes once it is sent, which may be before
+    # the server applies it; see QueryCache.
+    def send_write_async(op_type, selector, doc_or_docs, check_keys, opts, collection_name=@name)
+      write_concern = get_write_concern(opts, self)
+      expire_query_cache
+      future = if @db.connection.use_write_command?(write_concern)
+        @command_writer.send_write_command_async(op_type, selector, doc_or_docs, check_keys, opts, write_concern, collection_name)
+      else
+        @operation_writer.send_write_operation_async(op_type, selector, doc_or_docs, check_keys, opts, write_concern, collection_name)
+      end
+      future.on_complete { expire_query_cache }
+    end
+
+    def find_one_spec(spec_or_object_id)
+      case spec_or_object_id
+      when nil
+        {}
+      when BSON::ObjectId
+        {:_id => spec_or_object_id}
+      when Hash
+        spec_or_object_id
+      else
+        raise TypeError, "spec_or_object_id must be an instance of ObjectId or Hash, or nil"
+      end
     end
 
     def index_name(spec)
@@ -1185,6 +1403,8 @@ module Mongo
       else
         return @operation_writer.batch_write(op_type, documents, check_keys, opts)
       end
+    ensure
+      expire_query_cache
     end
 
   end
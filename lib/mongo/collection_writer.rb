@@ -51,13 +51,13 @@ module Mongo
       write_concern_errors = []
       exchanges = []
       serialized_doc = nil
-      message = BSON::ByteBuffer.new("", max_message_size)
+      buffer = BSON::ByteBuffer.new("", max_message_size)
       @max_write_batch_size = @collection.db.connection.max_write_batch_size
       docs = documents.dup
       catch(:error) do
         until docs.empty? || (!errors.empty? && !collect_on_error && !continue_on_error) # process documents a batch at a time
           batch_docs = []
-          batch_message_initialize(message, op_type, continue_on_error, write_concern)
+          message = batch_message_initialize(buffer, op_type, continue_on_error, write_concern)
           while !docs.empty? && batch_docs.size < @max_write_batch_size
             begin
               doc = docs.first
@@ -152,16 +152,7 @@ module Mongo
     def send_bulk_write_command(op_type, documents, check_keys, opts, collection_name=@name)
       if op_type == :insert
         documents = documents.collect{|doc| doc[:d]} if opts.key?(:ordered)
-        documents.each do |doc|
-          # TODO - @pk_factory.create_pk(doc)
-          if check_keys
-            doc.each_key do |key|
-              key = key.to_s
-              raise BSON::InvalidKeyName.new("key #{key} must not start with '$'") if key[0] == ?$
-              raise BSON::InvalidKeyName.new("key #{key} must not contain '.'") if key.include? ?.
-            end
-          end
-        end
+        documents = serialize_documents(documents, check_keys)
       #elsif op_type == :update # TODO - check keys
       #elsif op_type == :delete
       #else
@@ -177,6 +168,17 @@ module Mongo
 
     private
 
+    # Serialize each document on its own, checking its keys, so that the
+    # serializer copies them into the command's array instead of walking
+    # them again. Documents already serialized are kept as they are.
+    def serialize_documents(documents, check_keys)
+      max_serialize_size = @connection.max_bson_size + MongoClient::SERIALIZE_HEADROOM
+      documents.collect do |doc|
+        next doc if doc.is_a?(BSON::RawDocument)
+        BSON::RawDocument.new(BSON::BSON_CODER.serialize(doc, check_keys, true, max_serialize_size))
+      end
+    end
+
     def sort_by_first_sym(pairs)
       pairs = pairs.collect{|first, rest| [first.to_s, rest]} #stringify_first
       pairs = pairs.sort{|x,y| x.first <=> y.first }
@@ -201,26 +203,7 @@ module Mongo
     end
 
     def send_write_operation(op_type, selector, doc_or_docs, check_keys, opts, write_concern, collection_name=@name)
-      message = BSON::ByteBuffer.new("", @connection.max_message_size)
-      message.put_int((op_type == :insert && !!opts[:continue_on_error]) ? 1 : 0)
-      BSON::BSON_RUBY.serialize_cstr(message, "#{@db.name}.#{collection_name}")
-      if op_type == :update
-        update_options  = 0
-        update_options += 1 if opts[:upsert]
-        update_options += 2 if opts[:multi]
-        message.put_int(update_options)
-      elsif op_type == :delete
-        delete_options = 0
-        delete_options += 1 if opts[:limit] && opts[:limit] != 0
-        message.put_int(delete_options)
-      end
-      message.put_binary(BSON::BSON_CODER.serialize(selector, false, true, @connection.max_bson_size).to_s) if selector
-      [doc_or_docs].flatten(1).compact.each do |document|
-        message.put_binary(BSON::BSON_CODER.serialize(document, check_keys, true, @connection.max_bson_size).to_s)
-        if message.size > @connection.max_message_size
-          raise BSON::InvalidDocument, "Message is too large. This message is limited to #{@connection.max_message_size} bytes."
-        end
-      end
+      message = build_write_message(op_type, selector, doc_or_docs, check_keys, opts, collection_name)
       instrument(op_type, :database => @db.name, :collection => collection_name, :selector => selector, :documents => doc_or_docs) do
         op_code = OPCODE[op_type]
         if Mongo::WriteConcern.gle?(write_concern)
@@ -231,25 +214,47 @@ module Mongo
       end
     end
 
+    # Asynchronous counterpart of #send_write_operation.
+    #
+    # @return [Mongo::Future] resolving to the getlasterror document, or true
+    #   for unacknowledged writes.
+    def send_write_operation_async(op_type, selector, doc_or_docs, check_keys, opts, write_concern, collection_name=@name)
+      message = build_write_message(op_type, selector, doc_or_docs, check_keys, opts, collection_name)
+      reactor = @connection.reactor
+      instrument(op_type, :database => @db.name, :collection => collection_name, :selector => selector, :documents => doc_or_docs) do
+        op_code = OPCODE[op_type]
+        if Mongo::WriteConcern.gle?(write_concern)
+          reactor.dispatch(@connection.writer_pool, op_code, message,
+                           :gle_db => @db.name, :write_concern => write_concern) do |docs, num_received, _|
+            @connection.check_last_error(docs, num_received)
+          end
+        else
+          reactor.dispatch_and_forget(@connection.writer_pool, op_code, message)
+        end
+      end
+    end
+
+    # Number of operations an unordered bulk writes ahead of reading their
+    # getlasterror replies. It bounds the replies left waiting in the socket
+    # buffers, which the server could otherwise fill while we are still
+    # writing.
+    PIPELINE_WINDOW = 256
+
     def bulk_execute(ops, options, opts = {})
       write_concern = get_write_concern(opts, @collection)
+      if !options[:ordered] && Mongo::WriteConcern.gle?(write_concern)
+        return bulk_execute_pipelined(ops, opts, write_concern)
+      end
       errors = []
       write_concern_errors = []
       exchanges = []
       ops.each do |op_type, doc|
-        doc = {:d => @collection.pk_factory.create_pk(doc[:d]), :ord => doc[:ord]} if op_type == :insert
-        doc_opts = doc.merge(opts)
-        d = doc_opts.delete(:d)
-        q = doc_opts.delete(:q)
-        u = doc_opts.delete(:u)
+        doc, selector, document, doc_opts = bulk_op(op_type, doc, opts)
         begin  # use single and NOT batch inserts since there no index for an error
-          response = @collection.operation_writer.send_write_operation(op_type, q, d || u, check_keys = false, doc_opts, write_concern)
+          response = @collection.operation_writer.send_write_operation(op_type, selector, document, check_keys = false, doc_opts, write_concern)
           exchanges << {:op_type => op_type, :batch => [doc], :opts => opts, :response => response}
         rescue BSON::InvalidDocument, BSON::InvalidKeyName, BSON::InvalidStringEncoding => ex
-          bulk_message = "Bulk write error - #{ex.message} - examine result for complete information"
-          ex = BulkWriteError.new(bulk_message, Mongo::ErrorCode::INVALID_BSON,
-                                  {:op_type => op_type, :serialize => doc, :ord => doc[:ord], :error => ex})
-          errors << ex
+          errors << bulk_serialize_error(op_type, doc, ex)
           break if options[:ordered]
         rescue Mongo::WriteConcernError => ex
           write_concern_errors << ex
@@ -265,10 +270,111 @@ module Mongo
 
     private
 
+    # Unordered bulk execution for acknowledged writes. Each operation is
+    # written with its getlasterror right behind it, without waiting, and
+    # the replies are read back in order once a window of operations is on
+    # the wire. Ordered bulks cannot do this, since they must not send an
+    # operation until the previous one is known to have succeeded.
+    #
+    # @return [Array] the errors, write concern errors and exchanges, followed
+    #   by the ConnectionFailure that cut the bulk short, if any.
+    def bulk_execute_pipelined(ops, opts, write_concern)
+      errors = []
+      write_concern_errors = []
+      exchanges = []
+      ops.each_slice(PIPELINE_WINDOW) do |window|
+        pending = []
+        sock = @connection.checkout_writer
+        begin
+          window.each do |op_type, doc|
+            doc, selector, document, doc_opts = bulk_op(op_type, doc, opts)
+            begin
+              message = build_write_message(op_type, selector, document, false, doc_opts, @name)
+            rescue BSON::InvalidDocument, BSON::InvalidKeyName, BSON::InvalidStringEncoding => ex
+              errors << bulk_serialize_error(op_type, doc, ex)
+              next
+            end
+            request_id = instrument(op_type, :database => @db.name, :collection => @name, :selector => selector, :documents => document) do
+              @connection.dispatch_message(OPCODE[op_type], message, sock, @db.name, write_concern)
+            end
+            pending << [op_type, doc, request_id]
+          end
+
+          until pending.empty?
+            op_type, doc, request_id = pending.first
+            docs, num_received, _ = @connection.receive_reply(sock, request_id)
+            pending.shift
+            begin
+              response = @connection.check_last_error(docs, num_received)
+              exchanges << {:op_type => op_type, :batch => [doc], :opts => opts, :response => response}
+            rescue Mongo::WriteConcernError => ex
+              write_concern_errors << ex
+              exchanges << {:op_type => op_type, :batch => [doc], :opts => opts, :response => ex.result}
+            rescue Mongo::OperationFailure => ex
+              errors << ex
+              exchanges << {:op_type => op_type, :batch => [doc], :opts => opts, :response => ex.result}
+            end
+          end
+        ensure
+          # Replies left unread would be taken for the next user's.
+          sock.close unless pending.empty?
+          @connection.checkin(sock)
+        end
+      end
+      [errors, write_concern_errors, exchanges]
+    rescue ConnectionFailure => ex
+      # The replies read before the failure describe writes the server has
+      # applied, so they are returned along with it.
+      [errors, write_concern_errors, exchanges, ex]
+    end
+
+    # Splits a bulk operation into what #send_write_operation takes.
+    #
+    # @return [Array] the operation, its selector, its document and its options.
+    def bulk_op(op_type, doc, opts)
+      doc = {:d => @collection.pk_factory.create_pk(doc[:d]), :ord => doc[:ord]} if op_type == :insert
+      doc_opts = doc.merge(opts)
+      d = doc_opts.delete(:d)
+      q = doc_opts.delete(:q)
+      u = doc_opts.delete(:u)
+      [doc, q, d || u, doc_opts]
+    end
+
+    def bulk_serialize_error(op_type, doc, ex)
+      bulk_message = "Bulk write error - #{ex.message} - examine result for complete information"
+      BulkWriteError.new(bulk_message, Mongo::ErrorCode::INVALID_BSON,
+                         {:op_type => op_type, :serialize => doc, :ord => doc[:ord], :error => ex})
+    end
+
+    def build_write_message(op_type, selector, doc_or_docs, check_keys, opts, collection_name)
+      message = BSON::ByteBuffer.new("", @connection.max_message_size)
+      message.put_int((op_type == :insert && !!opts[:continue_on_error]) ? 1 : 0)
+      BSON::BSON_RUBY.serialize_cstr(message, "#{@db.name}.#{collection_name}")
+      if op_type == :update
+        update_options  = 0
+        update_options += 1 if opts[:upsert]
+        update_options += 2 if opts[:multi]
+        message.put_int(update_options)
+      elsif op_type == :delete
+        delete_options = 0
+        delete_options += 1 if opts[:limit] && opts[:limit] != 0
+        message.put_int(delete_options)
+      end
+      message.put_binary(BSON::BSON_CODER.serialize(selector, false, true, @connection.max_bson_size).to_s) if selector
+      [doc_or_docs].flatten(1).compact.each do |document|
+        message.put_binary(BSON::BSON_CODER.serialize(document, check_keys, true, @connection.max_bson_size).to_s)
+        if message.size > @connection.max_message_size
+          raise BSON::InvalidDocument, "Message is too large. This message is limited to #{@connection.max_message_size} bytes."
+        end
+      end
+      message
+    end
+
     def batch_message_initialize(message, op_type, continue_on_error, write_concern)
       message.clear!.clear
       message.put_int(continue_on_error ? 1 : 0)
       BSON::BSON_RUBY.serialize_cstr(message, "#{@db.name}.#{@name}")
+      message
     end
 
     def batch_message_append(message, serialized_doc, write_concern)
@@ -297,24 +403,22 @@ module Mongo
     end
 
     def send_write_command(op_type, selector, doc_or_docs, check_keys, opts, write_concern, collection_name=@name)
-      if op_type == :insert
-        argument = [doc_or_docs].flatten(1).compact
-      elsif op_type == :update
-        argument = [{:q => selector, :u => doc_or_docs, :multi => !!opts[:multi]}]
-        argument.first.merge!(:upsert => opts[:upsert]) if opts[:upsert]
-      elsif op_type == :delete
-        argument = [{:q => selector, :limit => (opts[:limit] || 0)}]
-      else
-        raise ArgumentError, "Write operation type must be :insert, :update or :delete"
-      end
-      request = BSON::OrderedHash[op_type, collection_name, WRITE_COMMAND_ARG_KEY[op_type], argument]
-      request.merge!(:writeConcern => write_concern, :ordered => !opts[:continue_on_error])
-      request.merge!(opts)
+      request = build_write_command(op_type, selector, doc_or_docs, opts, write_concern, collection_name)
       instrument(op_type, :database => @db.name, :collection => collection_name, :selector => selector, :documents => doc_or_docs) do
         @db.command(request)
       end
     end
 
+    # Asynchronous counterpart of #send_write_command.
+    #
+    # @return [Mongo::Future] resolving to the write command's response.
+    def send_write_command_async(op_type, selector, doc_or_docs, check_keys, opts, write_concern, collection_name=@name)
+      request = build_write_command(op_type, selector, doc_or_docs, opts, write_concern, collection_name)
+      instrument(op_type, :database => @db.name, :collection => collection_name, :selector => selector, :documents => doc_or_docs) do
+        @db.command_async(request)
+      end
+    end
+
     def bulk_execute(ops, options, opts = {})
       errors = []
       write_concern_errors = []
@@ -334,7 +438,31 @@ module Mongo
 
     private
 
+    def build_write_command(op_type, selector, doc_or_docs, opts, write_concern, collection_name)
+      if op_type == :insert
+        argument = [doc_or_docs].flatten(1).compact
+      elsif op_type == :update
+        argument = [{:q => selector, :u => doc_or_docs, :multi => !!opts[:multi]}]
+        argument.first.merge!(:upsert => opts[:upsert]) if opts[:upsert]
+      elsif op_type == :delete
+        argument = [{:q => selector, :limit => (opts[:limit] || 0)}]
+      else
+        raise ArgumentError, "Write operation type must be :insert, :update or :delete"
+      end
+      request = BSON::OrderedHash[op_type, collection_name, WRITE_COMMAND_ARG_KEY[op_type], argument]
+      request.merge!(:writeConcern => write_concern, :ordered => !opts[:continue_on_error])
+      request.merge!(opts)
+    end
+
+    # Servers that take OP_MSG get the documents as a document sequence
+    # following the command. Others get them spliced into the command's
+    # array.
     def batch_message_initialize(message, op_type, continue_on_error, write_concern)
+      if @connection.use_op_msg?
+        body = BSON::OrderedHash[op_type, @name, :writeConcern, write_concern,
+                                 :ordered, !continue_on_error, :$db, @db.name]
+        return OpMsg.new(body, 0, message, @connection.max_bson_size).sequence(WRITE_COMMAND_ARG_KEY[op_type].to_s)
+      end
       message.clear!.clear
       @bson_empty ||= BSON::BSON_CODER.serialize({})
       message.put_binary(@bson_empty.to_s)
@@ -342,19 +470,30 @@ module Mongo
     end
 
     def batch_message_append(message, serialized_doc, write_concern)
-      message.push_doc!(serialized_doc)
+      message.is_a?(OpMsg) ? message.push(serialized_doc) : message.push_doc!(serialized_doc)
     end
 
     def batch_message_send(message, op_type, batch_docs, write_concern, continue_on_error)
+      if message.is_a?(OpMsg)
+        return instrument(op_type, :database => @db.name, :collection => @name, :documents => batch_docs) do
+          @db.command_msg(message)
+        end
+      end
       message.finish!
       request = BSON::OrderedHash[op_type, @name, :bson, message]
       request.merge!(:writeConcern => write_concern, :ordered => !continue_on_error)
-      instrument(:insert, :database => @db.name, :collection => @name, :documents => batch_docs) do
+      instrument(op_type, :database => @db.name, :collection => @name, :documents => batch_docs) do
         @db.command(request)
       end
     end
 
+    # An OP_MSG may fill a whole message, with each document up to the
+    # largest BSON size.
     def batch_write_max_sizes(write_concern)
+      if @connection.use_op_msg?
+        max_message_size = @connection.max_message_size
+        return [max_message_size, max_message_size - Networking::STANDARD_HEADER_SIZE, @connection.max_bson_size]
+      end
       [MongoClient::COMMAND_HEADROOM, MongoClient::APPEND_HEADROOM, MongoClient::SERIALIZE_HEADROOM].collect{|h| @connection.max_bson_size + h}
     end
 
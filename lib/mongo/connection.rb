@@ -13,7 +13,10 @@
 # limitations under the License.
 
 require 'mongo/connection/socket'
+require 'mongo/connection/cursor_reaper'
+require 'mongo/connection/hedged_reads'
 require 'mongo/connection/node'
+require 'mongo/connection/op_msg'
 require 'mongo/connection/pool'
 require 'mongo/connection/pool_manager'
 require 'mongo/connection/sharding_pool_manager'
@@ -0,0 +1,117 @@
+# Copyright (C) 2009-2013 MongoDB, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+module Mongo
+
+  # Kills server cursors in the background on behalf of a client.
+  #
+  # Cursors hand their ids to the reaper when they are closed, or when they
+  # are garbage collected while still open on the server. A background
+  # thread wakes every +interval+ seconds and sends one OP_KILL_CURSORS per
+  # pool carrying every id queued for that server, so closing a cursor never
+  # waits on the network.
+  #
+  # Ids are queued through a Queue, which may be pushed to from a finalizer.
+  # The thread is started once, when the reaper is created, so enqueueing
+  # never has to create a thread.
+  class CursorReaper
+    DEFAULT_INTERVAL    = 1
+    MAX_IDS_PER_MESSAGE = 10_000
+
+    attr_reader :interval
+
+    def initialize(client, interval=DEFAULT_INTERVAL)
+      @client   = client
+      @interval = interval
+      @queue    = Queue.new
+      @monitor  = Monitor.new
+      @thread   = nil
+      start
+    end
+
+    # Queue a server cursor to be killed.
+    #
+    # @param [Pool] pool the pool of the server holding the cursor.
+    # @param [Integer] cursor_id
+    def enqueue(pool, cursor_id)
+      return if cursor_id.nil? || cursor_id == 0
+      @queue << [pool, cursor_id]
+    end
+
+    # @return [Integer] the number of cursors waiting to be killed.
+    def pending
+      @queue.size
+    end
+
+    # Kill every queued cursor now, one message per server.
+    #
+    # @return [Integer] the number of cursors killed.
+    def flush
+      @monitor.synchronize do
+        ids_by_pool = {}
+        begin
+          loop do
+            pool, cursor_id = @queue.pop(true)
+            (ids_by_pool[pool] ||= []) << cursor_id
+          end
+        rescue ThreadError
+          # Queue drained.
+        end
+
+        ids_by_pool.inject(0) do |killed, (pool, ids)|
+          ids.each_slice(MAX_IDS_PER_MESSAGE) { |slice| kill_cursors(pool, slice) }
+          killed + ids.size
+        end
+      end
+    end
+
+    # Kill the queued cursors and stop the background thread. A stopped
+    # reaper is not restarted; MongoClient#close discards it and the client
+    # creates a new one when it is next needed.
+    def stop
+      flush
+      thread = @monitor.synchronize do
+        stopping, @thread = @thread, nil
+        stopping
+      end
+      thread.kill if thread && thread != Thread.current
+    end
+
+    private
+
+    def start
+      @monitor.synchronize do
+        @thread = Thread.new do
+          loop do
+            sleep(@interval)
+            begin
+              flush
+            rescue => ex
+              @client.logger.warn("MONGODB cursor reaper: #{ex.message}") if @client.logger
+            end
+          end
+        end
+      end
+    end
+
+    def kill_cursors(pool, ids)
+      message = BSON::ByteBuffer.new([0, 0, 0, 0])
+      message.put_int(ids.size)
+      ids.each { |cursor_id| message.put_long(cursor_id) }
+      @client.send_message(Mongo::Constants::OP_KILL_CURSORS, message, :pool => pool)
+    rescue ConnectionFailure, OperationTimeout, SystemCallError, IOError
+      # The server times these cursors out on its own.
+    end
+  end
+end
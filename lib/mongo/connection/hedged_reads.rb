@@ -0,0 +1,205 @@
+# Copyright (C) 2009-2013 MongoDB, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+module Mongo
+
+  # Sends a second copy of slow queries to another replica set member.
+  #
+  # Hedging applies to queries with the :secondary_preferred or :nearest
+  # read preference on a client created with the :hedged_reads option. A
+  # query is sent to the member chosen as usual. If that member has not
+  # replied within its recent +:percentile+ round-trip time (the 95th by
+  # default, kept between +:min_delay+ and +:max_delay+ milliseconds), the
+  # same query is sent to another eligible member and whichever replies
+  # first is used. The slower reply is read on a background thread and its
+  # cursor, if any, is killed.
+  #
+  # Commands, exhaust cursors and queries sent on a given socket are never
+  # hedged.
+  #
+  # @see MongoReplicaSetClient#hedged_reads
+  class HedgedReads
+    MODES              = [:secondary_preferred, :nearest]
+    DEFAULT_PERCENTILE = 0.95
+    DEFAULT_MIN_DELAY  = 2
+    DEFAULT_MAX_DELAY  = 1000
+
+    attr_reader :percentile, :min_delay, :max_delay
+
+    # @param [MongoReplicaSetClient] client
+    #
+    # @option opts [Float] :percentile (0.95) the fraction of a member's recent
+    #   replies that must have arrived sooner before a query to it is hedged.
+    # @option opts [Numeric] :min_delay (2) the shortest wait, in milliseconds.
+    # @option opts [Numeric] :max_delay (1000) the longest wait, in milliseconds.
+    def initialize(client, opts={})
+      opts        = {} unless opts.is_a?(Hash)
+      @client     = client
+      @percentile = opts[:percentile] || DEFAULT_PERCENTILE
+      @min_delay  = opts[:min_delay]  || DEFAULT_MIN_DELAY
+      @max_delay  = opts[:max_delay]  || DEFAULT_MAX_DELAY
+      @mutex      = Mutex.new
+      @counts     = { :reads => 0, :hedged => 0, :won => 0 }
+
+      unless @percentile > 0 && @percentile <= 1
+        raise MongoArgumentError, "Hedged read percentile must be greater than 0 and at most 1."
+      end
+    end
+
+    # Whether a query with this read preference mode may be hedged.
+    def hedge?(mode)
+      MODES.include?(mode)
+    end
+
+    # Seconds to wait for a reply from the given pool before hedging.
+    #
+    # @return [Float]
+    def delay(pool)
+      ms = pool.latency_percentile(@percentile) || pool.ping_time
+      [[ms, @min_delay].max, @max_delay].min / 1000.0
+    end
+
+    # @return [Hash] the number of queries that could be hedged, the hedges
+    #   sent, and the hedges that replied first.
+    def stats
+      @mutex.synchronize { @counts.dup }
+    end
+
+    # Send a query on the given socket, hedging it if it is slow.
+    #
+    # The socket is owned by this method from then on: it is returned if it
+    # carried the reply that was used, and otherwise closed or handed back
+    # to its pool once its reply has been read.
+    #
+    # @param [BSON::ByteBuffer] message an OP_QUERY message without its header.
+    # @param [Socket] socket a socket checked out from the first member's pool.
+    # @param [Hash] read_pref the query's read preference.
+    #
+    # @option opts [Boolean] :compile_regex (true)
+    # @option opts [Boolean] :raw (false)
+    #
+    # @return [Array] the documents, the number received, the cursor id, the
+    #   bytes read and the socket of the member whose reply was used.
+    def query(message, socket, read_pref, opts={})
+      body = message.to_s.dup
+      begin
+        first = send_query(message, socket)
+      rescue SystemCallError, IOError, ConnectionFailure => ex
+        discard(socket)
+        raise ex
+      end
+      increment(:reads)
+
+      hedge = nil
+      unless IO.select([socket], nil, nil, delay(socket.pool))
+        hedge = send_hedge(body, read_pref, socket.pool)
+      end
+      increment(:hedged) if hedge
+
+      pending = [first, hedge].compact
+      until pending.empty?
+        entry = next_ready(pending)
+        pending.delete(entry)
+        begin
+          reply = receive(entry, opts)
+        rescue OperationFailure => ex
+          # The server answered, so the socket is sound and the other
+          # member would only fail the same way.
+          entry[0].checkin
+          pending.each { |loser| cancel(loser) }
+          raise ex
+        rescue ConnectionFailure, OperationTimeout, SystemCallError, IOError => ex
+          discard(entry[0])
+          raise ex if pending.empty?
+          next
+        end
+        pending.each { |loser| cancel(loser) }
+        increment(:won) if entry.equal?(hedge)
+        return reply + [entry[0]]
+      end
+    end
+
+    private
+
+    # Returns [socket, request_id, time sent].
+    def send_query(message, socket)
+      [socket, @client.dispatch_message(Mongo::Constants::OP_QUERY, message, socket), Time.now]
+    end
+
+    def send_hedge(body, read_pref, excluded)
+      pool = @client.select_hedge_pool(read_pref, excluded)
+      return nil unless pool
+      socket = pool.checkout
+      begin
+        send_query(BSON::ByteBuffer.new(body), socket)
+      rescue SystemCallError, IOError, ConnectionFailure
+        discard(socket)
+        nil
+      end
+    rescue ConnectionFailure, ConnectionTimeoutError
+      nil
+    end
+
+    # Wait for one of the pending queries to be readable.
+    def next_ready(pending)
+      sockets = pending.map { |entry| entry[0] }
+      readable, _, errored = IO.select(sockets, nil, sockets, @client.op_timeout)
+      unless readable
+        pending.each { |entry| discard(entry[0]) }
+        raise OperationTimeout, "Timed out waiting on socket read."
+      end
+      ready = readable + errored
+      pending.find { |entry| ready.include?(entry[0]) }
+    end
+
+    def receive(entry, opts)
+      socket, request_id, started = entry
+      reply = @client.receive_reply(socket, request_id, opts.dup)
+      socket.pool.record_latency((Time.now - started) * 1000) if socket.pool
+      reply
+    end
+
+    # Read the slower reply in the background, so that its latency still
+    # counts and its cursor can be killed, then return the socket.
+    def cancel(entry)
+      Thread.new do
+        socket = entry[0]
+        begin
+          cursor_id = receive(entry, :raw => true)[2]
+          kill_cursor(socket, cursor_id) if cursor_id && cursor_id != 0
+          socket.checkin
+        rescue => ex
+          discard(socket)
+          @client.logger.warn("MONGODB hedged read: #{ex.message}") if @client.logger
+        end
+      end
+    end
+
+    def kill_cursor(socket, cursor_id)
+      message = BSON::ByteBuffer.new([0, 0, 0, 0])
+      message.put_int(1)
+      message.put_long(cursor_id)
+      @client.dispatch_message(Mongo::Constants::OP_KILL_CURSORS, message, socket)
+    end
+
+    def discard(socket)
+      socket.close unless socket.closed?
+      socket.checkin
+    end
+
+    def increment(counter)
+      @mutex.synchronize { @counts[counter] += 1 }
+    end
+  end
+end
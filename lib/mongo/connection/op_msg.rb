@@ -0,0 +1,163 @@
+# Copyright (C) 2009-2013 MongoDB, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+module Mongo
+
+  # Builds and parses OP_MSG messages, used for commands by servers of wire
+  # version 6 (MongoDB 3.6) and later.
+  #
+  # A message is a word of flag bits followed by sections: one body section
+  # (kind 0) holding the command document, and any number of document
+  # sequences (kind 1). A sequence has an identifier and a flat run of
+  # documents, which the server reads as an array field of the body with
+  # that name. Write batches put their documents in a sequence, so they are
+  # appended one after another rather than nested in an array.
+  #
+  # @example
+  #   msg = OpMsg.new(BSON::OrderedHash[:insert, 'logs', :$db, 'test'])
+  #   msg.sequence('documents')
+  #   docs.each { |doc| msg.push(BSON::BSON_CODER.serialize(doc, true, true)) }
+  #   client.send_op_msg(msg, socket)
+  class OpMsg
+    CHECKSUM_PRESENT = 1 << 0
+    MORE_TO_COME     = 1 << 1
+    EXHAUST_ALLOWED  = 1 << 16
+
+    # Flag bits 0 to 15 must be understood by the receiver.
+    REQUIRED_FLAGS = 0xffff
+    KNOWN_FLAGS    = CHECKSUM_PRESENT | MORE_TO_COME
+
+    BODY     = 0
+    SEQUENCE = 1
+
+    attr_reader :body, :flags, :message
+
+    # @param [Hash] body the command, including its $db field.
+    # @param [Integer] flags
+    # @param [BSON::ByteBuffer] message a buffer to reuse. It is cleared.
+    # @param [Integer] max_bson_size the largest body document allowed.
+    def initialize(body, flags=0, message=nil, max_bson_size=DEFAULT_MAX_BSON_SIZE)
+      @body    = body
+      @flags   = flags
+      @message = message || BSON::ByteBuffer.new
+      @message.clear!.clear
+      @message.put_int(flags)
+      @message.put(BODY)
+      @message.put_binary(BSON::BSON_CODER.serialize(body, false, false, max_bson_size).to_s)
+      @sequence_start = nil
+    end
+
+    # Start a document sequence. Documents pushed afterwards belong to it.
+    #
+    # @param [String] identifier the name of the body field it stands for.
+    #
+    # @return [OpMsg] self
+    def sequence(identifier)
+      finish_sequence
+      @message.put(SEQUENCE)
+      @sequence_start = @message.size
+      @message.put_int(0)
+      BSON::BSON_RUBY.serialize_cstr(@message, identifier)
+      self
+    end
+
+    # Append a serialized document to the current sequence.
+    #
+    # @param [String, BSON::ByteBuffer, BSON::RawDocument] bson
+    #
+    # @return [OpMsg] self
+    def push(bson)
+      raise MongoArgumentError, "Documents must be pushed into a sequence" unless @sequence_start
+      @message.put_binary(bson.to_s)
+      self
+    end
+
+    # @return [Integer] the size of the message so far, without its header.
+    def size
+      @message.size
+    end
+
+    # @return [Boolean] whether the sender expects no reply.
+    def more_to_come?
+      @flags & MORE_TO_COME != 0
+    end
+
+    # Close the last sequence.
+    #
+    # @return [BSON::ByteBuffer] the message without its header.
+    def finish!
+      finish_sequence
+      @message
+    end
+
+    # Parse an OP_MSG read after its header. A checksum, if present, is
+    # skipped without being verified.
+    #
+    # @param [String] data
+    # @param [Hash] opts options for BSON deserialization.
+    #
+    # @return [Array] the flags, the body document, and a Hash of the
+    #   documents of each sequence by identifier.
+    #
+    # @raise [ConnectionFailure] if a required flag bit is not understood
+    #   or the sections are malformed.
+    def self.parse(data, opts={})
+      flags = data.unpack('V')[0]
+      unknown = flags & REQUIRED_FLAGS & ~KNOWN_FLAGS
+      if unknown != 0
+        raise ConnectionFailure, "OP_MSG reply has unsupported flag bits #{unknown}"
+      end
+      finish = flags & CHECKSUM_PRESENT != 0 ? data.size - 4 : data.size
+
+      body = nil
+      sequences = {}
+      pos = 4
+      while pos < finish
+        kind = data[pos, 1].unpack('C')[0]
+        pos += 1
+        if kind == BODY
+          size = data[pos, 4].unpack('V')[0]
+          body = BSON::BSON_CODER.deserialize(data[pos, size], opts)
+          pos += size
+        elsif kind == SEQUENCE
+          size = data[pos, 4].unpack('V')[0]
+          last = pos + size
+          name_end = data.index("\0", pos + 4)
+          identifier = data[pos + 4...name_end]
+          docs = sequences[identifier] = []
+          pos = name_end + 1
+          while pos < last
+            doc_size = data[pos, 4].unpack('V')[0]
+            docs << BSON::BSON_CODER.deserialize(data[pos, doc_size], opts)
+            pos += doc_size
+          end
+        else
+          raise ConnectionFailure, "OP_MSG reply has unknown section kind #{kind}"
+        end
+      end
+      raise ConnectionFailure, "OP_MSG reply is malformed" if pos != finish || body.nil?
+
+      [flags, body, sequences]
+    end
+
+    private
+
+    def finish_sequence
+      return unless @sequence_start
+      @message.put_int(@message.size - @sequence_start, @sequence_start)
+      @message.position = @message.size
+      @sequence_start = nil
+    end
+  end
+end
@@ -18,6 +18,12 @@ module Mongo
     MAX_PING_TIME  = 1_000_000
     PRUNE_INTERVAL = 10_000
 
+    # Weight given to the newest sample in the round-trip time average.
+    LATENCY_WEIGHT = 0.2
+
+    # Number of recent round-trip times kept for #latency_percentile.
+    LATENCY_SAMPLES = 100
+
     attr_accessor :host,
                   :port,
                   :address,
@@ -59,6 +65,9 @@ module Mongo
       @closed                = false
       @thread_ids_to_sockets = {}
       @checkout_counter      = 0
+      @latency               = nil
+      @latency_samples       = []
+      @latency_index         = 0
     end
 
     # Close this pool.
@@ -98,7 +107,7 @@ module Mongo
 
     def inspect
       "#<Mongo::Pool:0x#{self.object_id.to_s(16)} @host=#{@host} @port=#{port} " +
-        "@ping_time=#{@ping_time} #{@checked_out.size}/#{@size} sockets available " +
+        "@ping_time=#{@ping_time} @latency=#{@latency} #{@checked_out.size}/#{@size} sockets available " +
         "up=#{!closed?}>"
     end
 
@@ -106,6 +115,68 @@ module Mongo
       "#{@host}:#{@port}"
     end
 
+    # Moving average of observed operation round-trip times in
+    # milliseconds, or nil before the first operation completes.
+    def latency
+      @latency
+    end
+
+    # Fold an operation's round-trip time, in milliseconds, into #latency
+    # and keep it as one of the samples for #latency_percentile.
+    def record_latency(ms)
+      @connection_mutex.synchronize do
+        @latency = @latency ? @latency + LATENCY_WEIGHT * (ms - @latency) : ms.to_f
+        if @latency_samples.size < LATENCY_SAMPLES
+          @latency_samples << ms
+        else
+          @latency_samples[@latency_index] = ms
+          @latency_index = (@latency_index + 1) % LATENCY_SAMPLES
+        end
+      end
+    end
+
+    # Start the round-trip time average at +ms+ if nothing has been
+    # recorded yet. No sample is kept, so #latency_percentile and outlier
+    # checks still wait for real round trips.
+    def seed_latency(ms)
+      @connection_mutex.synchronize { @latency ||= ms.to_f }
+    end
+
+    # Forget every recorded round-trip time, so the pool is judged afresh.
+    def reset_latency
+      @connection_mutex.synchronize do
+        @latency         = nil
+        @latency_samples = []
+        @latency_index   = 0
+      end
+    end
+
+    # Number of round-trip times currently kept, up to LATENCY_SAMPLES.
+    def latency_sample_count
+      @latency_samples.size
+    end
+
+    # The given percentile (0.95 for the 95th) of the last LATENCY_SAMPLES
+    # round-trip times in milliseconds, or nil before the first operation
+    # completes.
+    def latency_percentile(fraction)
+      samples = @connection_mutex.synchronize { @latency_samples.sort }
+      return nil if samples.empty?
+      samples[[(samples.size * fraction).ceil - 1, 0].max]
+    end
+
+    # Number of sockets currently checked out, i.e. operations in flight.
+    def in_flight
+      @checked_out.size
+    end
+
+    # Relative cost of sending another operation to this pool. A pool with
+    # no round-trip time yet scores as the cheapest, so pool managers that
+    # compare pools seed it first; see ShardingPoolManager.
+    def load
+      (@latency || 0) * (in_flight + 1)
+    end
+
     def host_port
       [@host, @port]
     end
@@ -169,9 +240,9 @@ module Mongo
 
     # Adds a new socket to the pool and checks it out.
     #
-    # This method is called exclusively from #checkout;
-    # therefore, it runs within a mutex.
-    def checkout_new_socket
+    # This method is called exclusively from #checkout and
+    # #checkout_unpinned; therefore, it runs within a mutex.
+    def checkout_new_socket(pin=true)
       begin
         socket = @client.socket_class.new(@host, @port, @client.op_timeout,
                                                         @client.connect_timeout,
@@ -185,7 +256,7 @@ module Mongo
 
       @sockets << socket
       @checked_out << socket
-      @thread_ids_to_sockets[Thread.current.object_id] = socket
+      @thread_ids_to_sockets[Thread.current.object_id] = socket if pin
       socket
     end
 
@@ -214,11 +285,11 @@ module Mongo
     # If the pid has changed, remove the socket and check out
     # new one.
     #
-    # This method is called exclusively from #checkout;
-    # therefore, it runs within a mutex.
-    def checkout_existing_socket(socket=nil)
+    # This method is called exclusively from #checkout and
+    # #checkout_unpinned; therefore, it runs within a mutex.
+    def checkout_existing_socket(socket=nil, available=nil, pin=true)
       if !socket
-        available = @sockets - @checked_out
+        available ||= @sockets - @checked_out
         socket = available[rand(available.length)]
       end
 
@@ -227,10 +298,10 @@ module Mongo
         if socket
           socket.close unless socket.closed?
         end
-        checkout_new_socket
+        checkout_new_socket(pin)
       else
         @checked_out << socket
-        @thread_ids_to_sockets[Thread.current.object_id] = socket
+        @thread_ids_to_sockets[Thread.current.object_id] = socket if pin
         socket
       end
     end
@@ -283,6 +354,7 @@ module Mongo
             if !socket.closed?
               begin
                 check_auths(socket)
+                Probes.fire(:pool_checkout, @checked_out.size, start_time) if Probes.enabled?(:pool_checkout)
                 return socket
               rescue ConnectionFailure
                 # Socket failed authentication and will be cleaned up below
@@ -302,6 +374,56 @@ module Mongo
       end
     end
 
+    # Check out a socket without binding it to the current thread. This
+    # lets a Reactor hold several sockets from one pool at once. The socket
+    # bound to the current thread is never handed out here, so that the
+    # thread's own blocking operations can still check it out.
+    #
+    # @param [Boolean] wait whether to wait for a socket when none is
+    #   available. If false, returns nil instead.
+    def checkout_unpinned(wait=true)
+      @client.connect if !@client.connected?
+      start_time = Time.now
+      loop do
+        if (Time.now - start_time) > @timeout
+          raise ConnectionTimeoutError, "could not obtain connection within " +
+            "#{@timeout} seconds. The max pool size is currently #{@size}; " +
+            "consider increasing the pool size or timeout."
+        end
+
+        @connection_mutex.synchronize do
+          socket = nil
+          available = @sockets - @checked_out - [@thread_ids_to_sockets[Thread.current.object_id]]
+          if !available.empty?
+            socket = checkout_existing_socket(nil, available, false)
+          elsif @sockets.size < @size
+            socket = checkout_new_socket(false)
+          end
+
+          if socket
+            if !socket.closed?
+              begin
+                check_auths(socket)
+                Probes.fire(:pool_checkout, @checked_out.size, start_time) if Probes.enabled?(:pool_checkout)
+                return socket
+              rescue ConnectionFailure
+                # Socket failed authentication and will be cleaned up below
+              end
+            end
+
+            @checked_out.delete(socket)
+            @sockets.delete(socket)
+          elsif wait
+            # Wake up in time to raise once the timeout has passed.
+            remaining = @timeout - (Time.now - start_time)
+            @queue.wait(@connection_mutex, remaining) if remaining > 0
+          else
+            return nil
+          end
+        end
+      end
+    end
+
     private
 
     # Helper method to handle keeping track of auths/logouts for sockets.
@@ -18,8 +18,32 @@ module Mongo
       "<Mongo::ShardingPoolManager:0x#{self.object_id.to_s(16)} @seeds=#{@seeds}>"
     end
 
-    # "Best" should be the member with the fastest ping time
-    # but connect/connect_to_members reinitializes @members
+    # How often every mongos is pinged, in seconds. Pings measure the
+    # round-trip times used for selection and re-admit ejected mongos.
+    PROBE_INTERVAL = 1
+
+    # A mongos whose round-trip time average exceeds the median of the
+    # others by this factor, and by at least OUTLIER_MIN_MS milliseconds,
+    # is ejected. Pools with fewer than OUTLIER_MIN_SAMPLES recorded round
+    # trips are not judged.
+    OUTLIER_FACTOR      = 3
+    OUTLIER_MIN_MS      = 10
+    OUTLIER_MIN_SAMPLES = 5
+
+    # Pools for every healthy mongos, in discovery order.
+    attr_reader :mongos_pools
+
+    def initialize(client, seeds=[])
+      super
+      @mongos_pools   = [].freeze
+      @ejected        = {}
+      @eject_mutex    = Mutex.new
+      @probe_thread   = nil
+    end
+
+    # The first mongos remains the primary pool for callers that want a
+    # single router (e.g. MongoClient#host); selection spreads operations
+    # across all of them.
     def best(members)
       Array(members.first)
     end
@@ -31,13 +55,71 @@ module Mongo
           @refresh_required = false
           disconnect_old_members
           connect_to_members
-          initialize_pools best(@members)
+          initialize_pools @members
           update_max_sizes
           @seeds = discovered_seeds
         ensure
           thread_local[:locks][:connecting_manager] = false
         end
       end
+      start_probe_thread
+      clone_state
+    end
+
+    # Pick a mongos pool using the power of two choices: sample two pools
+    # that are not ejected and take the one with the lower load, where load
+    # weighs a pool's recent ping round-trip time by its operations in
+    # flight. If every pool has been ejected, all of them are considered
+    # again rather than failing outright.
+    #
+    # @param [Array<Pool>] exclude pools not to consider, e.g. ones that
+    #   already failed for this operation.
+    #
+    # @return [Pool, nil]
+    def select_pool(exclude=[])
+      candidates = @mongos_pools - exclude
+      available  = candidates.reject { |pool| pool.closed? || ejected?(pool) }
+      available  = candidates if available.empty?
+      return available.first if available.size < 2
+
+      i = rand(available.size)
+      j = rand(available.size - 1)
+      j += 1 if j >= i
+      first, second = available[i], available[j]
+      first.load <= second.load ? first : second
+    end
+
+    # Stop selecting the given pool until a background probe finds its
+    # mongos reachable again.
+    def eject(pool)
+      @eject_mutex.synchronize do
+        return if @ejected.key?(pool)
+        @client.log(:warn, "Ejecting mongos #{pool.host_string} from selection.")
+        @ejected[pool] = Time.now
+      end
+      start_probe_thread
+    end
+
+    def ejected?(pool)
+      @ejected.key?(pool)
+    end
+
+    # Eject the given pool if its ping round-trip time has become an
+    # outlier against the other mongos still in selection. Called after
+    # every probe of the pool.
+    def check_latency(pool)
+      latency = pool.latency
+      return unless latency && pool.latency_sample_count >= OUTLIER_MIN_SAMPLES
+      return unless @mongos_pools.include?(pool) && !ejected?(pool)
+
+      others = (@mongos_pools - [pool]).reject { |other| other.closed? || ejected?(other) }
+      others = others.map { |other| other.latency }.compact.sort
+      return if others.empty?
+
+      median = others[others.size / 2]
+      if latency > median * OUTLIER_FACTOR && latency - median > OUTLIER_MIN_MS
+        eject(pool)
+      end
     end
 
     # Checks that each node is healthy (via check_is_master) and that each
@@ -63,5 +145,88 @@ module Mongo
       @refresh_required
     end
 
+    private
+
+    # Every healthy mongos gets a pool of its own.
+    def initialize_pools(members)
+      super(best(members))
+      @mongos_pools = members.map do |member|
+        if @primary_pool && @primary_pool.node == member
+          @primary_pool
+        elsif existing = @pools_mutable.detect { |pool| pool.node == member }
+          existing
+        else
+          pool = Pool.new(self.client, member.host, member.port,
+            :size => self.client.pool_size,
+            :timeout => self.client.pool_timeout,
+            :node => member
+          )
+          @pools_mutable << pool
+          pool
+        end
+      end.freeze
+      @eject_mutex.synchronize do
+        @ejected.delete_if { |pool, _| !@mongos_pools.include?(pool) }
+      end
+      seed_latencies
+    end
+
+    # Pings every mongos until all of its pools are closed. Only pings are
+    # timed, so a mongos that serves slow queries is not mistaken for a
+    # slow router.
+    def start_probe_thread
+      @eject_mutex.synchronize do
+        return if @probe_thread && @probe_thread.alive?
+        @probe_thread = Thread.new do
+          until @mongos_pools.all? { |pool| pool.closed? }
+            sleep(PROBE_INTERVAL)
+            @mongos_pools.each { |pool| probe(pool) unless pool.closed? }
+            seed_latencies
+          end
+        end
+      end
+    end
+
+    def probe(pool)
+      ms = ping(pool)
+      if ejected?(pool)
+        readmit(pool) if ms
+      elsif ms
+        pool.record_latency(ms)
+        check_latency(pool)
+      else
+        eject(pool)
+      end
+    end
+
+    # A re-admitted pool starts without a round-trip time history, so its
+    # next pings decide whether it is still an outlier.
+    def readmit(pool)
+      pool.reset_latency
+      @eject_mutex.synchronize { @ejected.delete(pool) }
+      seed_latencies
+      @client.log(:info, "Re-admitting mongos #{pool.host_string} to selection.")
+    end
+
+    # Pools without a round-trip time yet would score a load of zero and
+    # win every comparison, so they start from the median of their peers.
+    def seed_latencies
+      known = @mongos_pools.map { |pool| pool.latency }.compact.sort
+      return if known.empty?
+      median = known[known.size / 2]
+      @mongos_pools.each { |pool| pool.seed_latency(median) }
+    end
+
+    # Round-trip time of a ping in milliseconds, or nil if the mongos
+    # could not be reached.
+    def ping(pool)
+      node = pool.node
+      node.connect unless node.connected?
+      return nil unless node.connected?
+      started = Time.now
+      node.active? ? (Time.now - started) * 1000 : nil
+    rescue ConnectionFailure, OperationFailure, OperationTimeout, SocketError, SystemCallError, IOError
+      nil
+    end
   end
 end
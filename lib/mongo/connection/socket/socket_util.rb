@@ -34,4 +34,9 @@ module SocketUtil
   def closed?
     @socket.closed?
   end
+
+  # Lets the wrapper be passed straight to IO.select.
+  def to_io
+    @socket.to_io
+  end
 end
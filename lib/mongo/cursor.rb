@@ -25,7 +25,7 @@ module Mongo
     attr_reader :collection, :selector, :fields,
       :order, :hint, :snapshot, :timeout, :transformer,
       :options, :cursor_id, :show_disk_loc,
-      :comment, :compile_regex, :read, :tag_sets,
+      :comment, :compile_regex, :raw, :read, :tag_sets,
       :acceptable_latency
 
     # Create a new cursor.
@@ -59,6 +59,10 @@ module Mongo
       @show_disk_loc = opts.delete(:show_disk_loc)
       @comment       = opts.delete(:comment)
       @compile_regex = opts.key?(:compile_regex) ? opts.delete(:compile_regex) : true
+      @raw           = !!opts.delete(:raw)
+      @dereference   = opts.delete(:dereference)
+      @track_changes = opts.delete(:track_changes)
+      @query_cache   = opts.delete(:query_cache)
 
       # Wire-protocol settings
       @fields   = convert_fields_for_query(opts.delete(:fields))
@@ -82,6 +86,8 @@ module Mongo
       @acceptable_latency = opts.delete(:acceptable_latency) || @collection.acceptable_latency
 
       batch_size(opts.delete(:batch_size) || 0)
+      adaptive_batch = opts.delete(:adaptive_batch)
+      @batch_sizer = BatchSizer.new(adaptive_batch.is_a?(Hash) ? adaptive_batch : {}) if adaptive_batch
 
       @cache                = opts.delete(:first_batch) || []
       @returned             = 0
@@ -100,6 +106,7 @@ module Mongo
       if @cursor_id
         @command_cursor = true
         @query_run      = true
+        track_cursor
       end
 
       if @collection.name =~ /^\$cmd/ || @collection.name =~ /^system/
@@ -111,6 +118,18 @@ module Mongo
       @opts = opts
     end
 
+    # Send a query message serialized ahead of time instead of building one
+    # from the selector and options. Used by PreparedQuery.
+    #
+    # @param [String] message an OP_QUERY message body without its header.
+    #
+    # @return [Cursor] self
+    def use_query_message(message)
+      check_modifiable
+      @query_message = message
+      self
+    end
+
     # Guess whether the cursor is alive on the server.
     #
     # Note that this method only checks whether we have
@@ -129,7 +148,8 @@ module Mongo
 
     # Get the next document specified the cursor options.
     #
-    # @return [Hash, Nil] the next document or Nil if no documents remain.
+    # @return [Hash, String, Nil] the next document, serialized if the cursor
+    #   was created with the :raw option, or Nil if no documents remain.
     def next
       if @cache.length == 0
         if @query_run && exhaust?
@@ -141,7 +161,7 @@ module Mongo
       end
       doc = @cache.shift
 
-      if doc && (err = doc['errmsg'] || doc['$err']) # assignment
+      if doc.is_a?(Hash) && (err = doc['errmsg'] || doc['$err']) # assignment
         code = doc['code'] || doc['assertionCode']
 
         # If the server has stopped being the master (e.g., it's one of a
@@ -158,7 +178,7 @@ module Mongo
         end
 
         raise OperationFailure.new(err, code, doc)
-      elsif doc && (write_concern_error = doc['writeConcernError']) # assignment
+      elsif doc.is_a?(Hash) && (write_concern_error = doc['writeConcernError']) # assignment
         raise WriteConcernError.new(write_concern_error['errmsg'], write_concern_error['code'], doc)
       end
 
@@ -170,6 +190,37 @@ module Mongo
     end
     alias :next_document :next
 
+    # Get the next document without blocking on the initial query.
+    #
+    # The query is written through the current thread's Reactor and the
+    # returned future resolves to the first document once the reply has been
+    # read. Later documents are fetched with Cursor#next as usual. Exhaust
+    # cursors are not supported.
+    #
+    # @return [Mongo::Future] resolving to a Hash or nil.
+    def next_async
+      reactor = @connection.reactor
+      return reactor.immediate { self.next } if @query_run || @socket
+
+      if exhaust?
+        raise InvalidOperation, "Exhaust cursors cannot be read asynchronously."
+      end
+
+      pool = @pool || async_pool
+      reactor.dispatch(pool, Mongo::Constants::OP_QUERY, construct_query_message,
+                       :compile_regex => compile_regex?, :raw => raw_reply?) do |results, n_received, cursor_id|
+        @pool        = pool
+        @n_received  = n_received
+        @cursor_id   = cursor_id
+        @returned   += n_received
+        @cache      += dereference(results)
+        @query_run   = true
+        track_cursor
+        close_cursor_if_query_complete
+        self.next
+      end
+    end
+
     # Reset this cursor on the server. Cursor options, such as the
     # query string and the values for skip and limit, are preserved.
     def rewind!
@@ -213,8 +264,19 @@ module Mongo
       command.merge!(BSON::OrderedHash["fields", @fields])
       command.merge!(BSON::OrderedHash["hint", hint]) if hint
 
+      if @query_cache
+        key = QueryCache.key(BSON::BSON_CODER.serialize(command).to_s, read_preference)
+        count = @query_cache.fetch(key)
+        return count if count
+        generation = @query_cache.generation
+      end
+
       response = @db.command(command, :read => @read, :comment => @comment)
-      return response['n'].to_i if Mongo::Support.ok?(response)
+      if Mongo::Support.ok?(response)
+        count = response['n'].to_i
+        @query_cache.store(key, count, 8, generation) if generation
+        return count
+      end
       return 0 if response['errmsg'] == "ns missing"
       raise OperationFailure.new("Count failed: #{response['errmsg']}", response['code'], response)
     end
@@ -326,6 +388,15 @@ module Mongo
       self
     end
 
+    # Statistics for cursors created with the :adaptive_batch option: the
+    # byte target and latency budget, the current average document size and
+    # time per document, and every getMore batch size chosen so far.
+    #
+    # @return [Hash, nil] nil unless the cursor sizes batches adaptively.
+    def batch_stats
+      @batch_sizer && @batch_sizer.stats
+    end
+
     # Iterate over each document in this cursor, yielding it to the given
     # block, if provided. An Enumerator is returned if no block is given.
     #
@@ -350,6 +421,44 @@ module Mongo
         end
       end
     end
+
+    # Iterate over the results one server batch at a time, decoding only the
+    # given fields of each batch into columns. No Hash is built for any
+    # document, which makes this the cheapest way to aggregate a few fields
+    # over many documents. The cursor's :transformer and :dereference
+    # options are ignored.
+    #
+    # This must be called before the query has been run, and iterating over
+    # every batch will close the cursor.
+    #
+    # @param [Array] paths the fields to decode, as dotted paths.
+    #
+    # @yield [Hash] a BSON::Column for each path, with one row for each
+    #   document in the batch. An Enumerator is returned if no block is given.
+    #
+    # @example Sum a field:
+    #   total = 0
+    #   metrics.find({}, :fields => ['value']).each_column_batch(['value']) do |columns|
+    #     columns['value'].each { |value| total += value if value }
+    #   end
+    def each_column_batch(paths)
+      return enum_for(:each_column_batch, paths) unless block_given?
+      check_modifiable
+      @raw = true
+
+      while num_remaining > 0
+        batch, @cache = @cache, []
+        unless batch.first.is_a?(String)
+          # The server reported an error, which is read as a document.
+          @cache = batch
+          self.next
+          next
+        end
+        yield BSON::BSON_CODER.decode_columns(batch.join, batch.size, paths)
+      end
+      nil
+    end
+
     # Receive all the documents from this cursor as an array of hashes.
     #
     # Notes:
@@ -391,18 +500,23 @@ module Mongo
     # @return [True]
     def close
       if @cursor_id && @cursor_id != 0
-        message = BSON::ByteBuffer.new([0, 0, 0, 0])
-        message.put_int(1)
-        message.put_long(@cursor_id)
         log(:debug, "Cursor#close #{@cursor_id}")
-        @connection.send_message(
-          Mongo::Constants::OP_KILL_CURSORS,
-          message,
-          :pool => @pool
-        )
+        if (reaper = @connection.cursor_reaper) # assignment
+          reaper.enqueue(@pool, @cursor_id)
+        else
+          message = BSON::ByteBuffer.new([0, 0, 0, 0])
+          message.put_int(1)
+          message.put_long(@cursor_id)
+          @connection.send_message(
+            Mongo::Constants::OP_KILL_CURSORS,
+            message,
+            :pool => @pool
+          )
+        end
       end
       @cursor_id = 0
       @closed    = true
+      untrack_cursor
     end
 
     # Is this cursor closed?
@@ -543,14 +657,32 @@ module Mongo
     # Pins pools upon successful read and unpins pool upon ConnectionFailure
     #
     def send_initial_query
+      message = nil
+      if cached_query?
+        message = construct_query_message
+        key = QueryCache.key(message.to_s, read_preference)
+        if (results = @query_cache.fetch(key)) # assignment
+          return load_cached_reply(results)
+        end
+        generation = @query_cache.generation
+      end
+
       tries = 0
       instrument(:find, instrument_payload) do
         begin
-          message = construct_query_message
+          message ||= construct_query_message
           socket = @socket || checkout_socket_from_connection
-          results, @n_received, @cursor_id = @connection.receive_message(
-            Mongo::Constants::OP_QUERY, message, nil, socket, @command,
-            nil, exhaust?, compile_regex?)
+          started = Time.now
+          if hedger = hedger_for(socket)
+            hedged, socket = socket, nil
+            results, @n_received, @cursor_id, bytes, socket = hedger.query(
+              message, hedged, read_preference, :compile_regex => compile_regex?, :raw => raw_reply?)
+            @pool = socket.pool
+          else
+            results, @n_received, @cursor_id, bytes = @connection.receive_message(
+              Mongo::Constants::OP_QUERY, message, nil, socket, @command,
+              nil, exhaust?, compile_regex?, raw_reply?)
+          end
         rescue ConnectionFailure => ex
           socket.close if socket
           @pool = nil
@@ -558,6 +690,7 @@ module Mongo
           @connection.refresh
           if tries < 3 && !@socket && (!@command || Mongo::ReadPreference::secondary_ok?(@selector))
             tries += 1
+            message = nil
             retry
           else
             raise ex
@@ -571,14 +704,40 @@ module Mongo
         if pin_pool?(results.first)
           @connection.pin_pool(socket.pool, read_preference)
         end
+        record_batch(bytes, started)
+
+        if generation && @cursor_id.zero? && results.all? { |doc| doc.is_a?(String) }
+          # Raw cursors hand these Strings to the caller, so the cache keeps its own.
+          @query_cache.store(key, results.map { |bson| bson.dup.freeze }, results.inject(0) { |sum, doc| sum + doc.size }, generation)
+        end
 
         @returned += @n_received
-        @cache += results
+        @cache += dereference(results)
         @query_run = true
+        track_cursor
         close_cursor_if_query_complete
       end
     end
 
+    # Whether the initial query is answered from the collection's query
+    # cache when it can be. Queries on a given socket, tailable and exhaust
+    # cursors, explains and commands always go to the server.
+    def cached_query?
+      !!@query_cache && !@socket && !@tailable && !@explain && !@command && !exhaust?
+    end
+
+    # Take the first batch from a reply held in the query cache. The reply
+    # is complete, so there is no cursor on the server. Raw documents are
+    # copied, since the cached Strings are shared by every hit.
+    def load_cached_reply(results)
+      @n_received = results.size
+      @cursor_id  = 0
+      @returned  += @n_received
+      @cache     += dereference(@raw ? results.map { |bson| bson.dup } : results)
+      @query_run  = true
+      close_cursor_if_query_complete
+    end
+
     def send_get_more
       message = BSON::ByteBuffer.new([0, 0, 0, 0])
 
@@ -586,14 +745,15 @@ module Mongo
       BSON::BSON_RUBY.serialize_cstr(message, full_collection_name)
 
       # Number of results to return.
+      batch_size = @batch_sizer ? @batch_sizer.next_batch_size : @batch_size
       if @limit > 0
         limit = @limit - @returned
-        if @batch_size > 0
-          limit = limit < @batch_size ? limit : @batch_size
+        if batch_size > 0
+          limit = limit < batch_size ? limit : batch_size
         end
         message.put_int(limit)
       else
-        message.put_int(@batch_size)
+        message.put_int(batch_size)
       end
 
       # Cursor id.
@@ -603,18 +763,79 @@ module Mongo
       socket = @pool.checkout
 
       begin
-        results, @n_received, @cursor_id = @connection.receive_message(
+        started = Time.now
+        results, @n_received, @cursor_id, bytes = @connection.receive_message(
           Mongo::Constants::OP_GET_MORE, message, nil, socket, @command,
-          nil, exhaust?, compile_regex?)
+          nil, exhaust?, compile_regex?, raw_reply?)
       ensure
         socket.checkin
       end
+      record_batch(bytes, started)
 
       @returned += @n_received
-      @cache += results
+      @cache += dereference(results)
+      track_cursor
       close_cursor_if_query_complete
     end
 
+    # Keep the client's cursor reaper informed of the server cursor this
+    # object holds, so that it is killed if the cursor is garbage collected
+    # without being closed.
+    def track_cursor
+      if @reap_state
+        @reap_state[0] = @pool
+        @reap_state[1] = @cursor_id
+      elsif @cursor_id && @cursor_id != 0 && @connection.cursor_reaper
+        @reap_state = [@pool, @cursor_id]
+        ObjectSpace.define_finalizer(self, Cursor.reap_on_finalize(@connection, @reap_state))
+      end
+    end
+
+    def untrack_cursor
+      return unless @reap_state
+      ObjectSpace.undefine_finalizer(self)
+      @reap_state = nil
+    end
+
+    # Built outside the instance so the finalizer does not keep the cursor
+    # alive. The client's reaper is looked up when the finalizer runs, so a
+    # reaper stopped by MongoClient#close is never used.
+    def self.reap_on_finalize(client, state)
+      proc { client.reap_cursor(state[0], state[1]) }
+    end
+
+    # Batches are read raw when dereferencing, tracking changes or caching
+    # replies, to be decoded by #dereference.
+    def raw_reply?
+      @raw || !!@dereference || !!@track_changes || cached_query?
+    end
+
+    # Decode a batch read raw for the :dereference, :track_changes or
+    # :query_cache option.
+    # With :track_changes each document keeps the bytes it was decoded from.
+    # With :dereference the DBRefs met while decoding are collected, and
+    # each is replaced with the document it points to.
+    def dereference(results)
+      return results if @raw || !raw_reply?
+      dbrefs = @dereference ? [] : nil
+      docs = results.map do |bson|
+        next bson unless bson.is_a?(String)
+        doc = BSON::BSON_CODER.deserialize(bson, :compile_regex => compile_regex?, :dbrefs => dbrefs)
+        doc.original_bson = bson if @track_changes
+        doc
+      end
+      unless dbrefs.nil? || dbrefs.empty?
+        targets = @db.dereference_all(dbrefs.map { |entry| entry[2] }, @dereference.is_a?(Hash) ? @dereference : {})
+        dbrefs.each_with_index { |entry, i| entry[0][entry[1]] = targets[i] }
+      end
+      docs
+    end
+
+    def record_batch(bytes, started)
+      return unless @batch_sizer && bytes
+      @batch_sizer.record(@n_received, bytes, (Time.now - started) * 1000)
+    end
+
     def checkout_socket_from_connection
       begin
         if @pool
@@ -632,11 +853,20 @@ module Mongo
       socket
     end
 
+    def async_pool
+      if @command && !Mongo::ReadPreference::secondary_ok?(@selector)
+        @connection.reader_pool(:mode => :primary)
+      else
+        @connection.reader_pool(read_preference)
+      end
+    end
+
     def checkin_socket(sock)
       @connection.checkin(sock)
     end
 
     def construct_query_message
+      return BSON::ByteBuffer.new(@query_message.dup) if @query_message
       message = BSON::ByteBuffer.new("", @connection.max_bson_size + MongoClient::COMMAND_HEADROOM)
       message.put_int(@options)
       BSON::BSON_RUBY.serialize_cstr(message, full_collection_name)
@@ -734,8 +964,15 @@ module Mongo
       indexes.join("_")
     end
 
+    # The HedgedReads to send the initial query through, if it may be hedged.
+    def hedger_for(socket)
+      return nil if @socket || @command || exhaust? || @connection.mongos?
+      hedger = @connection.hedged_reads
+      hedger if hedger && hedger.hedge?(@read) && socket.pool
+    end
+
     def pin_pool?(response)
-      ( response && (response['cursor'] || response['cursors']) ) ||
+      ( response.is_a?(Hash) && (response['cursor'] || response['cursors']) ) ||
         ( !@socket && !@command )
     end
   end
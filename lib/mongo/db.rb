@@ -447,6 +447,40 @@ module Mongo
       collection(dbref.namespace).find_one("_id" => dbref.object_id)
     end
 
+    # Dereference many DBRefs with one query per collection.
+    #
+    # @param [Array<Mongo::DBRef>] dbrefs the references; nil entries are allowed.
+    #
+    # @option opts [Boolean] :parallel (false) query the collections from
+    #   separate threads.
+    #
+    # @return [Array] the document each reference points to, or nil, in
+    #   the order of +dbrefs+.
+    def dereference_all(dbrefs, opts={})
+      ids = {}
+      dbrefs.each do |dbref|
+        (ids[dbref.namespace] ||= []) << dbref.object_id if dbref
+      end
+
+      lookup = lambda do |namespace|
+        docs = {}
+        collection(namespace).find("_id" => { "$in" => ids[namespace].uniq }).each do |doc|
+          docs[doc["_id"]] = doc
+        end
+        docs
+      end
+
+      found = {}
+      if opts[:parallel] && ids.size > 1
+        threads = ids.keys.map { |namespace| [namespace, Thread.new { lookup.call(namespace) }] }
+        threads.each { |namespace, thread| found[namespace] = thread.value }
+      else
+        ids.keys.each { |namespace| found[namespace] = lookup.call(namespace) }
+      end
+
+      dbrefs.map { |dbref| dbref && found[dbref.namespace][dbref.object_id] }
+    end
+
     # Evaluate a JavaScript expression in MongoDB.
     #
     # @param [String, Code] code a JavaScript expression to evaluate server-side.
@@ -576,61 +610,65 @@ module Mongo
     #
     # @return [Hash]
     def command(selector, opts={})
-      raise MongoArgumentError, "Command must be given a selector" unless selector.respond_to?(:keys) && !selector.empty?
-
-      opts = opts.dup
-      # deletes :check_response and returns the value, if nil defaults to the block result
-      check_response = opts.delete(:check_response) { true }
-
-      # build up the command hash
-      command = opts.key?(:socket) ? { :socket => opts.delete(:socket) } : {}
-      command.merge!(:comment => opts.delete(:comment)) if opts.key?(:comment)
-      command.merge!(:compile_regex => opts.delete(:compile_regex)) if opts.key?(:compile_regex)
-      command[:limit] = -1
-      command[:read] = Mongo::ReadPreference::cmd_read_pref(opts.delete(:read), selector) if opts.key?(:read)
-
-      if RUBY_VERSION < '1.9' && selector.class != BSON::OrderedHash
-        if selector.keys.length > 1
-          raise MongoArgumentError, "DB#command requires an OrderedHash when hash contains multiple keys"
-        end
-        if opts.keys.size > 0
-          # extra opts will be merged into the selector, so make sure it's an OH in versions < 1.9
-          selector = selector.dup
-          selector = BSON::OrderedHash.new.merge!(selector)
-        end
-      end
-
-      # arbitrary opts are merged into the selector
-      command[:selector] = selector.merge!(opts)
+      command, check_response = prepare_command(selector, opts)
 
       begin
-        result = Cursor.new(system_command_collection, command).next_document
-      rescue OperationFailure => ex
-        if check_response
-          raise ex.class.new("Database command '#{selector.keys.first}' failed: #{ex.message}", ex.error_code, ex.result)
+        if direct_command?(command)
+          result = run_command(command)
         else
-          result = ex.result
+          result = Cursor.new(system_command_collection, command).next_document
         end
+      rescue OperationFailure => ex
+        result = command_failure(selector, ex, check_response)
       end
 
-      raise OperationFailure,
-        "Database command '#{selector.keys.first}' failed: returned null." unless result
+      check_command_result(selector, result, check_response)
+    end
 
-      if check_response && (!ok?(result) || result['writeErrors'] || result['writeConcernError'])
-        message = "Database command '#{selector.keys.first}' failed: ("
-        message << result.map do |key, value|
-          "#{key}: '#{value}'"
-        end.join('; ')
-        message << ').'
-        code = result['code'] || result['assertionCode']
-        if result['writeErrors']
-          code = result['writeErrors'].first['code']
-        end
-        raise ExecutionTimeout.new(message, code, result) if code == MAX_TIME_MS_CODE
-        raise OperationFailure.new(message, code, result)
+    # Send a command without blocking on its reply.
+    #
+    # Takes the same arguments as DB#command. The command is written through
+    # the current thread's Reactor, and errors are raised when the value of
+    # the returned future is read.
+    #
+    # @return [Mongo::Future] resolving to the command's response.
+    def command_async(selector, opts={})
+      command, check_response = prepare_command(selector, opts)
+
+      Cursor.new(system_command_collection, command).next_async.recover do |ex|
+        raise ex unless ex.is_a?(OperationFailure)
+        command_failure(selector, ex, check_response)
+      end.then do |result|
+        check_command_result(selector, result, check_response)
       end
+    end
 
-      result
+    # Send a command built as an OP_MSG to the primary. Errors are raised as
+    # by DB#command.
+    #
+    # @param [OpMsg] op_msg a message whose body includes this database as $db.
+    # @param [Boolean] check_response (true) if +true+, raises an exception if
+    #   the command fails.
+    #
+    # @return [Hash, nil] the command's response, or nil if none was asked for.
+    #
+    # @private
+    def command_msg(op_msg, check_response=true)
+      selector = op_msg.body
+      socket   = @client.checkout_writer
+      begin
+        result = @client.send_op_msg(op_msg, socket)
+      ensure
+        socket.checkin
+      end
+      return result if op_msg.more_to_come?
+
+      begin
+        check_command_reply(result)
+      rescue OperationFailure => ex
+        result = command_failure(selector, ex, check_response)
+      end
+      check_command_result(selector, result, check_response)
     end
 
     # A shortcut returning db plus dot plus collection name.
@@ -717,6 +755,146 @@ module Mongo
 
     private
 
+    # Builds the cursor options for DB#command and DB#command_async.
+    #
+    # @return [Array] the cursor options and whether to check the response.
+    def prepare_command(selector, opts)
+      raise MongoArgumentError, "Command must be given a selector" unless selector.respond_to?(:keys) && !selector.empty?
+
+      opts = opts.dup
+      # deletes :check_response and returns the value, if nil defaults to the block result
+      check_response = opts.delete(:check_response) { true }
+
+      # build up the command hash
+      command = opts.key?(:socket) ? { :socket => opts.delete(:socket) } : {}
+      command.merge!(:comment => opts.delete(:comment)) if opts.key?(:comment)
+      command.merge!(:compile_regex => opts.delete(:compile_regex)) if opts.key?(:compile_regex)
+      command[:limit] = -1
+      command[:read] = Mongo::ReadPreference::cmd_read_pref(opts.delete(:read), selector) if opts.key?(:read)
+
+      if RUBY_VERSION < '1.9' && selector.class != BSON::OrderedHash
+        if selector.keys.length > 1
+          raise MongoArgumentError, "DB#command requires an OrderedHash when hash contains multiple keys"
+        end
+        if opts.keys.size > 0
+          # extra opts will be merged into the selector, so make sure it's an OH in versions < 1.9
+          selector = selector.dup
+          selector = BSON::OrderedHash.new.merge!(selector)
+        end
+      end
+
+      # arbitrary opts are merged into the selector
+      command[:selector] = selector.merge!(opts)
+      [command, check_response]
+    end
+
+    # Commands are run without a Cursor unless they need one of its extras: a
+    # given socket, a comment, or a $readPreference wrapper for mongos.
+    def direct_command?(command)
+      return false if command.key?(:socket) || command.key?(:comment)
+      (command[:read] || @read) == :primary || !@client.mongos?
+    end
+
+    # Runs a command with one OP_QUERY on a checked-out socket and returns
+    # the single reply document. The selector is serialized once, whatever
+    # the number of tries. Routing, retries, pool pinning and errors are
+    # those of Cursor#send_initial_query and Cursor#next.
+    def run_command(command)
+      selector  = command[:selector]
+      read      = command[:read] || @read
+      read_pref = { :mode => read, :tags => @tag_sets, :latency => @acceptable_latency }
+      secondary = Mongo::ReadPreference::secondary_ok?(selector)
+
+      bson  = selector.delete(:bson)
+      query = BSON::BSON_CODER.serialize(selector, false, false, @client.max_bson_size + MongoClient::APPEND_HEADROOM)
+      query.grow(bson) if bson
+      query = query.to_s
+
+      payload = { :database => @name, :collection => SYSTEM_COMMAND_COLLECTION, :selector => selector, :limit => -1 }
+      tries   = 0
+      reply   = nil
+      @client.instrument(:find, payload) do
+        begin
+          message = BSON::ByteBuffer.new("", @client.max_bson_size + MongoClient::COMMAND_HEADROOM)
+          message.put_int(read == :primary ? 0 : Mongo::Constants::OP_QUERY_SLAVE_OK)
+          BSON::BSON_RUBY.serialize_cstr(message, "#{@name}.#{SYSTEM_COMMAND_COLLECTION}")
+          message.put_int(0)
+          message.put_int(-1)
+          message.put_binary(query)
+
+          socket = @client.checkout_reader(secondary ? read_pref : { :mode => :primary })
+          docs = @client.receive_message(Mongo::Constants::OP_QUERY, message, nil,
+            socket, true, nil, false, command.fetch(:compile_regex, true)).first
+        rescue ConnectionFailure => ex
+          # receive_message has already checked the socket back in
+          socket.close if socket
+          socket = nil
+          @client.unpin_pool
+          @client.refresh
+          if tries < 3 && secondary
+            tries += 1
+            retry
+          end
+          raise ex
+        ensure
+          socket.checkin if socket
+        end
+
+        reply = docs.first
+        if reply.is_a?(Hash) && (reply['cursor'] || reply['cursors'])
+          @client.pin_pool(socket.pool, read_pref)
+        end
+      end
+
+      check_command_reply(reply)
+    end
+
+    # Raises the error a command reply reports, as Cursor#next does.
+    def check_command_reply(doc)
+      if doc.is_a?(Hash) && (err = doc['errmsg'] || doc['$err']) # assignment
+        code = doc['code'] || doc['assertionCode']
+
+        # The next request will re-open on the new primary.
+        if err.include?("not master")
+          @client.close
+          raise ConnectionFailure.new(err, code, doc)
+        end
+        raise ExecutionTimeout.new(err, code, doc) if code == MAX_TIME_MS_CODE
+        raise OperationFailure.new(err, code, doc)
+      elsif doc.is_a?(Hash) && (write_concern_error = doc['writeConcernError']) # assignment
+        raise WriteConcernError.new(write_concern_error['errmsg'], write_concern_error['code'], doc)
+      end
+      doc
+    end
+
+    def command_failure(selector, ex, check_response)
+      if check_response
+        raise ex.class.new("Database command '#{selector.keys.first}' failed: #{ex.message}", ex.error_code, ex.result)
+      end
+      ex.result
+    end
+
+    def check_command_result(selector, result, check_response)
+      raise OperationFailure,
+        "Database command '#{selector.keys.first}' failed: returned null." unless result
+
+      if check_response && (!ok?(result) || result['writeErrors'] || result['writeConcernError'])
+        message = "Database command '#{selector.keys.first}' failed: ("
+        message << result.map do |key, value|
+          "#{key}: '#{value}'"
+        end.join('; ')
+        message << ').'
+        code = result['code'] || result['assertionCode']
+        if result['writeErrors']
+          code = result['writeErrors'].first['code']
+        end
+        raise ExecutionTimeout.new(message, code, result) if code == MAX_TIME_MS_CODE
+        raise OperationFailure.new(message, code, result)
+      end
+
+      result
+    end
+
     def system_command_collection
       Collection.new(SYSTEM_COMMAND_COLLECTION, self)
     end
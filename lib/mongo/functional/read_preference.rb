@@ -155,6 +155,21 @@ module Mongo
       select_near_pools(matching_pools, read_pref).first
     end
 
+    # Choose a second member for a hedged read first sent to +excluded+:
+    # another member the read preference allows, nearest first. For
+    # :secondary_preferred the primary is used only when no other matching
+    # secondary is available.
+    def select_hedge_pool(read_pref, excluded)
+      case read_pref[:mode]
+        when :secondary_preferred
+          secondaries = match_tag_sets(secondary_pools, read_pref[:tags]) - [excluded]
+          select_near_pools(secondaries, read_pref).first ||
+            (primary_pool unless primary_pool == excluded)
+        when :nearest
+          select_near_pools(match_tag_sets(pools, read_pref[:tags]) - [excluded], read_pref).first
+      end
+    end
+
     private
 
     def select_near_pools(candidates, read_pref)
@@ -55,6 +55,8 @@ module Mongo
     #   the content type will may be inferred from the filename extension if the mime-types gem can be
     #   loaded. Otherwise, the content type 'binary/octet-stream' will be used.
     # @option opts [Integer] (261120) :chunk_size size of file chunks in bytes.
+    # @option opts [String, Symbol] :compression (nil) compress the file's chunks with this codec.
+    #   See GridIO#new.
     # @option opts [String, Integer, Symbol] :w (1) Set write concern
     #
     #   Notes on write concern:
@@ -64,6 +64,8 @@ module Mongo
     # @option opts [Boolean] :delete_old (false) ensure that old versions of the file are deleted. This option
     #  only work in 'w' mode. Certain precautions must be taken when deleting GridFS files. See the notes under
     #  GridFileSystem#delete.
+    # @option opts [String, Symbol] :compression (nil) compress the file's chunks with this codec.
+    #   See GridIO#new.
     # @option opts [String, Integer, Symbol] :w (1) Set write concern
     #
     #   Notes on write concern:
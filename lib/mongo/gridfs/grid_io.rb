@@ -13,6 +13,7 @@
 # limitations under the License.
 
 require 'digest/md5'
+require 'zlib'
 
 module Mongo
 
@@ -24,9 +25,10 @@ module Mongo
     DEFAULT_CHUNK_SIZE   = 255 * 1024
     DEFAULT_CONTENT_TYPE = 'binary/octet-stream'
     PROTECTED_ATTRS      = [:files_id, :file_length, :client_md5, :server_md5]
+    COMPRESSION_CODECS   = ['zlib']
 
     attr_reader :content_type, :chunk_size, :upload_date, :files_id, :filename,
-      :metadata, :server_md5, :client_md5, :file_length, :file_position
+      :metadata, :server_md5, :client_md5, :file_length, :file_position, :compression
 
     # Create a new GridIO object. Note that most users will not need to use this class directly;
     # the Grid and GridFileSystem classes will instantiate this class
@@ -46,6 +48,12 @@ module Mongo
     # @option opts [String] :content_type ('binary/octet-stream') If no content type is specified,
     #   the content type will may be inferred from the filename extension if the mime-types gem can be
     #   loaded. Otherwise, the content type 'binary/octet-stream' will be used.
+    # @option opts [String, Symbol] :compression (nil) compress each chunk with this codec
+    #   when writing. Only 'zlib' is supported. The codec is recorded as +compression+ in the
+    #   file's metadata, and chunks are decompressed transparently when the file is read.
+    #   Every chunk but the last still holds exactly +chunk_size+ bytes of the original data,
+    #   so seeking works as for uncompressed files. The file's md5 is that of the stored,
+    #   compressed chunks.
     # @option opts [String, Integer, Symbol] :w (1) Set the write concern
     #
     #   Notes on write concern:
@@ -112,13 +120,13 @@ module Mongo
     def write(io)
       raise GridError, "file not opened for write" unless @mode[0] == ?w
       if io.is_a? String
-        if Mongo::WriteConcern.gle?(@write_concern)
+        if Mongo::WriteConcern.gle?(@write_concern) && !@compression
           @local_md5.update(io)
         end
         write_string(io)
       else
         length = 0
-        if Mongo::WriteConcern.gle?(@write_concern)
+        if Mongo::WriteConcern.gle?(@write_concern) && !@compression
           while(string = io.read(@chunk_size))
             @local_md5.update(string)
             length += write_string(string)
@@ -233,6 +241,10 @@ module Mongo
         if @current_chunk['n'].zero? && @chunk_position.zero?
           warn "Warning: Storing a file with zero length."
         end
+        # Compressed chunks are only saved once they are full.
+        if @compression && @chunk_position > 0 && @chunk_position < @chunk_size
+          save_chunk(@current_chunk)
+        end
         @upload_date = Time.now.utc
         id = @files.insert(to_mongo_object)
       end
@@ -274,15 +286,39 @@ module Mongo
     end
 
     def save_chunk(chunk)
+      if @compression
+        data = compress(chunk['data'].to_s)
+        @local_md5.update(data) if @local_md5
+        chunk = chunk.dup
+        chunk['data'] = BSON::Binary.new(data)
+      end
       @chunks.save(chunk)
     end
 
     def get_chunk(n)
       chunk = @chunks.find({'files_id' => @files_id, 'n' => n}).next_document
+      chunk['data'] = decompress(chunk['data'].to_s) if chunk && @compression
       @chunk_position = 0
       chunk
     end
 
+    def compress(data)
+      Zlib::Deflate.deflate(data)
+    end
+
+    def decompress(data)
+      Zlib::Inflate.inflate(data)
+    rescue Zlib::Error => ex
+      raise GridError, "Could not decompress chunk of file #{@files_id}: #{ex.message}"
+    end
+
+    def check_compression
+      unless COMPRESSION_CODECS.include?(@compression)
+        raise GridError, "Unsupported GridFS compression #{@compression.inspect}. " +
+          "Supported codecs are #{COMPRESSION_CODECS.join(', ')}."
+      end
+    end
+
     # Read a file in its entirety.
     def read_all
       buf = ''
@@ -392,7 +428,7 @@ module Mongo
         @current_chunk['data'] = BSON::Binary.new((@current_chunk['data'].to_s << string[-to_write, step_size]).unpack("c*"))
         @chunk_position += step_size
         to_write -= step_size
-        save_chunk(@current_chunk)
+        save_chunk(@current_chunk) unless @compression && @chunk_position < @chunk_size
       end
       string.length - to_write
     end
@@ -412,6 +448,8 @@ module Mongo
       @md5          = doc['md5']
       @filename     = doc['filename']
       @custom_attrs = doc
+      @compression  = @metadata['compression'] if @metadata.is_a?(Hash)
+      check_compression if @compression
 
       @current_chunk = get_chunk(0)
       @file_position = 0
@@ -425,7 +463,13 @@ module Mongo
       @chunk_size    = opts.delete(:chunk_size) || DEFAULT_CHUNK_SIZE
       @metadata      = opts.delete(:metadata)
       @aliases       = opts.delete(:aliases)
+      @compression   = opts.delete(:compression)
       @file_length   = 0
+      if @compression
+        @compression = @compression.to_s
+        check_compression
+        @metadata = (@metadata || {}).merge('compression' => @compression)
+      end
       opts.each {|k, v| self[k] = v}
       check_existing_file if Mongo::WriteConcern.gle?(@write_concern)
 
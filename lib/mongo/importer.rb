@@ -0,0 +1,295 @@
+# Copyright (C) 2009-2013 MongoDB, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+module Mongo
+
+  # Loads newline-delimited JSON or CSV into a collection.
+  #
+  # An import runs as a pipeline. The calling thread reads lines and hands
+  # them out in batches to +:workers+ threads, which parse each line,
+  # assign an _id as Collection#insert does and serialize the document.
+  # The serialized batches go to +:writers+ threads, each sending one
+  # unordered insert at a time on its own socket. Pre-serialized documents
+  # are spliced straight into the insert command, or into an OP_INSERT with
+  # continue-on-error for servers without write commands or with w: 0.
+  #
+  # Lines that cannot be parsed and documents the server rejects are
+  # counted as failed and the import carries on. A batch that fails with a
+  # network error is retried up to +:retries+ times. Documents from an
+  # earlier attempt that reached the server before the error then come back
+  # as duplicate key errors on their own _ids, and are counted as inserted.
+  #
+  # Each CSV record must be on a single line. Fields that look like
+  # integers or floats are stored as numbers and empty fields are left out.
+  #
+  # @example
+  #   importer = Mongo::Importer.new(client['test']['logs'], :format => :csv, :workers => 4)
+  #   File.open('logs.csv') { |io| importer.import(io) }
+  #   importer.stats # => {:read => 120000, :inserted => 119998, :failed => 2, ...}
+  class Importer
+    include Mongo::WriteConcern
+
+    FORMATS                   = [:json, :csv]
+    DEFAULT_WORKERS           = 2
+    DEFAULT_WRITERS           = 2
+    DEFAULT_RETRIES           = 3
+    DEFAULT_PROGRESS_INTERVAL = 1
+    MAX_ERRORS                = 100
+    DUPLICATE_KEY_CODES       = [11000, 11001]
+
+    attr_reader :collection, :format, :fields, :workers, :writers, :retries,
+      :batch_size, :write_concern, :errors
+
+    # @param [Collection] collection the collection to insert into.
+    #
+    # @option opts [Symbol] :format (:json) +:json+ for one JSON object per line, or +:csv+.
+    # @option opts [Array<String>] :fields the CSV field names. If not given, they are
+    #   read from the first line.
+    # @option opts [Integer] :workers (2) threads parsing and serializing documents.
+    # @option opts [Integer] :writers (2) threads, and so sockets, sending inserts.
+    # @option opts [Integer] :batch_size most documents in one insert. Defaults to the
+    #   server's maximum write batch size.
+    # @option opts [Integer] :retries (3) times to resend a batch after a network error.
+    # @option opts [#call] :progress called with #stats every +:progress_interval+
+    #   seconds during an import, and once at the end.
+    # @option opts [Numeric] :progress_interval (1) seconds between progress reports.
+    # @option opts [String, Integer, Symbol] :w, :j, :wtimeout, :fsync the write concern.
+    #   Defaults to the collection's.
+    def initialize(collection, opts={})
+      @collection        = collection
+      @db                = collection.db
+      @connection        = @db.connection
+      @format            = (opts[:format] || :json).to_sym
+      @fields            = opts[:fields]
+      @workers           = opts[:workers]    || DEFAULT_WORKERS
+      @writers           = opts[:writers]    || DEFAULT_WRITERS
+      @retries           = opts[:retries]    || DEFAULT_RETRIES
+      @batch_size        = opts[:batch_size] || @connection.max_write_batch_size
+      @progress          = opts[:progress]
+      @progress_interval = opts[:progress_interval] || DEFAULT_PROGRESS_INTERVAL
+      @write_concern     = get_write_concern(opts, collection)
+
+      unless FORMATS.include?(@format)
+        raise MongoArgumentError, "Import format must be one of #{FORMATS.inspect}"
+      end
+      if @workers < 1 || @writers < 1 || @batch_size < 1
+        raise MongoArgumentError, "Workers, writers and batch size must be at least 1."
+      end
+      @format == :csv ? require('csv') : require('json')
+
+      @mutex  = Mutex.new
+      @errors = []
+      @counts = { :read => 0, :inserted => 0, :failed => 0, :retries => 0, :batches => 0 }
+    end
+
+    # Import every line of an IO, returning once all of it has been written.
+    #
+    # @param [IO] io
+    #
+    # @return [Hash] the final #stats.
+    def import(io)
+      @started ||= Time.now
+      lines    = SizedQueue.new(@workers * 2)
+      batches  = SizedQueue.new(@writers * 2)
+      workers  = (1..@workers).map { Thread.new { parse_loop(lines, batches) } }
+      writers  = (1..@writers).map { Thread.new { write_loop(batches) } }
+      reporter = Thread.new { loop { sleep(@progress_interval); @progress.call(stats) } } if @progress
+
+      begin
+        read_loop(io, lines)
+      ensure
+        @workers.times { lines << nil }
+        workers.each { |thread| thread.join }
+        @writers.times { batches << nil }
+        writers.each { |thread| thread.join }
+        reporter.kill if reporter
+      end
+
+      @progress.call(stats) if @progress
+      stats
+    end
+
+    # @return [Hash] lines read, documents inserted and failed, batches sent
+    #   and retried, seconds elapsed and documents inserted per second, all
+    #   counted from the start of the first import.
+    def stats
+      @mutex.synchronize do
+        elapsed = @started ? Time.now - @started : 0.0
+        rate    = elapsed > 0 ? @counts[:inserted] / elapsed : 0.0
+        @counts.merge(:elapsed => elapsed, :rate => rate)
+      end
+    end
+
+    private
+
+    # Batches are queued with the CSV field names they are parsed with.
+    # Unless :fields was given, these come from the first line of each IO.
+    def read_loop(io, lines)
+      fields = @fields
+      batch  = []
+      lineno = 0
+      io.each_line do |line|
+        lineno += 1
+        next if line.strip.empty?
+        if @format == :csv && fields.nil?
+          fields = CSV.parse_line(line)
+          next
+        end
+        batch << [lineno, line]
+        if batch.size == @batch_size
+          lines << [fields, batch]
+          batch = []
+        end
+      end
+      lines << [fields, batch] unless batch.empty?
+    end
+
+    def parse_loop(lines, batches)
+      max_size = @connection.max_bson_size
+      while (item = lines.pop) # assignment
+        fields, batch = item
+        docs  = []
+        bytes = 0
+        batch.each do |lineno, line|
+          begin
+            doc  = @collection.pk_factory.create_pk(parse(line, fields))
+            bson = BSON::BSON_CODER.serialize(doc, true, true, max_size).to_s
+          rescue StandardError => ex
+            failure(1, "line #{lineno}: #{ex.message}")
+            next
+          end
+          if bytes + bson.bytesize > max_size && !docs.empty?
+            batches << docs
+            docs  = []
+            bytes = 0
+          end
+          docs << bson
+          bytes += bson.bytesize
+        end
+        increment(:read, batch.size)
+        batches << docs unless docs.empty?
+      end
+    end
+
+    def parse(line, fields)
+      if @format == :csv
+        doc = BSON::OrderedHash.new
+        CSV.parse_line(line).each_with_index do |value, i|
+          doc[fields[i] || "field#{i}"] = convert(value) unless value.nil? || value.empty?
+        end
+        doc
+      else
+        doc = JSON.parse(line, :object_class => BSON::OrderedHash)
+        raise BSON::InvalidDocument, "expected a JSON object" unless doc.is_a?(Hash)
+        doc
+      end
+    end
+
+    def convert(value)
+      case value
+      when /\A-?\d{1,18}\z/ then value.to_i
+      when /\A-?\d+\.\d+([eE][-+]?\d+)?\z/ then value.to_f
+      else value
+      end
+    end
+
+    def write_loop(batches)
+      while docs = batches.pop
+        write_batch(docs)
+      end
+    end
+
+    def write_batch(docs)
+      attempt = 0
+      begin
+        inserted, errors = @connection.use_write_command?(@write_concern) ?
+          send_write_command(docs, attempt) : send_insert(docs)
+        increment(:inserted, inserted)
+        increment(:batches)
+        failure(errors.size, *errors.first(MAX_ERRORS)) unless errors.empty?
+      rescue ConnectionFailure, OperationTimeout => ex
+        if attempt < @retries
+          attempt += 1
+          increment(:retries)
+          sleep(0.1 * attempt)
+          retry
+        end
+        failure(docs.size, ex.message)
+      rescue MongoRubyError => ex
+        failure(docs.size, ex.message)
+      ensure
+        @collection.expire_query_cache
+      end
+    end
+
+    # @return [Array] the number of documents inserted and the error
+    #   messages of those that were not.
+    def send_write_command(docs, attempt)
+      message = BSON::ByteBuffer.new("", @connection.max_bson_size + MongoClient::COMMAND_HEADROOM)
+      message.put_binary(BSON::BSON_CODER.serialize({}).to_s)
+      message.unfinish!.array!('documents')
+      docs.each { |doc| message.push_doc!(doc) }
+      message.finish!
+
+      request = BSON::OrderedHash[:insert, @collection.name, :bson, message]
+      request.merge!(:writeConcern => @write_concern, :ordered => false)
+      reply = @db.command(request)
+
+      inserted = reply['n'].to_i
+      errors   = []
+      (reply['writeErrors'] || []).each do |error|
+        if attempt > 0 && DUPLICATE_KEY_CODES.include?(error['code'])
+          inserted += 1
+        else
+          errors << error['errmsg']
+        end
+      end
+      if reply['writeConcernError']
+        failure(0, "write concern: #{reply['writeConcernError']['errmsg']}")
+      end
+      [inserted, errors]
+    end
+
+    # Legacy insert with continue-on-error. getlasterror only reports the
+    # last error, so a failed batch counts as one failure.
+    def send_insert(docs)
+      message = BSON::ByteBuffer.new("", @connection.max_message_size)
+      message.put_int(1)
+      BSON::BSON_RUBY.serialize_cstr(message, "#{@db.name}.#{@collection.name}")
+      docs.each { |doc| message.put_binary(doc) }
+
+      if Mongo::WriteConcern.gle?(@write_concern)
+        begin
+          @connection.send_message_with_gle(Mongo::Constants::OP_INSERT, message, @db.name, nil, @write_concern)
+        rescue OperationFailure => ex
+          return [docs.size - 1, [ex.message]]
+        end
+      else
+        @connection.send_message(Mongo::Constants::OP_INSERT, message)
+      end
+      [docs.size, []]
+    end
+
+    def increment(counter, n=1)
+      @mutex.synchronize { @counts[counter] += n }
+    end
+
+    def failure(count, *messages)
+      @mutex.synchronize do
+        @counts[:failed] += count
+        messages.each { |message| @errors << message if @errors.size < MAX_ERRORS }
+      end
+    end
+  end
+end
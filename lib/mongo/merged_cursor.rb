@@ -0,0 +1,141 @@
+# Copyright (C) 2009-2013 MongoDB, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+module Mongo
+
+  # Merges several cursors that are each sorted by the same sort
+  # specification into a single stream in global order, e.g. the per-shard
+  # cursors of a fanned out query or the cursors of Collection#parallel_scan
+  # after sorting.
+  #
+  # The merge is a k-way heap merge over serialized documents compared with
+  # BSON.compare, so only the documents actually handed to the caller are
+  # deserialized. Create the source cursors with the :raw option to avoid
+  # decoding altogether; documents that arrive deserialized (such as a
+  # command cursor's first batch) are serialized again before comparison.
+  # Documents that compare equal are returned in the order of the cursors
+  # they came from.
+  class MergedCursor
+    include Enumerable
+
+    attr_reader :cursors, :order
+
+    # Create a new merged cursor.
+    #
+    # @param [Array<Cursor>] cursors cursors sorted by +order+. Cursors should
+    #   not use a :transformer.
+    # @param [Array, Hash, String] order the sort specification, in any form
+    #   accepted by Cursor#sort.
+    #
+    # @option opts [Boolean] :raw (false) return serialized documents rather
+    #   than deserializing each one.
+    # @option opts [Boolean] :compile_regex (true) whether BSON regex objects
+    #   should be compiled into Ruby regexes.
+    def initialize(cursors, order, opts={})
+      @cursors = cursors
+      @order   = Support.format_order_clause(order).to_a
+      @raw     = !!opts[:raw]
+      @decode_opts = { :compile_regex => opts.key?(:compile_regex) ? opts[:compile_regex] : true }
+      @heap    = nil
+      @closed  = false
+    end
+
+    # Get the next document in global sort order.
+    #
+    # @return [Hash, String, Nil] the next document, or nil when every
+    #   cursor is exhausted.
+    def next
+      fill_heap unless @heap
+      return nil if @heap.empty?
+
+      doc, index = @heap[0]
+      if (replacement = fetch(index)) # assignment
+        @heap[0] = [replacement, index]
+      else
+        last = @heap.pop
+        @heap[0] = last unless @heap.empty?
+      end
+      sift_down(0) unless @heap.empty?
+
+      @raw ? doc : BSON::BSON_CODER.deserialize(doc, @decode_opts)
+    end
+    alias :next_document :next
+
+    # Determine whether any cursor has documents left.
+    #
+    # @return [Boolean]
+    def has_next?
+      fill_heap unless @heap
+      !@heap.empty?
+    end
+
+    # Iterate over the merged documents in order.
+    def each
+      while (doc = self.next) # assignment
+        yield doc
+      end
+    end
+
+    # Close every underlying cursor.
+    #
+    # @return [True]
+    def close
+      @cursors.each { |cursor| cursor.close }
+      @heap   = []
+      @closed = true
+    end
+
+    def closed?
+      @closed
+    end
+
+    private
+
+    # Read the first document of every cursor and heapify.
+    def fill_heap
+      @heap = []
+      @cursors.each_index do |index|
+        doc = fetch(index)
+        @heap << [doc, index] if doc
+      end
+      (@heap.size / 2 - 1).downto(0) { |i| sift_down(i) }
+    end
+
+    def fetch(index)
+      doc = @cursors[index].next
+      return doc if doc.nil? || doc.is_a?(String)
+      BSON::BSON_CODER.serialize(doc).to_s
+    end
+
+    # Entries are [document, cursor index]; ties go to the lower index.
+    def less?(a, b)
+      comparison = BSON.compare(a[0], b[0], @order)
+      comparison < 0 || (comparison == 0 && a[1] < b[1])
+    end
+
+    def sift_down(i)
+      size  = @heap.size
+      entry = @heap[i]
+      loop do
+        child = 2 * i + 1
+        break if child >= size
+        child += 1 if child + 1 < size && less?(@heap[child + 1], @heap[child])
+        break unless less?(@heap[child], entry)
+        @heap[i] = @heap[child]
+        i = child
+      end
+      @heap[i] = entry
+    end
+  end
+end
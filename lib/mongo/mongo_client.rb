@@ -26,7 +26,8 @@ module Mongo
     AGG_RETURNS_CURSORS    = 1 # The aggregation command may now be requested to return cursors.
     BATCH_COMMANDS         = 2 # insert, update, and delete batch command
     MONGODB_3_0            = 3 # listCollections and listIndexes commands, SCRAM-SHA-1 auth mechanism
-    MAX_WIRE_VERSION       = MONGODB_3_0 # supported by this client implementation
+    OP_MSG_COMMANDS        = 6 # OP_MSG with document sequences
+    MAX_WIRE_VERSION       = OP_MSG_COMMANDS # supported by this client implementation
     MIN_WIRE_VERSION       = RELEASE_2_4_AND_BEFORE # supported by this client implementation
 
     # Server command headroom
@@ -47,6 +48,7 @@ module Mongo
     TIMEOUT_OPTS         = [:timeout, :op_timeout, :connect_timeout]
     SSL_OPTS             = [:ssl, :ssl_key, :ssl_cert, :ssl_verify, :ssl_ca_cert, :ssl_key_pass_phrase]
     POOL_OPTS            = [:pool_size, :pool_timeout]
+    CURSOR_OPTS          = [:reap_cursors, :reap_interval]
     READ_PREFERENCE_OPTS = [:read, :tag_sets, :secondary_acceptable_latency_ms]
     WRITE_CONCERN_OPTS   = [:w, :j, :fsync, :wtimeout]
     CLIENT_ONLY_OPTS     = [:slave_ok]
@@ -131,6 +133,9 @@ module Mongo
     #    Set to DEFAULT_OP_TIMEOUT (20) by default. A value of nil may be specified explicitly.
     #  @option opts [Float] :connect_timeout (nil) The number of seconds to wait before timing out a
     #    connection attempt.
+    #  @option opts [Boolean] :reap_cursors (false) If true, closed and garbage collected cursors are
+    #    killed in the background by a CursorReaper, batching their ids into one OP_KILL_CURSORS per server.
+    #  @option opts [Float] :reap_interval (1) The number of seconds between cursor reaper runs.
     #
     # @example localhost, 27017 (or <code>ENV["MONGODB_URI"]</code> if available)
     #   MongoClient.new
@@ -317,6 +322,8 @@ module Mongo
 
     def unpin_pool; end
 
+    def hedged_reads; end
+
     # Drop a database.
     #
     # @param database [String] name of an existing database.
@@ -463,6 +470,8 @@ module Mongo
 
     # Close the connection to the database.
     def close
+      stop_cursor_reaper
+      close_reactors
       @primary_pool.close if @primary_pool
       @primary_pool = nil
       @primary      = nil
@@ -504,6 +513,11 @@ module Mongo
       write_concern[:w] != 0 && primary_wire_version_feature?(Mongo::MongoClient::BATCH_COMMANDS)
     end
 
+    # Whether write command batches are sent as OP_MSG.
+    def use_op_msg?
+      primary_wire_version_feature?(Mongo::MongoClient::OP_MSG_COMMANDS)
+    end
+
     # Checkout a socket for reading (i.e., a secondary node).
     # Note: this is overridden in MongoReplicaSetClient.
     def checkout_reader(read_preference)
@@ -518,6 +532,99 @@ module Mongo
       @primary_pool.checkout
     end
 
+    # The pool a Reactor should use for reads.
+    # Note: this is overridden in MongoReplicaSetClient.
+    def reader_pool(read_preference)
+      connect unless connected?
+      @primary_pool
+    end
+
+    # The pool a Reactor should use for writes.
+    # Note: this is overridden in MongoReplicaSetClient.
+    def writer_pool
+      connect unless connected?
+      @primary_pool
+    end
+
+    # The reaper killing server cursors for this client, when the client
+    # was created with the :reap_cursors option.
+    #
+    # @return [Mongo::CursorReaper, nil]
+    def cursor_reaper
+      return nil unless @reap_cursors
+      @cursor_reaper_lock.synchronize do
+        @cursor_reaper ||= CursorReaper.new(self, @reap_interval)
+      end
+    end
+
+    # Queue a garbage collected cursor on the running reaper. This runs in
+    # finalizers, so it neither locks nor starts a reaper; cursors collected
+    # while the client is closed are left to time out on the server.
+    #
+    # @param [Pool] pool the pool of the server holding the cursor.
+    # @param [Integer] cursor_id
+    def reap_cursor(pool, cursor_id)
+      reaper = @cursor_reaper
+      reaper.enqueue(pool, cursor_id) if reaper
+    end
+
+    # Stop the cursor reaper, if one was started, after it kills the
+    # cursors still queued.
+    def stop_cursor_reaper
+      reaper = @cursor_reaper_lock.synchronize do
+        stopping, @cursor_reaper = @cursor_reaper, nil
+        stopping
+      end
+      reaper.stop if reaper
+    end
+
+    # The query cache for a namespace, shared by every Collection object for
+    # it. The options of the first caller create the cache.
+    #
+    # @param [String] ns the full name of the collection.
+    # @param [Hash] opts options for QueryCache.new.
+    #
+    # @return [Mongo::QueryCache]
+    def query_cache(ns, opts={})
+      @query_cache_lock.synchronize do
+        @query_caches[ns] ||= QueryCache.new(opts)
+      end
+    end
+
+    # Empty the query cache for a namespace, if it has one. Called after
+    # every write through a Collection.
+    #
+    # @param [String] ns the full name of the collection.
+    def expire_query_cache(ns)
+      cache = @query_caches[ns]
+      cache.clear if cache
+    end
+
+    # The reactor driving asynchronous operations issued through this
+    # client by the current thread. Reactors are held by the client rather
+    # than the thread, so #close can release them; those of threads that
+    # have exited are dropped when another thread creates its reactor.
+    #
+    # @return [Mongo::Reactor]
+    def reactor
+      @reactor_lock.synchronize do
+        @reactors[Thread.current] ||= begin
+          @reactors.keys.each { |thread| @reactors.delete(thread).close unless thread.alive? }
+          Reactor.new(self)
+        end
+      end
+    end
+
+    # Close and forget every thread's reactor, failing any operations still
+    # in flight on them.
+    def close_reactors
+      reactors = @reactor_lock.synchronize do
+        closing, @reactors = @reactors.values, {}
+        closing
+      end
+      reactors.each { |reactor| reactor.close }
+    end
+
     # Check a socket back into its pool.
     # Note: this is overridden in MongoReplicaSetClient.
     def checkin(socket)
@@ -558,6 +665,7 @@ module Mongo
       GENERIC_OPTS +
       CLIENT_ONLY_OPTS +
       POOL_OPTS +
+      CURSOR_OPTS +
       READ_PREFERENCE_OPTS +
       WRITE_CONCERN_OPTS +
       TIMEOUT_OPTS +
@@ -634,6 +742,19 @@ module Mongo
       # Timeout on socket connect.
       @connect_timeout = opts.delete(:connect_timeout) || 30
 
+      # Background killing of server cursors.
+      @reap_cursors  = opts.delete(:reap_cursors)
+      @reap_interval = opts.delete(:reap_interval) || CursorReaper::DEFAULT_INTERVAL
+      @cursor_reaper_lock = Mutex.new
+
+      # Query caches of collections created with the :query_cache option.
+      @query_caches     = {}
+      @query_cache_lock = Mutex.new
+
+      # Reactors for asynchronous operations, one per thread.
+      @reactors     = {}
+      @reactor_lock = Mutex.new
+
       @logger = opts.delete(:logger)
       if @logger
         write_logging_startup_message
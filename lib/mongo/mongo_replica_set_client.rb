@@ -24,7 +24,8 @@ module Mongo
       :refresh_interval,
       :read_secondary,
       :rs_name,
-      :name
+      :name,
+      :hedged_reads
     ]
 
     attr_reader :replica_set_name,
@@ -32,7 +33,8 @@ module Mongo
                 :refresh_interval,
                 :refresh_mode,
                 :refresh_version,
-                :manager
+                :manager,
+                :hedged_reads
 
     # Create a connection to a MongoDB replica set.
     #
@@ -104,6 +106,12 @@ module Mongo
     #     or remove replica set nodes not currently in use by the driver.
     #   @option opts [Integer] :refresh_interval (90) If :refresh_mode is enabled, this is the number of seconds
     #     between calls to check the replica set's state.
+    #   @option opts [Boolean] :reap_cursors (false) If true, closed and garbage collected cursors are
+    #     killed in the background by a CursorReaper, batching their ids into one OP_KILL_CURSORS per server.
+    #   @option opts [Float] :reap_interval (1) The number of seconds between cursor reaper runs.
+    #   @option opts [Boolean, Hash] :hedged_reads (false) If set, queries read with :secondary_preferred
+    #     or :nearest that are slow to reply are also sent to a second member, and the first reply is used.
+    #     A Hash is passed to HedgedReads as options.
     #   @note the number of seed nodes does not have to be equal to the number of replica set members.
     #     The purpose of seed nodes is to permit the driver to find at least one replica set member even if a member is down.
     #
@@ -311,6 +319,8 @@ module Mongo
 
     # Close the connection to the database.
     def close(opts={})
+      stop_cursor_reaper
+      close_reactors
       if opts[:soft]
         @manager.close(:soft => true) if @manager
       else
@@ -379,6 +389,20 @@ module Mongo
       end
     end
 
+    # The pool a Reactor should use for reads.
+    def reader_pool(read_pref={})
+      ensure_manager
+      connected? ? sync_refresh : connect
+      read_pool(read_pref)
+    end
+
+    # The pool a Reactor should use for writes.
+    def writer_pool
+      ensure_manager
+      connected? ? sync_refresh : connect
+      primary_pool or raise ConnectionFailure, "No primary available for writes."
+    end
+
     # Checkin a socket used for reading.
     def checkin(socket)
       if socket && socket.pool
@@ -512,6 +536,10 @@ module Mongo
         @read_secondary = opts.delete(:read_secondary) || false
       end
 
+      # Hedged reads
+      hedged = opts.delete(:hedged_reads)
+      @hedged_reads = hedged ? HedgedReads.new(self, hedged) : nil
+
       # Replica set name
       if opts[:rs_name]
         warn ":rs_name option has been deprecated and will be removed in v2.0. " +
@@ -143,6 +143,40 @@ module Mongo
       end
     end
 
+    # Reads and writes both go to whichever mongos ShardingPoolManager#select_pool
+    # picks; read preferences are forwarded to the mongos with the query.
+    def checkout_reader(read_pref={})
+      checkout { checkout_mongos_socket }
+    end
+
+    def checkout_writer
+      checkout { checkout_mongos_socket }
+    end
+
+    def reader_pool(read_pref={})
+      writer_pool
+    end
+
+    def writer_pool
+      ensure_manager
+      connected? ? sync_refresh : connect
+      @manager.select_pool or raise ConnectionFailure, "No mongos available."
+    end
+
+    # Current view of each mongos: its address, round-trip time average in
+    # milliseconds, operations in flight and whether it has been ejected.
+    #
+    # @return [Array<Hash>]
+    def mongos_stats
+      return [] unless @manager
+      @manager.mongos_pools.map do |pool|
+        { :host       => pool.host_string,
+          :latency_ms => pool.latency,
+          :in_flight  => pool.in_flight,
+          :ejected    => @manager.ejected?(pool) }
+      end
+    end
+
     # Initialize a connection to MongoDB using the MongoDB URI spec.
     #
     # @param uri [ String ]  string of the format:
@@ -155,5 +189,35 @@ module Mongo
       uri ||= ENV['MONGODB_URI']
       URIParser.new(uri).connection(options, false, true)
     end
+
+    private
+
+    # A mongos that fails an operation with a network error or timeout is
+    # ejected from selection, as is one whose ping round-trip time becomes
+    # an outlier; see ShardingPoolManager#check_latency.
+    def socket_failed(socket, error)
+      pool = socket.pool
+      @manager.eject(pool) if pool && @manager && @manager.mongos_pools.include?(pool)
+    end
+
+    # Operation times include the time the cluster spends running the
+    # query, so mongos latency is measured by pings instead.
+    def record_latency(socket, started)
+    end
+
+    # Try mongos pools in selection order, ejecting any that fail to hand
+    # out a connection, until one succeeds.
+    def checkout_mongos_socket
+      failed = []
+      while pool = @manager.select_pool(failed)
+        begin
+          return pool.checkout
+        rescue ConnectionFailure
+          @manager.eject(pool)
+          failed << pool
+        end
+      end
+      nil
+    end
   end
 end
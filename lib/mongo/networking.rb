@@ -61,6 +61,33 @@ module Mongo
       true
     end
 
+    # Send several messages to MongoDB in a single write on one socket.
+    #
+    # @param [Array] messages pairs of a MongoDB opcode and the
+    #   BSON::ByteBuffer to send with it, in the order they should arrive.
+    #
+    # @option opts [Pool] :pool (nil) the pool to send on; the writer by default.
+    #
+    # @return [Integer] number of bytes sent
+    def send_messages(messages, opts={})
+      packed_message = messages.collect do |operation, message|
+        add_message_headers(message, operation)
+        message.to_s
+      end.join
+
+      sock = nil
+      pool = opts.fetch(:pool, nil)
+      begin
+        sock = pool ? pool.checkout : checkout_writer
+        send_message_on_socket(packed_message, sock)
+      rescue SystemStackError, NoMemoryError, SystemCallError => ex
+        close
+        raise ex
+      ensure
+        sock.checkin if sock
+      end
+    end
+
     # Sends a message to the database, waits for a response, and raises
     # an exception if the operation has failed.
     #
@@ -84,8 +111,10 @@ module Mongo
       sock = nil
       begin
         sock = checkout_writer
+        started = Time.now
         send_message_on_socket(packed_message, sock)
         docs, num_received, cursor_id = receive(sock, last_error_id)
+        record_latency(sock, started)
       rescue ConnectionFailure, OperationFailure, OperationTimeout => ex
         raise ex
       rescue SystemStackError, NoMemoryError, SystemCallError => ex
@@ -97,23 +126,7 @@ module Mongo
         sock = nil
       end
 
-      if num_received == 1
-        error = docs[0]['err'] || docs[0]['errmsg']
-        if error && error.include?("not master")
-          close
-          raise ConnectionFailure.new(docs[0]['code'].to_s + ': ' + error, docs[0]['code'], docs[0])
-        elsif (!error.nil? && note = docs[0]['jnote'] || docs[0]['wnote']) # assignment
-          code = docs[0]['code'] || Mongo::ErrorCode::BAD_VALUE # as of server version 2.5.5
-          raise WriteConcernError.new(code.to_s + ': ' + note, code, docs[0])
-        elsif error
-          code = docs[0]['code'] || Mongo::ErrorCode::UNKNOWN_ERROR
-          error = "wtimeout" if error == "timeout"
-          raise WriteConcernError.new(code.to_s + ': ' + error, code, docs[0]) if error == "wtimeout"
-          raise OperationFailure.new(code.to_s + ': ' + error, code, docs[0])
-        end
-      end
-
-      docs[0]
+      check_last_error(docs, num_received)
     end
 
     # Sends a message to the database and waits for the response.
@@ -128,22 +141,27 @@ module Mongo
     # @param [Boolean] exhaust (false) indicate whether the cursor should be exhausted. Set
     #   this to true only when the OP_QUERY_EXHAUST flag is set.
     # @param [Boolean] compile_regex whether BSON regex objects should be compiled into Ruby regexes.
+    # @param [Boolean] raw (false) return each document as a serialized BSON string instead of
+    #   deserializing it. Replies reporting a query failure are always deserialized.
     #
     # @return [Array]
     #   An array whose indexes include [0] documents returned, [1] number of document received,
-    #   and [3] a cursor_id.
+    #   [2] a cursor_id and [3] the total size in bytes of the documents received.
     def receive_message(operation, message, log_message=nil, socket=nil, command=false,
-                        read=:primary, exhaust=false, compile_regex=true)
+                        read=:primary, exhaust=false, compile_regex=true, raw=false)
       request_id     = add_message_headers(message, operation)
       packed_message = message.to_s
       opts = { :exhaust => exhaust,
-               :compile_regex => compile_regex }
+               :compile_regex => compile_regex,
+               :raw => raw }
 
       result = ''
 
       begin
+        started = Time.now
         send_message_on_socket(packed_message, socket)
         result = receive(socket, request_id, opts)
+        record_latency(socket, started) unless exhaust
       rescue ConnectionFailure => ex
         socket.close
         checkin(socket)
@@ -160,30 +178,131 @@ module Mongo
       result
     end
 
+    # Sends an OP_MSG on a socket and reads its reply. Nothing is read when
+    # the message has the moreToCome flag set.
+    #
+    # @param [OpMsg] op_msg
+    # @param [Socket] socket
+    # @param [Hash] opts options for BSON deserialization.
+    #
+    # @return [Hash, nil] the body of the reply.
+    def send_op_msg(op_msg, socket, opts={})
+      message    = op_msg.finish!
+      request_id = add_message_headers(message, Mongo::Constants::OP_MSG)
+
+      begin
+        started = Time.now
+        send_message_on_socket(message.to_s, socket)
+        return nil if op_msg.more_to_come?
+
+        header = receive_message_on_socket(STANDARD_HEADER_SIZE, socket)
+        size, _, response_to, operation = header.unpack('VVVV')
+        if response_to != request_id
+          raise ConnectionFailure, "Expected response #{request_id} but got #{response_to}"
+        end
+        if operation != Mongo::Constants::OP_MSG
+          raise ConnectionFailure, "Expected an OP_MSG reply but got opcode #{operation}"
+        end
+        body = OpMsg.parse(receive_message_on_socket(size - STANDARD_HEADER_SIZE, socket), opts)[1]
+        record_latency(socket, started)
+      rescue ConnectionFailure => ex
+        socket.close
+        raise ex
+      rescue SystemStackError, NoMemoryError, SystemCallError => ex
+        close
+        raise ex
+      end
+      body
+    end
+
+    # Writes a message to a socket without waiting for the reply, for
+    # callers that read replies later through #receive_reply. When a
+    # database name is given the message is followed by a getlasterror
+    # query, as in #send_message_with_gle, and the reply to expect is the
+    # one to that query.
+    #
+    # @param [Integer] operation a MongoDB opcode.
+    # @param [BSON::ByteBuffer] message a message to send to the database.
+    # @param [Socket] socket a checked out socket.
+    # @param [String] gle_db_name database on which to call getlasterror.
+    # @param [Hash] write_concern write concern for the getlasterror.
+    #
+    # @return [Integer] the request id the reply will respond to.
+    def dispatch_message(operation, message, socket, gle_db_name=nil, write_concern=false)
+      request_id = add_message_headers(message, operation)
+      if gle_db_name
+        last_error_message = build_get_last_error_message(gle_db_name, write_concern)
+        request_id = add_message_headers(last_error_message, Mongo::Constants::OP_QUERY)
+        message.append!(last_error_message)
+      end
+
+      begin
+        send_message_on_socket(message.to_s, socket)
+      rescue SystemStackError, NoMemoryError, SystemCallError => ex
+        close
+        raise ex
+      end
+      request_id
+    end
+
+    # Reads the reply to a message written with #dispatch_message.
+    #
+    # @return [Array] documents returned, number of documents received
+    #   and the cursor id, as for #receive_message.
+    def receive_reply(socket, request_id, opts={})
+      receive(socket, request_id, opts)
+    end
+
+    # Raises the error reported by a getlasterror reply, if any.
+    #
+    # @return [Hash] the getlasterror document.
+    def check_last_error(docs, num_received)
+      if num_received == 1
+        error = docs[0]['err'] || docs[0]['errmsg']
+        if error && error.include?("not master")
+          close
+          raise ConnectionFailure.new(docs[0]['code'].to_s + ': ' + error, docs[0]['code'], docs[0])
+        elsif (!error.nil? && note = docs[0]['jnote'] || docs[0]['wnote']) # assignment
+          code = docs[0]['code'] || Mongo::ErrorCode::BAD_VALUE # as of server version 2.5.5
+          raise WriteConcernError.new(code.to_s + ': ' + note, code, docs[0])
+        elsif error
+          code = docs[0]['code'] || Mongo::ErrorCode::UNKNOWN_ERROR
+          error = "wtimeout" if error == "timeout"
+          raise WriteConcernError.new(code.to_s + ': ' + error, code, docs[0]) if error == "wtimeout"
+          raise OperationFailure.new(code.to_s + ': ' + error, code, docs[0])
+        end
+      end
+
+      docs[0]
+    end
+
     private
 
     def receive(sock, cursor_id, opts={})
       exhaust    = !!opts.delete(:exhaust)
+      raw        = !!opts.delete(:raw)
 
       if exhaust
         docs = []
         num_received = 0
+        bytes = 0
 
         while(cursor_id != 0) do
           receive_header(sock, cursor_id, exhaust)
-          number_received, cursor_id = receive_response_header(sock)
-          new_docs, n = read_documents(number_received, sock, opts)
+          number_received, cursor_id, flags = receive_response_header(sock)
+          new_docs, n, size = read_documents(number_received, sock, opts, raw && !query_failure?(flags))
           docs += new_docs
           num_received += n
+          bytes += size
         end
 
-        return [docs, num_received, cursor_id]
+        return [docs, num_received, cursor_id, bytes]
       else
         receive_header(sock, cursor_id, exhaust)
-        number_received, cursor_id = receive_response_header(sock)
-        docs, num_received = read_documents(number_received, sock, opts)
+        number_received, cursor_id, flags = receive_response_header(sock)
+        docs, num_received, bytes = read_documents(number_received, sock, opts, raw && !query_failure?(flags))
 
-        return [docs, num_received, cursor_id]
+        return [docs, num_received, cursor_id, bytes]
       end
     end
 
@@ -215,7 +334,7 @@ module Mongo
 
       check_response_flags(flags)
       cursor_id = (cursor_id_b << 32) + cursor_id_a
-      [number_remaining, cursor_id]
+      [number_remaining, cursor_id, flags]
     end
 
     def check_response_flags(flags)
@@ -227,17 +346,23 @@ module Mongo
       end
     end
 
-    def read_documents(number_received, sock, opts)
+    def query_failure?(flags)
+      flags & Mongo::Constants::REPLY_QUERY_FAILURE != 0
+    end
+
+    def read_documents(number_received, sock, opts, raw=false)
       docs = []
+      bytes = 0
       number_remaining = number_received
       while number_remaining > 0 do
         buf = receive_message_on_socket(4, sock)
         size = buf.unpack('V')[0]
         buf << receive_message_on_socket(size - 4, sock)
+        bytes += size
         number_remaining -= 1
-        docs << BSON::BSON_CODER.deserialize(buf, opts)
+        docs << (raw ? buf : BSON::BSON_CODER.deserialize(buf, opts))
       end
-      [docs, number_received]
+      [docs, number_received, bytes]
     end
 
     def build_command_message(db_name, query, projection=nil, skip=0, limit=-1)
@@ -302,11 +427,25 @@ module Mongo
       request_id
     end
 
+    # Feed an operation's round-trip time to the socket's pool, which uses
+    # it to rank mongos routers for selection.
+    def record_latency(socket, started)
+      pool = socket.pool
+      pool.record_latency((Time.now - started) * 1000) if pool
+    end
+
+    # Called when a send or receive on a socket fails with a network error
+    # or times out.
+    # Note: this is overridden in MongoShardedClient.
+    def socket_failed(socket, error)
+    end
+
     # Low-level method for sending a message on a socket.
     # Requires a packed message and an available socket,
     #
     # @return [Integer] number of bytes sent
     def send_message_on_socket(packed_message, socket)
+      started = Time.now if Probes.enabled?(:socket_send)
       begin
       total_bytes_sent = socket.send(packed_message)
       if total_bytes_sent != packed_message.size
@@ -317,9 +456,11 @@ module Mongo
           packed_message.slice!(0, byte_sent)
         end
       end
+      Probes.fire(:socket_send, total_bytes_sent, started) if started
       total_bytes_sent
       rescue => ex
         socket.close
+        socket_failed(socket, ex)
         raise ConnectionFailure, "Operation failed with the following exception: #{ex}:#{ex.message}"
       end
     end
@@ -327,10 +468,12 @@ module Mongo
     # Low-level method for receiving data from socket.
     # Requires length and an available socket.
     def receive_message_on_socket(length, socket)
+      started = Time.now if Probes.enabled?(:socket_receive)
       begin
           message = receive_data(length, socket)
       rescue OperationTimeout, ConnectionFailure => ex
         socket.close
+        socket_failed(socket, ex)
 
         if ex.class == OperationTimeout
           raise OperationTimeout, "Timed out waiting on socket read."
@@ -338,6 +481,7 @@ module Mongo
           raise ConnectionFailure, "Operation failed with the following exception: #{ex}"
         end
       end
+      Probes.fire(:socket_receive, length, started) if started
       message
     end
 
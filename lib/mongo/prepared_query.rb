@@ -0,0 +1,275 @@
+# Copyright (C) 2009-2013 MongoDB, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+module Mongo
+
+  # A query whose OP_QUERY message is serialized once and reused.
+  #
+  # The selector is a template in which some values are placeholders made
+  # with PreparedQuery.param. Preparing serializes the whole message with a
+  # marker in each placeholder's position and records where each marker
+  # sits. Running the query copies the template and writes each parameter's
+  # BSON element over its slot. ObjectIds, 32-bit integers, floats, booleans
+  # and nil are encoded directly; other values are serialized on their own.
+  # When an element changes size, the enclosing document lengths are patched
+  # as the message is reassembled.
+  #
+  # Options are fixed when the query is prepared. The cursors returned are
+  # for iteration only: their selector still holds the placeholders, so
+  # Cursor#count and Cursor#explain are not supported.
+  #
+  # @example Look up users by _id
+  #   by_id = users.prepare('_id' => Mongo::PreparedQuery.param(:id, BSON::ObjectId))
+  #   ids.each { |id| process(by_id.find_one(:id => id)) }
+  #
+  # @see Collection#prepare
+  class PreparedQuery
+
+    # A placeholder for a value supplied when the query is run.
+    class Param
+      attr_reader :name, :type
+
+      def initialize(name, type=nil)
+        @name = name
+        @type = type
+      end
+
+      def inspect
+        "#<Mongo::PreparedQuery::Param #{@name.inspect}>"
+      end
+      alias :to_s :inspect
+    end
+
+    # A position in the template where a parameter is written.
+    Slot = Struct.new(:param, :start, :size, :key, :docs)
+
+    # Create a placeholder for a selector template.
+    #
+    # @param [Symbol, String] name the key of the value in the params hash.
+    # @param [Class] type (nil) if given, values must be instances of this class.
+    #
+    # @return [Param]
+    def self.param(name, type=nil)
+      Param.new(name, type)
+    end
+
+    attr_reader :collection, :selector, :opts
+
+    # @param [Collection] collection
+    # @param [Hash] selector a selector template containing Param placeholders.
+    # @param [Hash] opts any options accepted by Collection#find.
+    def initialize(collection, selector, opts={})
+      @collection = collection
+      @selector   = selector
+      @opts       = opts.dup
+      @markers    = {}
+
+      marked = mark(selector)
+      @collection.find(marked, @opts) do |cursor|
+        @template = cursor.send(:construct_query_message).to_s
+      end
+      @slots = find_slots
+      if @slots.size != @markers.size
+        raise MongoArgumentError, "Could not find every placeholder in the serialized selector"
+      end
+    end
+
+    # Names of the parameters this query expects.
+    #
+    # @return [Array]
+    def params
+      @slots.map { |slot| slot.param.name }.uniq
+    end
+
+    # Run the query with the given parameter values.
+    #
+    # @param [Hash] params a value for each placeholder, keyed by name.
+    #
+    # @return [Cursor, nil] a cursor, or nil if a block is given; as for
+    #   Collection#find, the cursor is yielded and then closed.
+    def find(params={})
+      message = bind(params)
+      if block_given?
+        @collection.find(@selector, @opts) { |cursor| yield cursor.use_query_message(message) }
+      else
+        @collection.find(@selector, @opts).use_query_message(message)
+      end
+    end
+
+    # Run the query and return the first matching document.
+    #
+    # @param [Hash] params a value for each placeholder, keyed by name.
+    #
+    # @return [OrderedHash, nil]
+    def find_one(params={})
+      @find_one ||= PreparedQuery.new(@collection, @selector, @opts.merge(:limit => -1))
+      @find_one.find(params).next_document
+    end
+
+    # The query message with the given parameters bound, without the
+    # standard message header.
+    #
+    # @param [Hash] params
+    #
+    # @return [String]
+    def bind(params)
+      elements = @slots.map { |slot| element(slot, fetch(params, slot.param)) }
+
+      if (0...@slots.size).all? { |i| elements[i].bytesize == @slots[i].size }
+        message = @template.dup
+        @slots.each_with_index { |slot, i| message[slot.start, slot.size] = elements[i] }
+        return message
+      end
+
+      relayout(elements)
+    end
+
+    private
+
+    # Replace each placeholder with a string unique to this query.
+    def mark(value)
+      case value
+      when Param
+        marker = "\x00mongo-param-#{object_id}-#{@markers.size}"
+        marker.force_encoding('binary') if marker.respond_to?(:force_encoding)
+        @markers[marker] = value
+        marker
+      when Hash
+        value.inject(value.class.new) do |hash, (k, v)|
+          raise MongoArgumentError, "Placeholders may only appear in the values of the selector" if k.is_a?(Param)
+          hash[k] = mark(v)
+          hash
+        end
+      when Array
+        value.map { |v| mark(v) }
+      else
+        value
+      end
+    end
+
+    # Walk the serialized selector and record the slot of every marker.
+    def find_slots
+      ns_end = @template.index("\x00", 4)
+      slots  = []
+      walk(ns_end + 9, [], slots)
+      slots
+    end
+
+    def walk(doc_start, docs, slots)
+      docs = docs + [doc_start]
+      pos  = doc_start + 4
+      while (type = byte(pos)) != 0
+        key_end = @template.index("\x00", pos + 1)
+        value   = key_end + 1
+        size    = value_size(type, value)
+        if type == 0x02 && (param = @markers[@template[value + 4, size - 5]]) # assignment
+          slots << Slot.new(param, pos, value + size - pos, @template[pos + 1...key_end], docs)
+        elsif type == 0x03 || type == 0x04
+          walk(value, docs, slots)
+        end
+        pos = value + size
+      end
+    end
+
+    def value_size(type, value)
+      case type
+      when 0x01, 0x09, 0x11, 0x12 then 8
+      when 0x02, 0x0D, 0x0E then 4 + int(value)
+      when 0x03, 0x04, 0x0F then int(value)
+      when 0x05 then 5 + int(value)
+      when 0x06, 0x0A, 0x7F, 0xFF then 0
+      when 0x07 then 12
+      when 0x08 then 1
+      when 0x0B then @template.index("\x00", @template.index("\x00", value) + 1) + 1 - value
+      when 0x0C then 16 + int(value)
+      when 0x10 then 4
+      else raise BSON::InvalidDocument, "Unknown BSON type #{type} in prepared query"
+      end
+    end
+
+    def byte(pos)
+      @template.unpack("@#{pos}C")[0]
+    end
+
+    def int(pos)
+      @template.unpack("@#{pos}V")[0]
+    end
+
+    def fetch(params, param)
+      value = params.fetch(param.name) do
+        params.fetch(param.name.to_s) do
+          raise MongoArgumentError, "Missing value for parameter #{param.name.inspect}"
+        end
+      end
+      if param.type && !value.is_a?(param.type)
+        raise MongoArgumentError, "Parameter #{param.name.inspect} must be a #{param.type}"
+      end
+      value
+    end
+
+    # Encode a single BSON element, with fixed-width types written directly.
+    def element(slot, value)
+      case value
+      when BSON::ObjectId
+        [0x07, slot.key].pack("Ca*x") << value.to_a.pack("C12")
+      when Integer
+        if value >= -2**31 && value < 2**31
+          [0x10, slot.key, value].pack("Ca*xV")
+        else
+          serialize_element(slot.key, value)
+        end
+      when Float
+        [0x01, slot.key, value].pack("Ca*xE")
+      when true, false
+        [0x08, slot.key, value ? 1 : 0].pack("Ca*xC")
+      when nil
+        [0x0A, slot.key].pack("Ca*x")
+      else
+        serialize_element(slot.key, value)
+      end
+    end
+
+    def serialize_element(key, value)
+      key = key.dup.force_encoding('utf-8') if key.respond_to?(:force_encoding)
+      bson = BSON::BSON_CODER.serialize({ key => value }, false, false, @collection.db.connection.max_bson_size).to_s
+      bson[4, bson.bytesize - 5]
+    end
+
+    # Reassemble the message when elements change size, growing or
+    # shrinking each document that encloses a slot.
+    def relayout(elements)
+      message = ''
+      message.force_encoding('binary') if message.respond_to?(:force_encoding)
+      deltas  = []
+      pos     = 0
+      @slots.each_with_index do |slot, i|
+        message << @template[pos...slot.start] << elements[i]
+        deltas << elements[i].bytesize - slot.size
+        pos = slot.start + slot.size
+      end
+      message << @template[pos..-1]
+
+      @slots.map { |slot| slot.docs }.flatten.uniq.each do |doc|
+        growth = 0
+        shift  = 0
+        @slots.each_with_index do |slot, i|
+          growth += deltas[i] if slot.docs.include?(doc)
+          shift  += deltas[i] if slot.start < doc
+        end
+        message[doc + shift, 4] = [int(doc) + growth].pack("V")
+      end
+      message
+    end
+  end
+end
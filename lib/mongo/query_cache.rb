@@ -0,0 +1,155 @@
+# Copyright (C) 2009-2013 MongoDB, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+module Mongo
+
+  # Replies to queries on one collection, kept on the client so identical
+  # queries can be answered without a round trip.
+  #
+  # A query is keyed by its serialized OP_QUERY message, which holds the
+  # selector, projection, sort, skip, limit and query flags, together with
+  # its read preference. Finds store frozen copies of the serialized
+  # documents of replies that complete in one batch, which are decoded, or
+  # copied for raw cursors, afresh on every hit so callers never share a
+  # document. Counts store their result.
+  #
+  # Entries expire after :ttl seconds, and the least recently used are
+  # evicted once keys and replies take more than :max_bytes. Any write to
+  # the collection through the same client empties the cache. A reply read
+  # while a write was in progress is not stored, since the cache's
+  # generation will have moved on by the time it arrives.
+  #
+  # An unacknowledged (:w => 0) write is over, as far as the client knows,
+  # once it has been sent, though the server may apply it later. A find
+  # sent in between can read and store the collection as it was before the
+  # write, and that reply is served until it expires. Collections written
+  # that way should be cached with a :ttl they can tolerate being stale for.
+  #
+  # @example
+  #   countries = db.collection('countries', :query_cache => {:ttl => 300})
+  #   countries.find_one('code' => 'FR')   # read from the server
+  #   countries.find_one('code' => 'FR')   # read from the cache
+  #   countries.query_cache.stats[:hit_rate] # => 0.5
+  #
+  # @see Collection#query_cache
+  class QueryCache
+    DEFAULT_TTL       = 60
+    DEFAULT_MAX_BYTES = 16 * 1024 * 1024
+
+    # Counted for each entry on top of its key and reply.
+    ENTRY_OVERHEAD = 64
+
+    Entry = Struct.new(:value, :size, :expires)
+
+    attr_reader :ttl, :max_bytes, :generation
+
+    # @option opts [Numeric] :ttl (60) seconds an entry is served for.
+    # @option opts [Integer] :max_bytes (16MB) bound on the size of the keys
+    #   and replies held.
+    def initialize(opts={})
+      @ttl        = opts[:ttl] || DEFAULT_TTL
+      @max_bytes  = opts[:max_bytes] || DEFAULT_MAX_BYTES
+      @entries    = BSON::OrderedHash.new
+      @bytes      = 0
+      @generation = 0
+      @hits = @misses = @evictions = 0
+      @lock = Mutex.new
+    end
+
+    # Build the key for a query.
+    #
+    # @param [String] message the OP_QUERY message without its header, or
+    #   a serialized command.
+    # @param [Hash] read_preference the query's read preference.
+    #
+    # @return [String]
+    def self.key(message, read_preference)
+      BSON::BSON_CODER.serialize(read_preference).to_s << message
+    end
+
+    # Look up a reply. A hit makes the entry the most recently used.
+    #
+    # @return [Object, nil] the stored reply, or nil on a miss.
+    def fetch(key)
+      @lock.synchronize do
+        entry = @entries.delete(key)
+        if entry && entry.expires <= Time.now
+          @bytes -= entry.size
+          entry = nil
+        end
+        if entry
+          @entries[key] = entry
+          @hits += 1
+          entry.value
+        else
+          @misses += 1
+          nil
+        end
+      end
+    end
+
+    # Store a reply, unless the cache has been emptied since +generation+
+    # or the reply alone would not fit.
+    #
+    # @param [String] key
+    # @param [Object] value
+    # @param [Integer] size the size of the value in bytes.
+    # @param [Integer] generation the #generation read before the query was sent.
+    def store(key, value, size, generation)
+      size += key.size + ENTRY_OVERHEAD
+      return if size > @max_bytes
+      @lock.synchronize do
+        return unless generation == @generation
+        if (old = @entries.delete(key)) # assignment
+          @bytes -= old.size
+        end
+        @entries[key] = Entry.new(value, size, Time.now + @ttl)
+        @bytes += size
+        while @bytes > @max_bytes
+          oldest = @entries.first[0]
+          @bytes -= @entries.delete(oldest).size
+          @evictions += 1
+        end
+      end
+    end
+
+    # Drop every entry, and any reply still being read.
+    def clear
+      @lock.synchronize do
+        @entries.clear
+        @bytes = 0
+        @generation += 1
+      end
+    end
+
+    # @return [Hash] :hits, :misses, :hit_rate, :evictions, :entries and
+    #   :bytes.
+    def stats
+      @lock.synchronize do
+        lookups = @hits + @misses
+        { :hits      => @hits,
+          :misses    => @misses,
+          :hit_rate  => lookups.zero? ? 0.0 : @hits.to_f / lookups,
+          :evictions => @evictions,
+          :entries   => @entries.size,
+          :bytes     => @bytes }
+      end
+    end
+
+    def inspect
+      "#<Mongo::QueryCache:0x#{self.object_id.to_s(16)} @entries=#{@entries.size} " +
+        "@bytes=#{@bytes} @generation=#{@generation}>"
+    end
+  end
+end
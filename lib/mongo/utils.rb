@@ -12,8 +12,11 @@
 # See the License for the specific language governing permissions and
 # limitations under the License.
 
+require 'mongo/utils/batch_sizer'
 require 'mongo/utils/conversions'
 require 'mongo/utils/core_ext'
+require 'mongo/utils/document_diff'
+require 'mongo/utils/probes'
 require 'mongo/utils/server_version'
 require 'mongo/utils/support'
 require 'mongo/utils/thread_local_variable_manager'
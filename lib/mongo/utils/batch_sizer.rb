@@ -0,0 +1,97 @@
+# Copyright (C) 2009-2013 MongoDB, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+module Mongo
+
+  # Chooses the number of documents a cursor asks for in each getMore,
+  # aiming for a target number of bytes per round trip without letting a
+  # single reply take longer than a latency budget.
+  #
+  # Average document size and time per document are smoothed over the
+  # replies seen so far. The next batch is the smaller of the sizes those
+  # two targets imply, and never more than twice the previous reply so a
+  # single fast, small reply cannot trigger a huge request.
+  class BatchSizer
+    DEFAULT_TARGET_BYTES = 1024 * 1024
+    DEFAULT_LATENCY_MS   = 100
+    SMOOTHING            = 0.3
+    MAX_GROWTH           = 2
+
+    # A numberToReturn of 1 is treated by the server as -1 and closes the
+    # cursor, so batches never go below two documents.
+    MIN_BATCH_SIZE       = 2
+
+    attr_reader :target_bytes, :latency_ms, :batch_sizes
+
+    # @option opts [Integer] :target_bytes (1MB) bytes to aim for per reply.
+    # @option opts [Integer, nil] :latency_ms (100) longest a reply should
+    #   take; nil disables the latency budget.
+    # @option opts [Integer] :max_batch_size (nil) upper bound on the number
+    #   of documents requested.
+    def initialize(opts={})
+      @target_bytes   = opts[:target_bytes] || DEFAULT_TARGET_BYTES
+      @latency_ms     = opts.key?(:latency_ms) ? opts[:latency_ms] : DEFAULT_LATENCY_MS
+      @max_batch_size = opts[:max_batch_size]
+      @doc_bytes      = nil
+      @ms_per_doc     = nil
+      @last_received  = nil
+      @batch_sizes    = []
+    end
+
+    # Record an OP_REPLY.
+    #
+    # @param [Integer] n_received documents in the reply.
+    # @param [Integer] bytes total size of those documents.
+    # @param [Float] elapsed_ms time from sending the request to reading the reply.
+    def record(n_received, bytes, elapsed_ms)
+      return if n_received.zero?
+      @doc_bytes     = smooth(@doc_bytes, bytes.to_f / n_received)
+      @ms_per_doc    = smooth(@ms_per_doc, elapsed_ms.to_f / n_received)
+      @last_received = n_received
+    end
+
+    # The number of documents to ask for next, or 0 to let the server choose
+    # until a reply has been measured.
+    #
+    # @return [Integer]
+    def next_batch_size
+      return 0 unless @doc_bytes
+
+      size = @target_bytes / @doc_bytes
+      size = [size, @latency_ms / @ms_per_doc].min if @latency_ms && @ms_per_doc > 0
+      size = [size, @last_received * MAX_GROWTH].min
+      size = [size, @max_batch_size].min if @max_batch_size
+      size = [size.floor, MIN_BATCH_SIZE].max
+
+      @batch_sizes << size
+      size
+    end
+
+    # @return [Hash] the targets, current estimates and every batch size
+    #   chosen so far.
+    def stats
+      { :target_bytes  => @target_bytes,
+        :latency_ms    => @latency_ms,
+        :avg_doc_bytes => @doc_bytes && @doc_bytes.round,
+        :ms_per_doc    => @ms_per_doc,
+        :batch_sizes   => @batch_sizes.dup }
+    end
+
+    private
+
+    def smooth(average, sample)
+      average ? average + SMOOTHING * (sample - average) : sample
+    end
+  end
+end
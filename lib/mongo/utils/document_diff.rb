@@ -0,0 +1,139 @@
+# Copyright (C) 2009-2013 MongoDB, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+module Mongo
+
+  # Computes the update that turns one serialized document into another,
+  # for Collection#save_changes.
+  #
+  # The two documents are compared element by element on their bytes, so no
+  # value is decoded. An element found only in the new document, or whose
+  # bytes differ, goes into $set under its dotted path; one found only in
+  # the old document goes into $unset. Embedded documents present on both
+  # sides are compared field by field, while arrays and other values are
+  # set whole. The update is built as BSON, with the new elements' bytes
+  # copied into it unchanged.
+  module DocumentDiff
+    # Fraction of the document's size above which Collection#save_changes
+    # sends the whole document instead of an update.
+    DEFAULT_THRESHOLD = 0.5
+
+    EMBEDDED_DOCUMENT = 0x03
+
+    # Value sizes of the types whose values have a fixed length.
+    FIXED_SIZES = {
+      0x01 => 8,  # double
+      0x06 => 0,  # undefined
+      0x07 => 12, # ObjectId
+      0x08 => 1,  # boolean
+      0x09 => 8,  # UTC datetime
+      0x0A => 0,  # null
+      0x10 => 4,  # int32
+      0x11 => 8,  # timestamp
+      0x12 => 8,  # int64
+      0x13 => 16, # decimal128
+      0x7F => 0,  # max key
+      0xFF => 0   # min key
+    }
+
+    # @param [String] original the document as it was read.
+    # @param [String] current the document as it is now.
+    #
+    # @return [String, nil, false] the serialized update, nil if the
+    #   documents are the same, or false if their _ids differ, since an
+    #   update cannot change the _id.
+    #
+    # @raise [BSON::InvalidDocument] if either document is malformed.
+    def self.update(original, current)
+      before = elements(original)
+      after  = elements(current)
+      return false if before['_id'] != after['_id']
+
+      set   = String.new
+      unset = String.new
+      diff(before, after, '', set, unset)
+      return nil if set.empty? && unset.empty?
+
+      body = String.new
+      body << "\x03$set\0" << document(set) unless set.empty?
+      body << "\x03$unset\0" << document(unset) unless unset.empty?
+      document(body)
+    end
+
+    # Split a serialized document into its elements.
+    #
+    # @return [Hash] the type and value bytes of each element, by name.
+    def self.elements(data)
+      elements = {}
+      pos  = 4
+      last = data.size - 1
+      while pos < last
+        type     = data[pos, 1].unpack('C')[0]
+        name_end = data.index("\0", pos + 1)
+        raise BSON::InvalidDocument, "Malformed document" unless name_end
+        name  = data[pos + 1...name_end]
+        start = name_end + 1
+        pos   = start + value_size(data, type, start)
+        elements[name] = [type, data[start...pos]]
+      end
+      raise BSON::InvalidDocument, "Malformed document" if pos != last
+      elements
+    end
+
+    def self.diff(old, new, prefix, set, unset)
+      new.each do |name, element|
+        was = old.delete(name)
+        next if was == element
+        if was && was[0] == EMBEDDED_DOCUMENT && element[0] == EMBEDDED_DOCUMENT
+          diff(elements(was[1]), elements(element[1]), "#{prefix}#{name}.", set, unset)
+        else
+          set << element[0].chr << prefix << name << "\0" << element[1]
+        end
+      end
+      old.each_key do |name|
+        unset << "\x10" << prefix << name << "\0" << [1].pack('V')
+      end
+    end
+    private_class_method :diff
+
+    def self.value_size(data, type, pos)
+      return FIXED_SIZES[type] if FIXED_SIZES.key?(type)
+      case type
+      when 0x02, 0x0D, 0x0E # string, code, symbol
+        4 + int32(data, pos)
+      when 0x03, 0x04, 0x0F # document, array, code with scope
+        int32(data, pos)
+      when 0x05             # binary
+        5 + int32(data, pos)
+      when 0x0B             # regex: pattern and options as cstrings
+        data.index("\0", data.index("\0", pos) + 1) + 1 - pos
+      when 0x0C             # DBPointer
+        4 + int32(data, pos) + 12
+      else
+        raise BSON::InvalidDocument, "Unknown BSON type #{type}"
+      end
+    end
+    private_class_method :value_size
+
+    def self.int32(data, pos)
+      data[pos, 4].unpack('V')[0]
+    end
+    private_class_method :int32
+
+    def self.document(body)
+      [body.size + 5].pack('V') << body << "\0"
+    end
+    private_class_method :document
+  end
+end
@@ -0,0 +1,47 @@
+# Copyright (C) 2009-2013 MongoDB, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+module Mongo
+
+  # Fires the driver's static tracepoints, which live in the bson_ext C
+  # extension as USDT probes of the "bson" provider:
+  #
+  #   socket__send(bytes, ns), socket__receive(bytes, ns) and
+  #   pool__checkout(sockets in use, ns)
+  #
+  # Callers only time an operation when #enabled? says a tracer is attached,
+  # so the probes cost one method call each when nobody is listening.
+  # Without bson_ext, or where it was built without sys/sdt.h, they are
+  # never enabled.
+  #
+  # @example
+  #   bpftrace -e 'usdt:/path/to/cbson.so:bson:socket__receive { @ns = hist(arg1); }' -p PID
+  module Probes
+    if defined?(CBson) && CBson.respond_to?(:fire_probe)
+      def self.enabled?(name)
+        CBson.probe_enabled?(name)
+      end
+
+      def self.fire(name, value, started)
+        CBson.fire_probe(name, value, ((Time.now - started) * 1_000_000_000).to_i)
+      end
+    else
+      def self.enabled?(name)
+        false
+      end
+
+      def self.fire(name, value, started); end
+    end
+  end
+end
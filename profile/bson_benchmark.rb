@@ -0,0 +1,48 @@
+require 'bson'
+require 'benchmark'
+
+# Serialization and deserialization throughput of the loaded BSON coder.
+# Run with BSON_EXT_DISABLED=1 to measure the pure Ruby coder.
+
+ITERATIONS = (ENV['ITERATIONS'] || 100_000).to_i
+
+flat = { '_id' => BSON::ObjectId.new, 'name' => 'user', 'index' => 1, 'score' => 1.5, 'active' => true }
+
+ordered = BSON::OrderedHash.new
+flat.each { |key, value| ordered[key] = value }
+
+nested = {
+  '_id'     => BSON::ObjectId.new,
+  'name'    => 'user',
+  'address' => { 'street' => '1 Main St', 'city' => 'Springfield', 'zip' => '12345' },
+  'tags'    => %w(a b c d e),
+  'scores'  => (1..10).to_a,
+  'created' => Time.now.utc
+}
+
+puts "Coder: #{BSON::BSON_CODER}, #{ITERATIONS} iterations"
+Benchmark.bm(32) do |bm|
+  [['Hash', flat], ['OrderedHash', ordered], ['nested Hash', nested]].each do |name, doc|
+    bm.report("serialize #{name}") do
+      ITERATIONS.times { BSON::BSON_CODER.serialize(doc, false, false) }
+    end
+    bm.report("serialize #{name} (move_id)") do
+      ITERATIONS.times { BSON::BSON_CODER.serialize(doc, true, true) }
+    end
+    bson = BSON::BSON_CODER.serialize(doc).to_s
+    bm.report("deserialize #{name}") do
+      ITERATIONS.times { BSON::BSON_CODER.deserialize(bson) }
+    end
+  end
+
+  # Read three fields of a batch of documents, as a reporting job would.
+  docs  = (0...ITERATIONS).map { |i| BSON::BSON_CODER.serialize(nested.merge('value' => i * 0.5)).to_s }
+  batch = docs.join
+  paths = ['created', 'value', 'address.city']
+  bm.report("deserialize batch, 3 fields") do
+    docs.each { |doc| d = BSON::BSON_CODER.deserialize(doc); [d['created'], d['value'], d['address']['city']] }
+  end
+  bm.report("decode_columns batch, 3 fields") do
+    BSON.decode_columns(batch, docs.size, paths)
+  end
+end
@@ -289,6 +289,41 @@ class BSONTest < Test::Unit::TestCase
     assert_doc_pass(doc)
   end
 
+  def test_raw_document
+    inner = BSON::OrderedHash['b', 1, 'c', [1, 'x']]
+    raw = RawDocument.new(@encoder.serialize(inner))
+    assert_equal 1, raw['b']
+    assert_equal ['b', 'c'], raw.keys
+    assert_equal @encoder.serialize(inner).to_s, @encoder.serialize(raw).to_s
+
+    doc = BSON::OrderedHash['a', raw, 'list', [raw, {'d' => 2}]]
+    expected = BSON::OrderedHash['a', inner, 'list', [inner, {'d' => 2}]]
+    assert_equal @encoder.serialize(expected).to_s, @encoder.serialize(doc).to_s
+    assert_equal expected, @encoder.deserialize(@encoder.serialize(doc))
+  end
+
+  def test_raw_document_is_not_checked
+    raw = RawDocument.new(@encoder.serialize({'$set' => {'a.b' => 1}}))
+    assert_equal raw.to_s, @encoder.serialize(raw, true).to_s
+    assert_equal raw.to_s, @encoder.serialize({'u' => raw}, true).to_s[7..-2]
+  end
+
+  def test_invalid_raw_document
+    assert_raise InvalidDocument do
+      RawDocument.new("\x05\x00\x00\x00")
+    end
+    assert_raise InvalidDocument do
+      RawDocument.new(@encoder.serialize({'a' => 1}).to_s + "\x00")
+    end
+  end
+
+  def test_raw_document_max_size
+    raw = RawDocument.new(@encoder.serialize({'a' => 'x' * 100}))
+    assert_raise InvalidDocument do
+      @encoder.serialize(raw, false, false, 100)
+    end
+  end
+
   def test_double
     doc = {'doc' => 41.25}
     assert_doc_pass(doc)
@@ -497,6 +532,29 @@ class BSONTest < Test::Unit::TestCase
     end
   end
 
+  def test_mixed_id_keys
+    doc = BSON::OrderedHash.new
+    doc['a'] = 1
+    doc['_id'] = 'string'
+    doc[:_id] = 'symbol'
+    assert_equal [['a', 1], ['_id', 'symbol']], @encoder.deserialize(@encoder.serialize(doc.dup)).to_a
+    assert_equal [['_id', 'string'], ['a', 1]], @encoder.deserialize(@encoder.serialize(doc.dup, false, true)).to_a
+  end
+
+  def test_collect_dbrefs
+    return if RUBY_PLATFORM =~ /java/ && BSON.extension?
+    a, b, c = DBRef.new('a', ObjectId.new), DBRef.new('b', ObjectId.new), DBRef.new('c', ObjectId.new)
+    bson = @encoder.serialize('one' => a, 'list' => [1, b], 'nested' => {'ref' => c, 'n' => 1})
+    dbrefs = []
+    doc = @encoder.deserialize(bson, :dbrefs => dbrefs)
+
+    assert_equal 3, dbrefs.size
+    assert_equal [['one', 'a'], [1, 'b'], ['ref', 'c']],
+      dbrefs.map { |container, key, dbref| [key, dbref.namespace] }.sort_by { |key, ns| ns }
+    dbrefs.each { |container, key, dbref| container[key] = dbref.namespace }
+    assert_equal({'one' => 'a', 'list' => [1, 'b'], 'nested' => {'ref' => 'c', 'n' => 1}}, doc)
+  end
+
   def test_symbol
     doc = {'sym' => :foo}
     bson = @encoder.serialize(doc)
@@ -0,0 +1,136 @@
+# Copyright (C) 2009-2013 MongoDB, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+require 'test_helper'
+
+class ColumnTest < Test::Unit::TestCase
+  include BSON
+
+  def batch(*docs)
+    docs.map { |doc| BSON_CODER.serialize(doc).to_s }.join
+  end
+
+  # Decode with the loaded coder, checking the pure Ruby decoder agrees.
+  def decode(docs, paths)
+    bytes = batch(*docs)
+    columns = BSON.decode_columns(bytes, docs.size, paths)
+    ruby = Column.decode(bytes, docs.size, paths)
+    paths.each do |path|
+      assert_equal ruby[path].type, columns[path].type
+      assert_equal ruby[path].nulls, columns[path].nulls
+      assert_equal ruby[path].data, columns[path].data
+    end
+    columns
+  end
+
+  def test_integers_are_packed_as_int64
+    column = decode([{'n' => 1}, {'n' => 2**40}, {'n' => -3}], ['n'])['n']
+    assert_equal :int64, column.type
+    assert column.packed?
+    assert_equal 24, column.data.length
+    assert_equal [1, 2**40, -3], column.to_a
+  end
+
+  def test_integers_and_doubles_are_packed_as_double
+    column = decode([{'n' => 1}, {'n' => 2.5}, {'n' => 2**40}], ['n'])['n']
+    assert_equal :double, column.type
+    assert_equal [1.0, 2.5, 2.0**40], column.data.unpack("E*")
+  end
+
+  def test_dates_are_packed_as_milliseconds
+    times = [Time.at(1376000000, 123000).utc, Time.at(-1, 500000).utc]
+    column = decode(times.map { |t| {'t' => t} }, ['t'])['t']
+    assert_equal :time, column.type
+    assert_equal times, column.to_a
+    assert_equal 1376000000123, column.data.unpack("VV").each_with_index.inject(0) { |n, (v, i)| n | (v << (32 * i)) }
+  end
+
+  def test_nulls_and_missing_fields
+    column = decode([{'n' => 1}, {'n' => nil}, {}, {'n' => 4}], ['n'])['n']
+    assert_equal :int64, column.type
+    assert_equal [false, true, true, false], (0...4).map { |row| column.null?(row) }
+    assert_equal 2, column.null_count
+    assert_equal [1, nil, nil, 4], column.to_a
+    assert_equal 0, column.data.unpack("@8V")[0]
+  end
+
+  def test_strings_are_arrays
+    column = decode([{'host' => 'a'}, {}, {'host' => 'b'}], ['host'])['host']
+    assert_equal :object, column.type
+    assert !column.packed?
+    assert_equal ['a', nil, 'b'], column.data
+    assert column.null?(1)
+  end
+
+  def test_mixed_types_become_objects
+    columns = decode([{'a' => 1, 'b' => Time.at(5).utc}, {'a' => 2.5, 'b' => 7}, {'a' => 'x', 'b' => nil}], ['a', 'b'])
+    assert_equal [1, 2.5, 'x'], columns['a'].to_a
+    assert_kind_of Integer, columns['a'][0]
+    assert_equal [Time.at(5).utc, 7, nil], columns['b'].to_a
+  end
+
+  def test_all_null_column
+    column = decode([{}, {'n' => nil}], ['n'])['n']
+    assert_equal :object, column.type
+    assert_equal [nil, nil], column.to_a
+  end
+
+  def test_dotted_paths
+    docs = [{'m' => {'v' => 1, 'tags' => ['x', 'y']}}, {'m' => {'v' => 2}}, {'m' => 3}]
+    columns = decode(docs, ['m.v', 'm.tags.1'])
+    assert_equal [1, 2, nil], columns['m.v'].to_a
+    assert_equal ['y', nil, nil], columns['m.tags.1'].to_a
+  end
+
+  def test_other_types_are_decoded
+    id = ObjectId.new
+    column = decode([{'x' => id}, {'x' => {'a' => 1}}, {'x' => [1, 2]}, {'x' => true}], ['x'])['x']
+    assert_equal [id, {'a' => 1}, [1, 2], true], column.to_a
+  end
+
+  def test_symbol_paths
+    assert_equal [1], BSON.decode_columns(batch('n' => 1), 1, [:n])['n'].to_a
+  end
+
+  def test_empty_batch
+    column = BSON.decode_columns('', 0, ['n'])['n']
+    assert_equal 0, column.size
+    assert_equal [], column.to_a
+  end
+
+  def test_malformed_batches
+    bytes = batch({'n' => 1}, {'n' => 2})
+    assert_raise InvalidDocument do
+      BSON.decode_columns(bytes, 3, ['n'])
+    end
+    assert_raise InvalidDocument do
+      BSON.decode_columns(bytes, 1, ['n'])
+    end
+    assert_raise InvalidDocument do
+      BSON.decode_columns(bytes[0...-1], 2, ['n'])
+    end
+  end
+
+  def test_malformed_values
+    nested = batch('m' => {'s' => 'abc'})
+    string = nested.index("abc") - 4
+    [[string, 100], [string, 0], [nested.index("s\x00") - 1, 0x7F]].each do |pos, byte|
+      bytes = nested.dup
+      bytes.setbyte(pos, byte)
+      assert_raise InvalidDocument do
+        BSON.decode_columns(bytes, 1, ['m']).values.each(&:to_a)
+      end
+    end
+  end
+end
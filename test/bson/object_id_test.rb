@@ -173,4 +173,68 @@ class ObjectIdTest < Test::Unit::TestCase
     id = ObjectId.new
     assert_equal [ id ], [[ id ]].flatten!
   end
+
+  def test_generate_many
+    ids = ObjectId.generate_many(1000)
+    assert_equal 1000, ids.size
+    assert ids.all? { |id| id.is_a?(ObjectId) }
+    assert_equal 1000, ids.uniq.size
+    assert_in_delta Time.now.to_i, ids.last.generation_time.to_i, 2
+    assert ObjectId.generate_many(0).empty?
+  end
+
+  def test_generate_many_packed
+    packed = ObjectId.generate_many(3, :packed => true)
+    assert_equal 36, packed.bytesize
+    first, second, third = packed.unpack("a12a12a12")
+    assert_equal first[0, 9], third[0, 9]
+    counters = [first, second, third].map { |id| ("\x00" + id[9, 3]).unpack("N")[0] }
+    assert_equal [1, 2], [counters[1] - counters[0], counters[2] - counters[0]].map { |d| d % 0xFFFFFF }
+    assert_not_equal ObjectId.new.to_a[9, 3], first.unpack("C12")[9, 3]
+  end
+
+  def test_generate_many_bad_count
+    assert_raise ArgumentError do
+      ObjectId.generate_many(-1)
+    end
+  end
+
+  def test_generate_after_fork
+    return unless Process.respond_to?(:fork) && RUBY_PLATFORM !~ /java|mswin|mingw/
+    reader, writer = IO.pipe
+    pid = fork do
+      reader.close
+      writer.write(ObjectId.generate_many(1, :packed => true))
+      writer.close
+      exit!(0)
+    end
+    writer.close
+    child_id = reader.read
+    Process.wait(pid)
+    # The C extension truncates the pid to two bytes, the Ruby generator
+    # takes it modulo 0xFFFF.
+    assert [pid % 0x10000, pid % 0xFFFF].include?(child_id[7, 2].unpack("n")[0])
+  end
+
+  def test_from_strings
+    strings = ['4c6ae1bc5b1b7d5e3a000001', '4C6AE1BC5B1B7D5E3A00FFFF']
+    ids = ObjectId.from_strings(strings)
+    assert_equal [ObjectId.from_string(strings[0]), ObjectId.from_string(strings[1])], ids
+    assert_equal strings.map { |str| str.downcase }, ObjectId.to_strings(ids)
+    assert_equal [], ObjectId.from_strings([])
+  end
+
+  def test_from_strings_illegal
+    ['4c6ae1bc5b1b7d5e3a00000g', '4c6ae1bc5b1b7d5e3a0000', 12].each do |bad|
+      assert_raise InvalidObjectId do
+        ObjectId.from_strings(['4c6ae1bc5b1b7d5e3a000001', bad])
+      end
+    end
+  end
+
+  def test_to_strings_requires_object_ids
+    assert_raise TypeError do
+      ObjectId.to_strings([ObjectId.new, '4c6ae1bc5b1b7d5e3a000001'])
+    end
+  end
 end
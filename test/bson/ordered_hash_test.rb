@@ -291,6 +291,19 @@ class OrderedHashTest < Test::Unit::TestCase
     assert_equal ['c', 'a', 'z'], @oh.keys
   end
 
+  def test_deserialized_documents
+    doc = BSON::BSON_CODER.deserialize(BSON::BSON_CODER.serialize(@oh.merge('n' => {'y' => 1, 'x' => 2})))
+    assert_equal BSON::OrderedHash, doc.class
+    assert_equal BSON::OrderedHash, doc['n'].class
+    assert_equal %w(c a z n), doc.keys
+    assert_equal %w(y x), doc['n'].keys
+
+    doc.delete('a')
+    doc['b'] = 4
+    assert_equal %w(c z n b), doc.keys
+    assert_equal [['c', 1], ['z', 3]], doc.dup.reject { |k, v| !v.is_a?(Integer) || v > 3 }.to_a
+  end
+
   def test_extractable_options_for_ordered_hash
     assert @oh.extractable_options?
   end
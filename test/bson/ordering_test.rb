@@ -0,0 +1,123 @@
+# Copyright (C) 2009-2013 MongoDB, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+require 'test_helper'
+
+class OrderingTest < Test::Unit::TestCase
+  include BSON
+
+  # Values in ascending server sort order; each entry sorts strictly after
+  # the one before it.
+  ASCENDING = [
+    MinKey.new,
+    nil,
+    -1.5,
+    -1,
+    0,
+    2.5,
+    2**40,
+    'a',
+    'ab',
+    'b',
+    { 'a' => 1 },
+    { 'a' => 1, 'b' => 1 },
+    { 'b' => 0 },
+    [1, 2],
+    [2],
+    Binary.new('zz'),
+    Binary.new('aaa', Binary::SUBTYPE_USER_DEFINED),
+    ObjectId.from_string('000000000000000000000001'),
+    ObjectId.from_string('100000000000000000000000'),
+    false,
+    true,
+    Time.at(-1).utc,
+    Time.at(1).utc,
+    Timestamp.new(1, 5),
+    Timestamp.new(2, 0),
+    /a/,
+    /b/,
+    Code.new('a'),
+    MaxKey.new
+  ]
+
+  def comparators
+    [BSON_CODER, Ordering].uniq
+  end
+
+  def bson(doc)
+    BSON_CODER.serialize(doc).to_s
+  end
+
+  def test_type_brackets_and_values
+    comparators.each do |coder|
+      ASCENDING.each_cons(2) do |low, high|
+        a, b = bson('v' => low), bson('v' => high)
+        assert_equal -1, coder.compare(a, b, [['v', 1]]), "#{coder}: #{low.inspect} < #{high.inspect}"
+        assert_equal 1, coder.compare(b, a, [['v', 1]]), "#{coder}: #{high.inspect} > #{low.inspect}"
+        assert_equal 1, coder.compare(a, b, [['v', -1]])
+        assert_equal 0, coder.compare(a, a, [['v', 1]])
+      end
+    end
+  end
+
+  def test_numbers_compare_across_types
+    comparators.each do |coder|
+      assert_equal 0, coder.compare(bson('v' => 1), bson('v' => 1.0), [['v', 1]])
+      assert_equal 0, coder.compare(bson('v' => 2**40), bson('v' => (2**40).to_f), [['v', 1]])
+      assert_equal -1, coder.compare(bson('v' => 2**53), bson('v' => 2**53 + 1), [['v', 1]])
+      assert_equal -1, coder.compare(bson('v' => 0.0 / 0.0), bson('v' => -2**62), [['v', 1]])
+      assert_equal 0, coder.compare(bson('v' => 0.0 / 0.0), bson('v' => 0.0 / 0.0), [['v', 1]])
+    end
+  end
+
+  def test_missing_sorts_as_null
+    comparators.each do |coder|
+      assert_equal 0, coder.compare(bson('a' => 1), bson('v' => nil), [['v', 1]])
+      assert_equal -1, coder.compare(bson('a' => 1), bson('v' => 0), [['v', 1]])
+      assert_equal 1, coder.compare(bson('a' => 1), bson('v' => MinKey.new), [['v', 1]])
+    end
+  end
+
+  def test_compound_and_dotted_keys
+    a = bson('x' => { 'y' => 1 }, 'z' => 'b')
+    b = bson('x' => { 'y' => 1 }, 'z' => 'a')
+    c = bson('x' => { 'y' => 2 }, 'z' => 'a')
+    comparators.each do |coder|
+      assert_equal 1, coder.compare(a, b, [['x.y', 1], ['z', 1]])
+      assert_equal -1, coder.compare(a, b, [['x.y', 1], ['z', -1]])
+      assert_equal -1, coder.compare(a, c, [['x.y', 1], ['z', 1]])
+      assert_equal 0, coder.compare(a, b, [['x.missing', 1]])
+      assert_equal -1, coder.compare(bson('l' => [5, 3]), bson('l' => [4, 9]), [['l.1', 1]])
+    end
+  end
+
+  def test_whole_document_comparison
+    comparators.each do |coder|
+      assert_equal 0, coder.compare(bson('a' => 1, 'b' => 2), bson('a' => 1.0, 'b' => 2))
+      assert_equal -1, coder.compare(bson('a' => 1), bson('a' => 1, 'b' => 2))
+      assert_equal -1, coder.compare(bson('a' => 1), bson('b' => 0))
+      assert_equal 1, coder.compare(bson('a' => 'x'), bson('a' => 5))
+    end
+  end
+
+  def test_malformed_documents_raise
+    good = bson('v' => 'abc')
+    truncated = good[0, good.length - 4]
+    comparators.each do |coder|
+      assert_raise InvalidDocument do
+        coder.compare(truncated, good, [['v', 1]])
+      end
+    end
+  end
+end
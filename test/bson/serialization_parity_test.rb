@@ -0,0 +1,105 @@
+# Copyright (C) 2009-2013 MongoDB, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+require 'test_helper'
+
+# Checks that the C extension and the pure Ruby coder write the same bytes
+# for every builtin type.
+class SerializationParityTest < Test::Unit::TestCase
+  include BSON
+
+  def assert_parity(doc)
+    ruby = BSON_RUBY.serialize(doc, false, false).to_s
+    if BSON.extension? && defined?(BSON_C) && RUBY_PLATFORM !~ /java/
+      assert_equal ruby.unpack("H*")[0], BSON_C.serialize(doc, false, false).to_s.unpack("H*")[0]
+    end
+    ruby
+  end
+
+  def millis(doc)
+    assert_parity(doc)[-9, 8].unpack("q")[0]
+  end
+
+  def test_time_is_rounded_down_to_the_millisecond
+    assert_equal 1000, millis('t' => Time.at(1, 999))
+    assert_equal 1999, millis('t' => Time.at(1, 999999))
+    assert_equal 1001, millis('t' => Time.at(1, 1000))
+    assert_equal 0,    millis('t' => Time.at(0))
+  end
+
+  def test_time_does_not_lose_precision_through_a_float
+    # 1.001 * 1000 is 1000.9999999999999 as a double.
+    assert_equal 1001, millis('t' => Time.at(1, 1000).utc)
+    assert_equal 1376000000123, millis('t' => Time.at(1376000000, 123456))
+  end
+
+  def test_time_before_epoch
+    assert_equal -1, millis('t' => Time.at(-1, 999500))
+    assert_equal -1000, millis('t' => Time.at(-1))
+    assert_parity('t' => Time.utc(1600))
+  rescue ArgumentError
+    # Some platforms cannot create pre-epoch Time instances.
+  end
+
+  def test_time_zones
+    t = Time.at(1376000000, 123456)
+    assert_parity('utc' => t.utc, 'local' => t.getlocal)
+  end
+
+  def test_integers
+    [0, 42, -1, 2**31 - 1, -2**31, 2**31, -2**31 - 1, 2**62, 2**63 - 1, -2**63].each do |n|
+      assert_parity('n' => n)
+    end
+  end
+
+  def test_bignum_out_of_range
+    [2**63, -2**63 - 1, 2**100].each do |n|
+      assert_raise RangeError do
+        BSON_CODER.serialize('n' => n)
+      end
+    end
+  end
+
+  def test_timestamp
+    assert_parity('ts' => Timestamp.new(1376000000, 7))
+    assert_parity('ts' => Timestamp.new(0, 0))
+    assert_parity('ts' => Timestamp.new(2**32 - 1, 2**32 - 1))
+  end
+
+  def test_code
+    assert_parity('code' => Code.new('function() { return x; }'))
+    assert_parity('code' => Code.new('function() { return x; }', 'x' => 1, 'y' => [Time.at(5)]))
+  end
+
+  def test_dbref
+    assert_parity('ref' => DBRef.new('users', ObjectId.new))
+    assert_parity('refs' => [DBRef.new('a', ObjectId.new), DBRef.new('b', 5)])
+  end
+
+  def test_object_id
+    assert_parity('_id' => ObjectId.new, 'ids' => [ObjectId.new, ObjectId.from_string('000000000000000000000000')])
+  end
+
+  def test_mixed_document
+    doc = OrderedHash.new
+    doc['_id']  = ObjectId.new
+    doc['at']   = Time.at(1376000000, 654321).utc
+    doc['ts']   = Timestamp.new(1376000000, 3)
+    doc['code'] = Code.new('this.a > 1', 'a' => 2**40)
+    doc['ref']  = DBRef.new('things', ObjectId.new)
+    doc['big']  = 2**62
+    doc['nest'] = { 'at' => [Time.at(0, 1), Time.at(2**31)], 'min' => MinKey.new, 'max' => MaxKey.new }
+    assert_parity(doc)
+  end
+end
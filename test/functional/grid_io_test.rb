@@ -198,6 +198,41 @@ class GridIOTest < Test::Unit::TestCase
 
     end
 
+    context "Compression" do
+      setup do
+        @data = ("timestamp,host,status\n" + "1376000000,db1.example.com,ok\n" * 20000)
+        @file = GridIO.new(@files, @chunks, 'log.csv', 'w', :compression => :zlib, :chunk_size => 64 * 1024)
+        @file.write(@data[0, 1000])
+        @file.write(@data[1000..-1])
+        @file.close
+      end
+
+      should "record the codec and store smaller chunks" do
+        doc = @files.find_one('_id' => @file.files_id)
+        assert_equal 'zlib', doc['metadata']['compression']
+        assert_equal @data.length, doc['length']
+        stored = @chunks.find('files_id' => @file.files_id).inject(0) { |sum, chunk| sum + chunk['data'].size }
+        assert stored < @data.length / 10
+        assert_equal doc['md5'], @file.client_md5
+      end
+
+      should "read and seek transparently" do
+        file = GridIO.new(@files, @chunks, nil, 'r', :query => {:_id => @file.files_id})
+        assert_equal 'zlib', file.compression
+        assert_equal @data, file.read
+        file.seek(100_000)
+        assert_equal @data[100_000, 5000], file.read(5000)
+        file.seek(-10, IO::SEEK_END)
+        assert_equal @data[-10..-1], file.read
+      end
+
+      should "reject unknown codecs" do
+        assert_raise GridError do
+          GridIO.new(@files, @chunks, 'log.csv', 'w', :compression => 'lz77')
+        end
+      end
+    end
+
     context "Grid MD5 check" do
       should "run in safe mode" do
         file = GridIO.new(@files, @chunks, 'smallfile', 'w')
@@ -0,0 +1,61 @@
+# Copyright (C) 2009-2013 MongoDB, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+require 'test_helper'
+require 'stringio'
+
+class ImporterTest < Test::Unit::TestCase
+
+  def setup
+    @client     = standard_connection
+    @collection = @client[TEST_DB]['test-importer']
+    @collection.drop
+  end
+
+  def teardown
+    @collection.drop
+  end
+
+  def test_import_json
+    lines = (1..5000).map { |i| %Q({"i": #{i}, "name": "doc #{i}"}\n) }
+    lines[10] = "{broken\n"
+    importer = Importer.new(@collection, :workers => 3, :writers => 3, :batch_size => 100)
+    stats = importer.import(StringIO.new(lines.join))
+
+    assert_equal 5000, stats[:read]
+    assert_equal 4999, stats[:inserted]
+    assert_equal 1, stats[:failed]
+    assert_equal 4999, @collection.count
+    assert_equal 'doc 42', @collection.find_one('i' => 42)['name']
+  end
+
+  def test_import_csv
+    csv = "name,n,score\na,1,2.5\nb,2,\n"
+    stats = Importer.new(@collection, :format => :csv).import(StringIO.new(csv))
+
+    assert_equal 2, stats[:inserted]
+    assert_equal 2.5, @collection.find_one('name' => 'a')['score']
+    assert_equal 2, @collection.find_one('name' => 'b')['n']
+  end
+
+  def test_import_reports_duplicate_keys
+    input = %Q({"_id": 1}\n{"_id": 1}\n{"_id": 2}\n)
+    importer = Importer.new(@collection)
+    stats = importer.import(StringIO.new(input))
+
+    assert_equal 2, stats[:inserted]
+    assert_equal 1, stats[:failed]
+    assert_match(/E11000/, importer.errors.first)
+  end
+end
@@ -0,0 +1,72 @@
+# Copyright (C) 2009-2013 MongoDB, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+require 'test_helper'
+
+class BatchLoaderUnitTest < Test::Unit::TestCase
+
+  context "Batch loader" do
+    setup do
+      @client = MongoClient.new('localhost', 27017, :connect => false)
+      @coll   = @client[TEST_DB]['batch-loader-test']
+    end
+
+    should "combine concurrent lookups into one query" do
+      loader = @coll.batch_loader(:window => 0.2)
+      selectors = []
+      @coll.stubs(:find).with { |selector, opts| selectors << selector }.returns(
+        [{'_id' => 1, 'n' => 'one'}, {'_id' => 3, 'n' => 'three'}])
+
+      threads = [1, 2, 3, 1].map { |id| Thread.new { loader.load(id) } }
+      docs = threads.map { |thread| thread.value }
+
+      assert_equal [{'_id' => {'$in' => [1, 2, 3]}}], selectors
+      assert_equal ['one', nil, 'three', 'one'], docs.map { |doc| doc && doc['n'] }
+      assert_equal({:loads => 4, :queries => 1}, loader.stats)
+    end
+
+    should "send a full batch without waiting for the window" do
+      loader = BatchLoader.new(@coll, :window => 30, :max_batch => 2)
+      @coll.expects(:find).with({'_id' => {'$in' => [1, 2]}}, {}).returns([{'_id' => 2}])
+      first = Thread.new { loader.load(1) }
+      Thread.pass until loader.stats[:loads] == 1
+      assert_equal [{'_id' => 2}], Timeout.timeout(5) { loader.load_many([2]) }
+      assert_nil Timeout.timeout(5) { first.value }
+    end
+
+    should "not miss a batch filled before the leader waits" do
+      loader = BatchLoader.new(@coll, :window => 30, :max_batch => 2)
+      @coll.expects(:find).with({'_id' => {'$in' => [1, 2]}}, {}).returns([{'_id' => 1}])
+      batch = BatchLoader::Batch.new
+      loader.instance_variable_set(:@batch, batch)
+      follower = Thread.new { loader.load_many([1, 2]) }
+      Thread.pass until loader.stats[:loads] == 2
+
+      Timeout.timeout(5) { loader.send(:run, batch) }
+      assert_equal [{'_id' => 1}, nil], Timeout.timeout(5) { follower.value }
+    end
+
+    should "raise the query error in every waiting thread" do
+      loader = BatchLoader.new(@coll, :window => 0.2)
+      @coll.stubs(:find).raises(Mongo::ConnectionFailure)
+      threads = [1, 2].map { |id| Thread.new { loader.load(id) rescue $! } }
+      assert threads.all? { |thread| thread.value.is_a?(Mongo::ConnectionFailure) }
+    end
+
+    should "keep one loader per read preference" do
+      assert_same @coll.batch_loader, @coll.batch_loader
+      assert_not_same @coll.batch_loader, @coll.batch_loader(:read => :secondary)
+    end
+  end
+end
@@ -0,0 +1,67 @@
+# Copyright (C) 2009-2013 MongoDB, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+require 'test_helper'
+
+class BatchSizerUnitTest < Test::Unit::TestCase
+
+  context "Adaptive batch sizing" do
+    should "let the server choose until a reply has been seen" do
+      assert_equal 0, BatchSizer.new.next_batch_size
+    end
+
+    should "aim for the byte target" do
+      sizer = BatchSizer.new(:target_bytes => 10_000, :latency_ms => nil)
+      sizer.record(100, 100 * 200, 5)
+      assert_equal 50, sizer.next_batch_size
+    end
+
+    should "stay within the latency budget" do
+      sizer = BatchSizer.new(:target_bytes => 10_000_000, :latency_ms => 100)
+      sizer.record(100, 100 * 10, 200)
+      assert_equal 50, sizer.next_batch_size
+    end
+
+    should "grow by at most a factor of two per reply" do
+      sizer = BatchSizer.new(:target_bytes => 1_000_000, :latency_ms => nil)
+      sizer.record(10, 10 * 100, 1)
+      assert_equal 20, sizer.next_batch_size
+      sizer.record(20, 20 * 100, 1)
+      assert_equal 40, sizer.next_batch_size
+    end
+
+    should "never ask for fewer than two documents" do
+      sizer = BatchSizer.new(:target_bytes => 100, :latency_ms => nil)
+      sizer.record(2, 2 * 4_000_000, 50)
+      assert_equal 2, sizer.next_batch_size
+    end
+
+    should "respect the maximum batch size" do
+      sizer = BatchSizer.new(:target_bytes => 1_000_000, :latency_ms => nil, :max_batch_size => 15)
+      sizer.record(100, 100 * 10, 1)
+      assert_equal 15, sizer.next_batch_size
+    end
+
+    should "report the sizes it chose" do
+      sizer = BatchSizer.new(:target_bytes => 1000, :latency_ms => nil)
+      sizer.record(4, 400, 2)
+      sizer.next_batch_size
+      stats = sizer.stats
+      assert_equal [8], stats[:batch_sizes]
+      assert_equal 100, stats[:avg_doc_bytes]
+      assert_equal 0.5, stats[:ms_per_doc]
+      assert_equal 1000, stats[:target_bytes]
+    end
+  end
+end
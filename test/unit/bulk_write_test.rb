@@ -0,0 +1,189 @@
+# Copyright (C) 2009-2013 MongoDB, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+require 'test_helper'
+require 'socket'
+
+class BulkWriteUnitTest < Test::Unit::TestCase
+
+  # The server end of a socket pair, for servers without write commands.
+  # Nothing is answered until +expected+ getlasterror queries have arrived,
+  # or a short wait has passed; each is then answered from a block given
+  # the operations received. A nil answer hangs up.
+  class MockServer
+    attr_reader :operations, :socket, :replied_early
+
+    def initialize(expected, &reply)
+      client, @io   = UNIXSocket.pair
+      @socket       = MockSocket.new(client)
+      @expected     = expected
+      @operations   = []
+      @reply        = reply
+      @replied_early = false
+      @thread       = Thread.new { serve }
+    end
+
+    def serve
+      queries = []
+      loop do
+        if queries.size < @expected && IO.select([@io], nil, nil, 0.5)
+          header = @io.read(16)
+          break unless header
+          size, request_id, _, opcode = header.unpack('VVVV')
+          data = @io.read(size - 16)
+          if opcode == Mongo::Constants::OP_QUERY
+            queries << [request_id, @operations.size - 1]
+          else
+            @operations << opcode
+          end
+        else
+          @replied_early = true if queries.size < @expected
+          break if queries.empty?
+          request_id, index = queries.shift
+          reply = @reply.call(index)
+          break @io.close unless reply
+          doc = BSON::BSON_CODER.serialize(reply).to_s
+          message = [0, 0, 0, 0, 1].pack('VVVVV') + doc
+          @io.write([16 + message.size, 1, request_id, Mongo::Constants::OP_REPLY].pack('VVVV') + message)
+          @expected -= 1
+        end
+      end
+    rescue IOError, SystemCallError
+      # the client closed its end
+    end
+
+    def stop
+      @socket.close
+      @thread.join
+      @io.close
+    end
+  end
+
+  class MockPool
+    def record_latency(ms); end
+  end
+
+  class MockSocket
+    attr_reader :pool
+
+    def initialize(io)
+      @io = io
+      @pool = MockPool.new
+    end
+
+    def send(data)
+      @io.write(data)
+    end
+
+    def read(length, buffer)
+      @io.read(length, buffer)
+    end
+
+    def close
+      @io.close unless @io.closed?
+    end
+
+    def closed?
+      @io.closed?
+    end
+
+    def checkin; end
+  end
+
+  context "Bulk writes against a server without write commands" do
+    setup do
+      @client = MongoClient.new('localhost', 27017, :connect => false)
+      @client.stubs(:use_write_command?).returns(false)
+      @client.instance_variable_set(:@primary_pool, true)
+      @coll = @client['test']['logs']
+      @coll.operation_writer.stubs(:log_operation)
+    end
+
+    teardown do
+      @server.stop if @server
+    end
+
+    should "write every operation before reading getlasterror replies when unordered" do
+      @server = MockServer.new(3) do |index|
+        index == 1 ? {'ok' => 1, 'err' => 'E11000 duplicate key', 'code' => 11000, 'n' => 0} : {'ok' => 1, 'err' => nil, 'n' => 0}
+      end
+      @client.expects(:checkout_writer).once.returns(@server.socket)
+
+      bulk = @coll.initialize_unordered_bulk_op
+      bulk.insert({'_id' => 1})
+      bulk.insert({'_id' => 1})
+      bulk.find({'_id' => 1}).remove_one
+      ex = assert_raise(BulkWriteError) { bulk.execute }
+
+      assert !@server.replied_early
+      assert_equal [Mongo::Constants::OP_INSERT, Mongo::Constants::OP_INSERT, Mongo::Constants::OP_DELETE], @server.operations
+      assert_equal 1, ex.result['nInserted']
+      assert_equal 1, ex.result['writeErrors'].size
+      assert_equal 1, ex.result['writeErrors'][0]['index']
+      assert_equal 11000, ex.result['writeErrors'][0]['code']
+    end
+
+    should "wait for each reply before the next operation when ordered" do
+      @server = MockServer.new(2) do |index|
+        index == 0 ? {'ok' => 1, 'err' => 'E11000 duplicate key', 'code' => 11000, 'n' => 0} : {'ok' => 1, 'err' => nil, 'n' => 0}
+      end
+      @client.stubs(:checkout_writer).returns(@server.socket)
+
+      bulk = @coll.initialize_ordered_bulk_op
+      bulk.insert({'_id' => 1})
+      bulk.insert({'_id' => 2})
+      ex = assert_raise(BulkWriteError) { bulk.execute }
+
+      assert @server.replied_early
+      assert_equal [Mongo::Constants::OP_INSERT], @server.operations
+      assert_equal 0, ex.result['writeErrors'][0]['index']
+    end
+
+    should "report documents that fail to serialize and send the rest" do
+      @server = MockServer.new(1) { |index| {'ok' => 1, 'err' => nil, 'n' => 0} }
+      @client.stubs(:checkout_writer).returns(@server.socket)
+
+      bulk = @coll.initialize_unordered_bulk_op
+      bulk.insert({'a' => Object.new})
+      bulk.insert({'_id' => 2})
+      ex = assert_raise(BulkWriteError) { bulk.execute }
+
+      assert_equal [Mongo::Constants::OP_INSERT], @server.operations
+      assert_equal 1, ex.result['nInserted']
+      assert_equal 0, ex.result['writeErrors'][0]['index']
+    end
+
+    should "report the replies read before a connection failure" do
+      @server = MockServer.new(3) do |index|
+        case index
+        when 0 then {'ok' => 1, 'err' => nil, 'n' => 0}
+        when 1 then {'ok' => 1, 'err' => 'E11000 duplicate key', 'code' => 11000, 'n' => 0}
+        end
+      end
+      @client.stubs(:checkout_writer).returns(@server.socket)
+
+      bulk = @coll.initialize_unordered_bulk_op
+      bulk.insert({'_id' => 1})
+      bulk.insert({'_id' => 1})
+      bulk.insert({'_id' => 2})
+      ex = assert_raise(ConnectionFailure) { bulk.execute }
+
+      assert @server.socket.closed?
+      assert_equal 1, ex.result['nInserted']
+      assert_equal 1, ex.result['writeErrors'].size
+      assert_equal 1, ex.result['writeErrors'][0]['index']
+      assert_equal 11000, ex.result['writeErrors'][0]['code']
+    end
+  end
+end
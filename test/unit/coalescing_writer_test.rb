@@ -0,0 +1,118 @@
+# Copyright (C) 2009-2013 MongoDB, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+require 'test_helper'
+
+class CoalescingWriterUnitTest < Test::Unit::TestCase
+
+  # Opcode and document count of each message in a batch.
+  def summarize(messages)
+    messages.collect do |op, message|
+      body = message.to_s
+      ns_end = body.index("\x00", 4)
+      pos = op == Mongo::Constants::OP_UPDATE ? ns_end + 5 : ns_end + 1
+      count = 0
+      while pos < body.size
+        pos += body[pos, 4].unpack('V')[0]
+        count += 1
+      end
+      [op, count]
+    end
+  end
+
+  context "Coalescing writer" do
+    setup do
+      @client = MongoClient.new('localhost', 27017, :connect => false)
+      @coll   = @client[TEST_DB]['coalescing-unit-test']
+    end
+
+    should "pack consecutive inserts and keep writes in order" do
+      writer = @coll.coalescing_writer(:flush_interval => 3600)
+      sent = nil
+      @client.expects(:send_messages).with { |messages| sent = summarize(messages) }
+
+      id = writer.insert('a' => 1)
+      ids = writer.insert([{'a' => 2}, {'a' => 3}])
+      assert writer.update({'a' => 1}, {'$set' => {'b' => 1}})
+      writer << {'a' => 4}
+
+      assert_kind_of BSON::ObjectId, id
+      assert_equal 2, ids.size
+      assert_equal 5, writer.flush
+      assert_equal [[2002, 3], [2001, 2], [2002, 1]], sent
+      assert_equal 5, writer.stats[:flushed]
+      assert_equal 0, writer.stats[:buffered_bytes]
+      writer.close
+    end
+
+    should "drop writes when the buffer is full" do
+      writer = CoalescingWriter.new(@coll, :flush_interval => 3600, :max_buffer_bytes => 30, :overflow => :drop)
+      @client.stubs(:send_messages)
+      assert writer.insert('a' => 'x' * 10)
+      assert_nil writer.insert('a' => 'y' * 10)
+      assert_equal 1, writer.stats[:dropped]
+      assert_equal 1, writer.flush
+      writer.close
+    end
+
+    should "count writes lost to send failures" do
+      writer = CoalescingWriter.new(@coll, :flush_interval => 3600)
+      @client.expects(:send_messages).raises(Mongo::ConnectionFailure)
+      writer.insert('a' => 1)
+      writer.flush
+      assert_equal 1, writer.stats[:failed]
+      writer.close
+    end
+
+    should "flush in the background" do
+      writer = CoalescingWriter.new(@coll, :flush_interval => 0.01)
+      sent = Queue.new
+      @client.stubs(:send_messages).with { |messages| sent << summarize(messages) }
+      writer.insert('a' => 1)
+      Timeout.timeout(5) { assert_equal [[2002, 1]], sent.pop }
+      writer.close
+    end
+
+    should "flush on close and refuse later writes" do
+      writer = CoalescingWriter.new(@coll, :flush_interval => 3600)
+      @client.expects(:send_messages)
+      writer.insert('a' => 1)
+      writer.close
+      assert writer.closed?
+      assert_raise InvalidOperation do
+        writer.insert('a' => 2)
+      end
+      assert_not_same writer, @coll.coalescing_writer
+    end
+
+    should "close open writers at exit and forget closed ones" do
+      open_writers = CoalescingWriter.instance_variable_get(:@open_writers)
+      closed = CoalescingWriter.new(@coll, :flush_interval => 3600)
+      left_open = CoalescingWriter.new(@coll, :flush_interval => 3600)
+      closed.close
+      assert !open_writers.key?(closed)
+      assert open_writers.key?(left_open)
+
+      CoalescingWriter.close_all
+      assert left_open.closed?
+      assert !open_writers.key?(left_open)
+    end
+
+    should "reject unknown overflow policies" do
+      assert_raise MongoArgumentError do
+        CoalescingWriter.new(@coll, :overflow => :explode)
+      end
+    end
+  end
+end
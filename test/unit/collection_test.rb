@@ -156,6 +156,54 @@ class CollectionUnitTest < Test::Unit::TestCase
       end
     end
 
+    should "send a raw document as it is" do
+      raw = BSON::RawDocument.new(BSON::BSON_CODER.serialize({'_id' => 1, 'a.b' => 2}))
+      @coll.pk_factory.expects(:create_pk).never
+      @client.expects(:send_message_with_gle).with do |op, msg, log|
+        op == 2002 && msg.to_s.end_with?(raw.to_s)
+      end
+      @coll.operation_writer.stubs(:log_operation)
+      assert_equal 1, @coll.insert(raw)
+    end
+
+    should "splice serialized documents into a bulk insert command" do
+      raw = BSON::RawDocument.new(BSON::BSON_CODER.serialize({'_id' => 2}))
+      @db.expects(:command).with do |request|
+        docs = request[:documents]
+        docs[0] == BSON::RawDocument.new(BSON::BSON_CODER.serialize({'_id' => 1, 'a' => 1})) && docs[1].equal?(raw)
+      end
+      @coll.command_writer.send_bulk_write_command(:insert, [BSON::OrderedHash['a', 1, '_id', 1], raw], true, {})
+
+      assert_raise BSON::InvalidKeyName do
+        @coll.command_writer.send_bulk_write_command(:insert, [{'$a' => 1}], true, {})
+      end
+    end
+
+    should "save only the changed fields of a tracked document" do
+      doc = BSON::BSON_CODER.deserialize(BSON::BSON_CODER.serialize(BSON::OrderedHash['_id', 1, 'a', 1, 'b', 'x' * 100]))
+      doc.original_bson = BSON::BSON_CODER.serialize(doc).to_s
+      doc['a'] = 2
+      @coll.expects(:update).with({:_id => 1}, BSON::RawDocument.new(BSON::BSON_CODER.serialize({'$set' => {'a' => 2}})), {})
+      assert_equal 1, @coll.save_changes(doc)
+      assert_equal BSON::BSON_CODER.serialize(doc).to_s, doc.original_bson
+
+      @coll.expects(:update).never
+      @coll.expects(:save).never
+      assert_equal 1, @coll.save_changes(doc)
+    end
+
+    should "save the whole document when most of it changed" do
+      doc = BSON::OrderedHash['_id', 1, 'a', 1]
+      doc.original_bson = BSON::BSON_CODER.serialize(doc).to_s
+      doc['a'] = 'y' * 100
+      @coll.expects(:update).never
+      @coll.expects(:save).with(doc, {})
+      @coll.save_changes(doc)
+
+      @coll.expects(:save).with({'a' => 1}, {:w => 0})
+      @coll.save_changes({'a' => 1}, :w => 0)
+    end
+
     should "use the connection's logger" do
       @logger.expects(:warn).with do |msg|
         msg == "MONGODB [WARNING] test warning"
@@ -0,0 +1,100 @@
+# Copyright (C) 2009-2013 MongoDB, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+require 'test_helper'
+
+class CursorReaperUnitTest < Test::Unit::TestCase
+
+  def killed_ids(message)
+    count = message.to_s.unpack('VV')[1]
+    message.to_s[8, count * 8].unpack('V*').each_slice(2).map { |low, high| (high << 32) + low }
+  end
+
+  context "Cursor reaper" do
+    setup do
+      @client = mock()
+      @client.stubs(:logger).returns(nil)
+      @reaper = CursorReaper.new(@client, 3600)
+      @pool_a = stub()
+      @pool_b = stub()
+    end
+
+    teardown do
+      @reaper.stop
+    end
+
+    should "send one OP_KILL_CURSORS per pool" do
+      sent = {}
+      @client.expects(:send_message).twice.with do |op, message, opts|
+        assert_equal Mongo::Constants::OP_KILL_CURSORS, op
+        sent[opts[:pool]] = killed_ids(message)
+      end
+
+      @reaper.enqueue(@pool_a, 1)
+      @reaper.enqueue(@pool_b, 2**40)
+      @reaper.enqueue(@pool_a, 3)
+      assert_equal 3, @reaper.pending
+      assert_equal 3, @reaper.flush
+
+      assert_equal [1, 3], sent[@pool_a]
+      assert_equal [2**40], sent[@pool_b]
+      assert_equal 0, @reaper.pending
+    end
+
+    should "ignore cursors that are already dead" do
+      @client.expects(:send_message).never
+      @reaper.enqueue(@pool_a, 0)
+      @reaper.enqueue(@pool_a, nil)
+      assert_equal 0, @reaper.flush
+    end
+
+    should "drop ids when the server is unreachable" do
+      @client.expects(:send_message).raises(Mongo::ConnectionFailure)
+      @reaper.enqueue(@pool_a, 7)
+      assert_equal 1, @reaper.flush
+      assert_equal 0, @reaper.pending
+    end
+
+    should "only queue ids when enqueueing" do
+      Thread.expects(:new).never
+      @reaper.enqueue(@pool_a, 5)
+      assert_equal 1, @reaper.pending
+    end
+
+    should "kill queued cursors in the background" do
+      reaper = CursorReaper.new(@client, 0.01)
+      killed = Queue.new
+      @client.stubs(:send_message).with { |op, message, opts| killed << killed_ids(message) }
+      reaper.enqueue(@pool_a, 9)
+      Timeout.timeout(5) { assert_equal [9], killed.pop }
+      reaper.stop
+    end
+
+    should "send finalized cursors to the client's current reaper" do
+      client = MongoClient.new('localhost', 27017, :connect => false, :reap_cursors => true, :reap_interval => 3600)
+      stopped = client.cursor_reaper
+      client.close
+      finalizer = Cursor.reap_on_finalize(client, [@pool_a, 5])
+
+      finalizer.call
+      assert_equal 0, stopped.pending
+
+      current = client.cursor_reaper
+      finalizer.call
+      assert_equal 1, current.pending
+      client.expects(:send_message)
+      current.stop
+    end
+  end
+end
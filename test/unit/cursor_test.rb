@@ -19,13 +19,23 @@ class CursorUnitTest < Test::Unit::TestCase
     public :construct_query_spec
   end
 
+  # Put a cursor in the state it is in once its query has run and left a
+  # server cursor open.
+  def open_cursor(cursor)
+    cursor.instance_variable_set(:@query_run, true)
+    cursor.instance_variable_set(:@cursor_id, 42)
+    cursor.instance_variable_set(:@pool, stub(:checkout => stub(:checkin => nil)))
+    cursor
+  end
+
   context "Cursor options" do
     setup do
       @logger     = mock()
       @logger.stubs(:debug)
       @connection = stub(:class => MongoClient, :logger => @logger,
         :slave_ok? => false, :read => :primary, :log_duration => false,
-        :tag_sets => [], :acceptable_latency => 10)
+        :tag_sets => [], :acceptable_latency => 10, :cursor_reaper => nil,
+        :hedged_reads => nil, :mongos? => false)
       @db         = stub(:name => "testing", :slave_ok? => false,
         :connection => @connection, :read => :primary,
         :tag_sets => [], :acceptable_latency => 10)
@@ -138,6 +148,108 @@ class CursorUnitTest < Test::Unit::TestCase
       assert_equal 100, @cursor.batch_size
     end
 
+    should "not report batch stats for fixed batch sizes" do
+      assert_nil @cursor.batch_stats
+    end
+
+    should "size getMores from observed replies when adaptive" do
+      cursor = open_cursor(Cursor.new(@collection, :adaptive_batch => {:target_bytes => 1000, :latency_ms => nil}))
+
+      requested = []
+      @connection.expects(:receive_message).twice.with do |op, message, *rest|
+        requested << message.to_s[4 + "testing.items".length + 1, 4].unpack('V')[0]
+      end.returns([[], 10, 42, 500], [[], 20, 0, 1000])
+
+      cursor.send(:send_get_more)
+      assert_equal [0], requested
+      cursor.send(:send_get_more)
+      assert_equal [0, 20], requested
+      assert_equal [20], cursor.batch_stats[:batch_sizes]
+      assert_equal 50, cursor.batch_stats[:avg_doc_bytes]
+    end
+
+    should "replace DBRefs with their documents when dereferencing" do
+      cursor = open_cursor(Cursor.new(@collection, :dereference => true))
+
+      id = BSON::ObjectId.new
+      ref = BSON::DBRef.new('users', id)
+      batch = [{'by' => ref}, {'likes' => [ref, 5]}].map { |doc| BSON::BSON_CODER.serialize(doc).to_s }
+      @connection.expects(:receive_message).with { |*args| args[8] == true }.returns([batch, 2, 0, 100])
+      @db.expects(:dereference_all).with { |refs, opts| refs.map { |r| r.object_id } == [id, id] }.
+        returns([{'_id' => id, 'name' => 'a'}, {'_id' => id, 'name' => 'a'}])
+
+      cursor.send(:send_get_more)
+      assert_equal 'a', cursor.next['by']['name']
+      assert_equal [{'_id' => id, 'name' => 'a'}, 5], cursor.next['likes']
+    end
+
+    should "keep the serialized form of each document when tracking changes" do
+      cursor = open_cursor(Cursor.new(@collection, :track_changes => true))
+
+      batch = [{'_id' => 1}, {'_id' => 2}].map { |doc| BSON::BSON_CODER.serialize(doc).to_s }
+      @connection.expects(:receive_message).with { |*args| args[8] == true }.returns([batch, 2, 0, 100])
+      @db.expects(:dereference_all).never
+
+      cursor.send(:send_get_more)
+      doc = cursor.next
+      assert_equal({'_id' => 1}, doc)
+      assert_equal batch[0], doc.original_bson
+    end
+
+    should "decode each raw batch into columns" do
+      cursor = Cursor.new(@collection)
+      pool = stub()
+      cursor.stubs(:checkout_socket_from_connection).returns(stub(:checkin => nil, :pool => pool))
+      cursor.stubs(:instrument).yields
+      cursor.stubs(:construct_query_message).returns(BSON::ByteBuffer.new)
+      @connection.stubs(:pin_pool)
+      pool.stubs(:checkout).returns(stub(:checkin => nil))
+      cursor.instance_variable_set(:@pool, pool)
+
+      first  = [{'v' => 1}, {'v' => 2.5}].map { |doc| BSON::BSON_CODER.serialize(doc).to_s }
+      second = [{'w' => 1}].map { |doc| BSON::BSON_CODER.serialize(doc).to_s }
+      @connection.expects(:receive_message).twice.with { |*args| args[8] == true }.
+        returns([first, 2, 42, 100], [second, 1, 0, 50])
+
+      batches = []
+      cursor.each_column_batch(['v']) { |columns| batches << columns['v'] }
+      assert_equal [:double, :object], batches.map { |column| column.type }
+      assert_equal [1.0, 2.5], batches[0].to_a
+      assert_equal [nil], batches[1].to_a
+      assert_raise InvalidOperation do
+        cursor.each_column_batch(['v']) { }
+      end
+    end
+
+    should "send hedgeable queries through hedged reads" do
+      cursor = Cursor.new(@collection, :read => :nearest)
+      first, second = stub(:pool => stub()), stub(:pool => stub())
+      hedger = HedgedReads.new(@connection)
+      @connection.stubs(:hedged_reads).returns(hedger)
+      cursor.stubs(:checkout_socket_from_connection).returns(first)
+      cursor.stubs(:instrument).yields
+      cursor.stubs(:construct_query_message).returns(BSON::ByteBuffer.new)
+      @connection.stubs(:pin_pool)
+      @connection.expects(:receive_message).never
+      hedger.expects(:query).with { |message, socket, read_pref, opts| socket == first }.
+        returns([[{'a' => 1}], 1, 0, 10, second])
+      second.expects(:checkin)
+
+      assert_equal({'a' => 1}, cursor.next)
+      assert_equal second.pool, cursor.instance_variable_get(:@pool)
+    end
+
+        should "hand the cursor id to the reaper on close" do
+      reaper = mock()
+      @connection.stubs(:cursor_reaper).returns(reaper)
+      pool = stub()
+      cursor = Cursor.new(@collection, :cursor_id => 42, :pool => pool)
+      reaper.expects(:enqueue).with(pool, 42)
+      @connection.expects(:send_message).never
+      cursor.close
+      assert cursor.closed?
+    end
+
     context 'when an alternate namespace is specified' do
 
       should 'use the alternate namespace' do
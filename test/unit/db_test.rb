@@ -64,24 +64,89 @@ class DBUnitTest < Test::Unit::TestCase
         @db.command(command, :socket => nil)
       end
 
-      should "create the proper cursor" do
-        @cursor = mock(:next_document => {"ok" => 1})
-        Cursor.expects(:new).with(@collection,
-          :limit => -1, :selector => {:buildinfo => 1}).returns(@cursor)
-        command = {:buildinfo => 1}
-        @db.command(command, :check_response => true)
-      end
+      context "run directly" do
+        setup do
+          @socket = mock(:pool => :primary_pool)
+          @client.stubs(:max_bson_size).returns(16 * 1024 * 1024)
+          @client.stubs(:mongos?).returns(false)
+          @client.stubs(:instrument).yields
+          Cursor.expects(:new).never
+        end
 
-      should "raise an error when the command fails" do
-        @cursor = mock(:next_document => {"ok" => 0})
-        Cursor.expects(:new).with(@collection,
-          :limit => -1, :selector => {:buildinfo => 1}).returns(@cursor)
-        assert_raise OperationFailure do
-          command = {:buildinfo => 1}
-          @db.command(command, :check_response => true)
+        should "send one query to the primary and decode the reply" do
+          @client.expects(:checkout_reader).with(:mode => :primary).returns(@socket)
+          @client.expects(:receive_message).with do |op, message, log, socket, command|
+            flags, ns = message.to_s.unpack("VZ*")
+            skip, limit = message.to_s[4 + ns.size + 1, 8].unpack("Vl")
+            doc = BSON::BSON_CODER.deserialize(message.to_s[4 + ns.size + 9..-1])
+            op == Mongo::Constants::OP_QUERY && socket == @socket && flags == 0 &&
+              ns == "testing.$cmd" && skip == 0 && limit == -1 && doc == {'buildinfo' => 1}
+          end.returns([[{"ok" => 1, "version" => "2.6.0"}], 1, 0])
+          @socket.expects(:checkin)
+
+          assert_equal "2.6.0", @db.command({:buildinfo => 1}, :check_response => true)['version']
+        end
+
+        should "raise an error when the command fails" do
+          @client.stubs(:checkout_reader).returns(@socket)
+          @client.stubs(:receive_message).returns([[{"ok" => 0}], 1, 0])
+          @socket.expects(:checkin)
+          assert_raise OperationFailure do
+            command = {:buildinfo => 1}
+            @db.command(command, :check_response => true)
+          end
+        end
+
+        should "raise the error reported in the reply" do
+          @client.stubs(:checkout_reader).returns(@socket)
+          @client.stubs(:receive_message).returns([[{"ok" => 0, "errmsg" => "no such cmd", "code" => 59}], 1, 0])
+          @socket.stubs(:checkin)
+          ex = assert_raise(OperationFailure) { @db.command(:bogus => 1) }
+          assert_equal 59, ex.error_code
+          assert_match(/Database command 'bogus' failed: no such cmd/, ex.message)
+          assert_equal "no such cmd", @db.command({:bogus => 1}, :check_response => false)['errmsg']
+        end
+
+        should "route secondary_ok commands by read preference and retry them" do
+          @client.expects(:checkout_reader).with(:mode => :secondary, :tags => nil, :latency => nil).
+            twice.returns(@socket)
+          @client.expects(:receive_message).
+            with { |op, message| message.to_s.unpack("V")[0] == Mongo::Constants::OP_QUERY_SLAVE_OK }.
+            twice.raises(ConnectionFailure).then.returns([[{"ok" => 1, "n" => 3}], 1, 0])
+          @socket.expects(:close)
+          @socket.expects(:checkin)
+          @client.expects(:unpin_pool)
+          @client.expects(:refresh)
+
+          assert_equal 3, @db.command({:count => 'foo'}, :read => :secondary)['n']
+        end
+
+        should "not retry commands that must run on the primary" do
+          @client.expects(:checkout_reader).once.returns(@socket)
+          @client.expects(:receive_message).raises(ConnectionFailure)
+          @socket.expects(:close)
+          @client.stubs(:unpin_pool)
+          @client.stubs(:refresh)
+          assert_raise(ConnectionFailure) { @db.command(:drop => 'foo') }
+        end
+
+        should "pin the pool for a command cursor" do
+          @client.stubs(:checkout_reader).returns(@socket)
+          @client.stubs(:receive_message).returns([[{"ok" => 1, "cursor" => {"id" => 5}}], 1, 0])
+          @socket.stubs(:checkin)
+          @client.expects(:pin_pool).with(:primary_pool, :mode => :primary, :tags => nil, :latency => nil)
+          @db.command(:aggregate => 'foo', :pipeline => [], :cursor => {})
         end
       end
 
+      should "use a cursor to send secondary reads through mongos" do
+        @client.stubs(:mongos?).returns(true)
+        @cursor = mock(:next_document => {"ok" => 1})
+        Cursor.expects(:new).with(@collection, :limit => -1, :read => :secondary,
+          :selector => {:count => 'foo'}).returns(@cursor)
+        @db.command({:count => 'foo'}, :read => :secondary)
+      end
+
       should "pass on the comment" do
         @cursor = mock(:next_document => {"ok" => 0})
         Cursor.expects(:new).with(@collection,
@@ -93,6 +158,18 @@ class DBUnitTest < Test::Unit::TestCase
         end
       end
 
+      should "dereference DBRefs with one query per collection" do
+        a1, a2 = BSON::ObjectId.new, BSON::ObjectId.new
+        users, posts = mock(), mock()
+        @db.stubs(:collection).with('users').returns(users)
+        @db.stubs(:collection).with('posts').returns(posts)
+        users.expects(:find).with('_id' => {'$in' => [a1, a2]}).returns([{'_id' => a2}, {'_id' => a1}])
+        posts.expects(:find).with('_id' => {'$in' => [a1]}).returns([])
+
+        refs = [DBRef.new('users', a1), nil, DBRef.new('posts', a1), DBRef.new('users', a2), DBRef.new('users', a1)]
+        assert_equal [{'_id' => a1}, nil, nil, {'_id' => a2}, {'_id' => a1}], @db.dereference_all(refs, :parallel => true)
+      end
+
       should "raise an error if collection creation fails" do
         @db.expects(:command).returns({'ok' => 0})
         assert_raise Mongo::MongoDBError do
@@ -0,0 +1,77 @@
+# Copyright (C) 2009-2013 MongoDB, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+require 'test_helper'
+
+class DocumentDiffUnitTest < Test::Unit::TestCase
+
+  def diff(original, current)
+    update = DocumentDiff.update(BSON::BSON_CODER.serialize(original).to_s,
+                                 BSON::BSON_CODER.serialize(current).to_s)
+    update ? BSON::BSON_CODER.deserialize(update) : update
+  end
+
+  context "DocumentDiff" do
+    setup do
+      @id = BSON::ObjectId.new
+      @doc = BSON::OrderedHash['_id', @id, 'name', 'a', 'count', 1,
+        'address', BSON::OrderedHash['city', 'x', 'zip', '1'], 'tags', ['p', 'q']]
+    end
+
+    should "find no changes in the same document" do
+      assert_nil diff(@doc, @doc.dup)
+    end
+
+    should "set changed and added fields" do
+      current = @doc.merge('count' => 2, 'score' => 1.5)
+      assert_equal({'$set' => {'count' => 2, 'score' => 1.5}}, diff(@doc, current))
+    end
+
+    should "set a field whose type changed" do
+      assert_equal({'$set' => {'count' => 1.0}}, diff(@doc, @doc.merge('count' => 1.0)))
+    end
+
+    should "unset removed fields" do
+      current = @doc.reject { |key, value| key == 'name' }
+      assert_equal({'$unset' => {'name' => 1}}, diff(@doc, current))
+    end
+
+    should "compare embedded documents by field" do
+      current = @doc.merge('address' => BSON::OrderedHash['city', 'y', 'street', 's'])
+      assert_equal({'$set' => {'address.city' => 'y', 'address.street' => 's'},
+                    '$unset' => {'address.zip' => 1}}, diff(@doc, current))
+    end
+
+    should "set arrays whole" do
+      assert_equal({'$set' => {'tags' => ['p', 'r']}}, diff(@doc, @doc.merge('tags' => ['p', 'r'])))
+    end
+
+    should "walk values of every type" do
+      values = BSON::OrderedHash['_id', @id, 'b', BSON::Binary.new('xyz'), 'r', BSON::Regex.new('^a', 'i'),
+        't', Time.at(0).utc, 'n', nil, 'l', 2 ** 40, 's', :sym, 'c', BSON::Code.new('f()', {'v' => 1}),
+        'ts', BSON::Timestamp.new(1, 2), 'min', BSON::MinKey.new, 'max', BSON::MaxKey.new, 'last', 1]
+      assert_equal({'$set' => {'last' => 2}}, diff(values, values.merge('last' => 2)))
+    end
+
+    should "refuse to change the _id" do
+      assert_equal false, diff(@doc, @doc.merge('_id' => BSON::ObjectId.new))
+    end
+
+    should "reject malformed documents" do
+      assert_raise BSON::InvalidDocument do
+        DocumentDiff.update([7].pack('V') + "\x10a\0", BSON::BSON_CODER.serialize({}).to_s)
+      end
+    end
+  end
+end
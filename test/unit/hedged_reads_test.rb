@@ -0,0 +1,196 @@
+# Copyright (C) 2009-2013 MongoDB, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+require 'test_helper'
+require 'socket'
+
+class HedgedReadsUnitTest < Test::Unit::TestCase
+
+  # Stands in for a client: a reply is "sent" by writing a byte to the
+  # server end of a socket pair, and reading it returns that member's reply.
+  class FakeClient
+    attr_reader :sent, :killed, :hedge_pool
+
+    def initialize(hedge_pool)
+      @hedge_pool = hedge_pool
+      @sent       = Queue.new
+      @killed     = Queue.new
+    end
+
+    def logger; end
+
+    def op_timeout
+      5
+    end
+
+    def select_hedge_pool(read_pref, excluded)
+      @hedge_pool
+    end
+
+    def dispatch_message(op, message, socket)
+      (op == Mongo::Constants::OP_KILL_CURSORS ? @killed : @sent) << [socket, message.to_s]
+      1
+    end
+
+    def receive_reply(socket, request_id, opts)
+      socket.read(1)
+      reply = socket.pool.reply
+      raise reply if reply.is_a?(Exception)
+      reply
+    end
+  end
+
+  class FakePool
+    attr_reader :reply, :ping_time, :latencies, :checked_in
+    attr_accessor :server
+
+    def initialize(reply)
+      @reply      = reply
+      @ping_time  = 1
+      @latencies  = []
+      @checked_in = Queue.new
+    end
+
+    def checkout
+      client, @server = UNIXSocket.pair
+      pool = self
+      client.instance_eval do
+        @pool = pool
+        def pool; @pool; end
+        def checkin; @pool.checked_in << self; end
+      end
+      client
+    end
+
+    def record_latency(ms)
+      @latencies << ms
+    end
+
+    def latency_percentile(fraction)
+      nil
+    end
+  end
+
+  context "Hedged reads" do
+    setup do
+      @first  = FakePool.new([[{'n' => 1}], 1, 0, 20])
+      @second = FakePool.new([[{'n' => 2}], 1, 77, 20])
+      @client = FakeClient.new(@second)
+      @hedger = HedgedReads.new(@client, :min_delay => 10, :max_delay => 10)
+      @socket = @first.checkout
+    end
+
+    should "only hedge secondary_preferred and nearest" do
+      assert @hedger.hedge?(:nearest)
+      assert @hedger.hedge?(:secondary_preferred)
+      assert !@hedger.hedge?(:secondary)
+      assert !@hedger.hedge?(:primary)
+    end
+
+    should "reject a bad percentile" do
+      assert_raise MongoArgumentError do
+        HedgedReads.new(@client, :percentile => 0)
+      end
+      assert_equal HedgedReads::DEFAULT_PERCENTILE, HedgedReads.new(@client, true).percentile
+    end
+
+    should "wait for the pool's latency percentile within the bounds" do
+      hedger = HedgedReads.new(@client, :min_delay => 5, :max_delay => 100)
+      pool = stub(:ping_time => 3)
+      pool.stubs(:latency_percentile).returns(40, 400, nil)
+      assert_equal 0.04, hedger.delay(pool)
+      assert_equal 0.1, hedger.delay(pool)
+      assert_equal 0.005, hedger.delay(pool)
+    end
+
+    should "not hedge a query that replies quickly" do
+      @first.server.write("r")
+      reply = @hedger.query(BSON::ByteBuffer.new("query"), @socket, {:mode => :nearest})
+
+      assert_equal [[{'n' => 1}], 1, 0, 20, @socket], reply
+      assert_equal 1, @client.sent.size
+      assert_equal({:reads => 1, :hedged => 0, :won => 0}, @hedger.stats)
+      assert_equal 1, @first.latencies.size
+    end
+
+    should "use the hedge's reply and kill the slower cursor" do
+      @first.stubs(:reply).returns([[{'n' => 1}], 1, 55, 20])
+      answer = Thread.new do
+        socket, message = @client.sent.pop
+        socket, message = @client.sent.pop
+        assert_equal "query", message
+        @second.server.write("r")
+      end
+      reply = @hedger.query(BSON::ByteBuffer.new("query"), @socket, {:mode => :nearest})
+      answer.join
+
+      assert_equal [{'n' => 2}], reply[0]
+      assert_equal 77, reply[2]
+      assert_equal @second, reply[4].pool
+      assert_equal({:reads => 1, :hedged => 1, :won => 1}, @hedger.stats)
+
+      @first.server.write("r")
+      socket, message = Timeout.timeout(5) { @client.killed.pop }
+      assert_equal @socket, socket
+      assert_equal [0, 1, 55, 0], message.unpack("VVVV")
+      assert_equal @socket, Timeout.timeout(5) { @first.checked_in.pop }
+    end
+
+    should "raise a server error at once and keep the socket" do
+      @first.stubs(:reply).returns(Mongo::OperationFailure.new("bad query"))
+      answer = Thread.new do
+        2.times { @client.sent.pop }
+        @first.server.write("r")
+      end
+      assert_raise Mongo::OperationFailure do
+        @hedger.query(BSON::ByteBuffer.new("query"), @socket, {:mode => :nearest})
+      end
+      answer.join
+
+      assert !@socket.closed?
+      assert_equal @socket, Timeout.timeout(5) { @first.checked_in.pop }
+      @second.server.write("r")
+      assert !Timeout.timeout(5) { @second.checked_in.pop }.closed?
+    end
+
+    should "use the first reply if no other member can take the hedge" do
+      @client.stubs(:select_hedge_pool).returns(nil)
+      answer = Thread.new { sleep 0.05; @first.server.write("r") }
+      reply = @hedger.query(BSON::ByteBuffer.new("query"), @socket, {:mode => :secondary_preferred})
+      answer.join
+
+      assert_equal [{'n' => 1}], reply[0]
+      assert_equal({:reads => 1, :hedged => 0, :won => 0}, @hedger.stats)
+    end
+  end
+
+  context "Pool latency percentile" do
+    setup do
+      @pool = Pool.new(stub(:pool_size => 1), 'localhost', 27017)
+    end
+
+    should "be nil without samples" do
+      assert_nil @pool.latency_percentile(0.95)
+    end
+
+    should "use the most recent samples" do
+      (1..100).each { |ms| @pool.record_latency(ms) }
+      assert_equal 95, @pool.latency_percentile(0.95)
+      assert_equal 1, @pool.latency_percentile(0.01)
+      (1..50).each { @pool.record_latency(1000) }
+      assert_equal 1000, @pool.latency_percentile(0.51)
+      assert_equal 100, @pool.latency_percentile(0.5)
+    end
+  end
+end
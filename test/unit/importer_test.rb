@@ -0,0 +1,166 @@
+# Copyright (C) 2009-2013 MongoDB, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+require 'test_helper'
+require 'stringio'
+
+class ImporterUnitTest < Test::Unit::TestCase
+
+  # Answers insert commands, keeping the documents it was sent. A reply can
+  # be replaced by giving a block, which may also raise.
+  class FakeDB
+    attr_reader :inserted, :connection
+
+    def initialize(connection, &reply)
+      @connection = connection
+      @reply      = reply
+      @inserted   = []
+      @mutex      = Mutex.new
+    end
+
+    def name
+      'test'
+    end
+
+    def command(request)
+      docs = BSON.deserialize(request[:bson].to_s)['documents']
+      assert_request(request)
+      reply = @reply ? @reply.call(docs) : {'ok' => 1, 'n' => docs.size}
+      @mutex.synchronize { @inserted.concat(docs) }
+      reply
+    end
+
+    def assert_request(request)
+      raise "not an unordered insert" unless request[:insert] == 'logs' && request[:ordered] == false
+    end
+  end
+
+  context "Importer" do
+    setup do
+      @connection = stub(:max_write_batch_size => 2, :max_bson_size => 16 * 1024 * 1024,
+        :max_message_size => 48 * 1024 * 1024)
+      @connection.stubs(:use_write_command?).returns(true)
+      @db = FakeDB.new(@connection)
+      @collection = stub(:db => @db, :name => 'logs', :pk_factory => BSON::ObjectId,
+        :write_concern => {:w => 1}, :expire_query_cache => nil)
+    end
+
+    should "import JSON lines in batches" do
+      input = StringIO.new(%Q({"a": 1}\n{"a": 2, "b": {"c": "x"}}\nnot json\n\n{"a": 3}\n{"a": 4}\n))
+      importer = Importer.new(@collection, :workers => 2, :writers => 2)
+      stats = importer.import(input)
+
+      assert_equal 5, stats[:read]
+      assert_equal 4, stats[:inserted]
+      assert_equal 1, stats[:failed]
+      assert_equal 3, stats[:batches]
+      assert_match(/\Aline 3: /, importer.errors.first)
+      assert_equal [1, 2, 3, 4], @db.inserted.map { |doc| doc['a'] }.sort
+      assert_equal({'c' => 'x'}, @db.inserted.find { |doc| doc['a'] == 2 }['b'])
+      assert @db.inserted.all? { |doc| doc['_id'].is_a?(BSON::ObjectId) }
+    end
+
+    should "import CSV with a header line" do
+      input = StringIO.new("host,status,ms\ndb1,ok,12\n\"db,2\",,1.5\n")
+      stats = Importer.new(@collection, :format => :csv).import(input)
+
+      assert_equal 2, stats[:inserted]
+      db2, db1 = @db.inserted.sort_by { |doc| doc['host'] }
+      assert_equal ['_id', 'host', 'status', 'ms'], db1.keys
+      assert_equal 12, db1['ms']
+      assert_equal 'db,2', db2['host']
+      assert_equal 1.5, db2['ms']
+      assert !db2.has_key?('status')
+    end
+
+    should "read the CSV header of every imported IO" do
+      importer = Importer.new(@collection, :format => :csv)
+      importer.import(StringIO.new("host,ms\ndb1,12\n"))
+      stats = importer.import(StringIO.new("name,size\nlogs,3\n"))
+
+      assert_equal 2, stats[:inserted]
+      assert_equal [{'host' => 'db1', 'ms' => 12}, {'name' => 'logs', 'size' => 3}],
+        @db.inserted.map { |doc| doc.reject { |key, _| key == '_id' } }
+      assert_nil importer.fields
+    end
+
+    should "count documents the server rejects" do
+      @db = FakeDB.new(@connection) do |docs|
+        {'ok' => 1, 'n' => docs.size - 1, 'writeErrors' => [{'index' => 0, 'code' => 11000, 'errmsg' => 'E11000 duplicate key'}]}
+      end
+      @collection.stubs(:db).returns(@db)
+      importer = Importer.new(@collection)
+      stats = importer.import(StringIO.new(%Q({"a": 1}\n{"a": 2}\n)))
+
+      assert_equal 1, stats[:inserted]
+      assert_equal 1, stats[:failed]
+      assert_equal ['E11000 duplicate key'], importer.errors
+    end
+
+    should "retry a batch after a network error" do
+      attempts = 0
+      @db = FakeDB.new(@connection) do |docs|
+        attempts += 1
+        raise ConnectionFailure, "connection reset" if attempts == 1
+        {'ok' => 1, 'n' => 1, 'writeErrors' => [{'index' => 0, 'code' => 11000, 'errmsg' => 'E11000'}]}
+      end
+      @collection.stubs(:db).returns(@db)
+      stats = Importer.new(@collection, :writers => 1).import(StringIO.new(%Q({"a": 1}\n{"a": 2}\n)))
+
+      assert_equal 1, stats[:retries]
+      assert_equal 2, stats[:inserted]
+      assert_equal 0, stats[:failed]
+    end
+
+    should "give up on a batch after the last retry" do
+      @db = FakeDB.new(@connection) { |docs| raise ConnectionFailure, "no primary" }
+      @collection.stubs(:db).returns(@db)
+      importer = Importer.new(@collection, :retries => 1)
+      importer.stubs(:sleep)
+      stats = importer.import(StringIO.new(%Q({"a": 1}\n)))
+
+      assert_equal 1, stats[:retries]
+      assert_equal 1, stats[:failed]
+      assert_equal ['no primary'], importer.errors
+    end
+
+    should "send OP_INSERT with continue-on-error without write commands" do
+      @connection.stubs(:use_write_command?).returns(false)
+      sent = []
+      @connection.expects(:send_message_with_gle).with do |op, message, db_name, log, write_concern|
+        sent << message.to_s
+        op == Mongo::Constants::OP_INSERT && db_name == 'test'
+      end
+      stats = Importer.new(@collection).import(StringIO.new(%Q({"a": 1}\n{"a": 2}\n)))
+
+      assert_equal 2, stats[:inserted]
+      assert_equal 1, sent[0].unpack("V")[0]
+      assert_equal "test.logs\0", sent[0][4, 10]
+    end
+
+    should "report progress" do
+      reports = []
+      Importer.new(@collection, :progress => lambda { |stats| reports << stats }).
+        import(StringIO.new(%Q({"a": 1}\n)))
+      assert_equal 1, reports.last[:inserted]
+      assert reports.last[:rate] > 0
+    end
+
+    should "reject unknown formats" do
+      assert_raise MongoArgumentError do
+        Importer.new(@collection, :format => :xml)
+      end
+    end
+  end
+end
@@ -0,0 +1,85 @@
+# Copyright (C) 2009-2013 MongoDB, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+require 'test_helper'
+
+class MergedCursorUnitTest < Test::Unit::TestCase
+
+  # Stands in for a Cursor over an already sorted result set.
+  class ListCursor
+    attr_reader :closed
+
+    def initialize(docs)
+      @docs = docs.dup
+    end
+
+    def next
+      @docs.shift
+    end
+
+    def close
+      @closed = true
+    end
+  end
+
+  def raw_cursor(*docs)
+    ListCursor.new(docs.map { |doc| BSON::BSON_CODER.serialize(doc).to_s })
+  end
+
+  context "Merging cursors" do
+    should "yield documents in global order" do
+      cursors = [
+        raw_cursor({'n' => 1}, {'n' => 4}, {'n' => 9}),
+        raw_cursor({'n' => 2.5}, {'n' => 3}),
+        raw_cursor(),
+        raw_cursor({'n' => 0}, {'n' => 10})
+      ]
+      merged = MergedCursor.new(cursors, [['n', Mongo::ASCENDING]])
+      assert_equal [0, 1, 2.5, 3, 4, 9, 10], merged.to_a.map { |doc| doc['n'] }
+      assert !merged.has_next?
+    end
+
+    should "honor descending and compound keys" do
+      cursors = [
+        raw_cursor({'a' => 2, 'b' => 'x'}, {'a' => 1, 'b' => 'z'}),
+        raw_cursor({'a' => 2, 'b' => 'y'}, {'a' => 1, 'b' => 'a'})
+      ]
+      merged = MergedCursor.new(cursors, [['a', :desc], ['b', :asc]])
+      assert_equal %w(x y a z), merged.map { |doc| doc['b'] }
+    end
+
+    should "break ties by cursor position" do
+      cursors = [raw_cursor({'k' => 1, 'from' => 0}), raw_cursor({'k' => 1, 'from' => 1})]
+      merged = MergedCursor.new(cursors.reverse, 'k')
+      assert_equal [1, 0], merged.map { |doc| doc['from'] }
+    end
+
+    should "accept deserialized documents and return raw ones on request" do
+      cursors = [ListCursor.new([{'n' => 2}]), raw_cursor({'n' => 1})]
+      merged = MergedCursor.new(cursors, {'n' => 1}, :raw => true)
+      docs = merged.to_a
+      assert docs.all? { |doc| doc.is_a?(String) }
+      assert_equal [1, 2], docs.map { |doc| BSON::BSON_CODER.deserialize(doc)['n'] }
+    end
+
+    should "close every cursor" do
+      cursors = [raw_cursor({'n' => 1}), raw_cursor({'n' => 2})]
+      merged = MergedCursor.new(cursors, 'n')
+      merged.close
+      assert merged.closed?
+      assert cursors.all? { |cursor| cursor.closed }
+      assert_nil merged.next
+    end
+  end
+end
@@ -45,4 +45,20 @@ class MongoShardedClientUnitTest < Test::Unit::TestCase
       assert_equal [[ "localhost", 27017 ], [ "localhost", 27018 ]], client.seeds
     end
   end
+
+  def test_network_failure_ejects_mongos
+    client = MongoShardedClient.new(["localhost:27017", "localhost:27018"], :connect => false)
+    manager = ShardingPoolManager.new(client, client.seeds)
+    manager.stubs(:start_probe_thread)
+    pool = Pool.new(client, "localhost", 27017)
+    manager.instance_variable_set(:@mongos_pools, [pool])
+    client.instance_variable_set(:@manager, manager)
+
+    socket = stub(:pool => pool, :close => nil)
+    socket.stubs(:read).raises(OperationTimeout)
+    assert_raise OperationTimeout do
+      client.send(:receive_message_on_socket, 16, socket)
+    end
+    assert manager.ejected?(pool)
+  end
 end
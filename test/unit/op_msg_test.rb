@@ -0,0 +1,181 @@
+# Copyright (C) 2009-2013 MongoDB, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+require 'test_helper'
+require 'socket'
+
+class OpMsgUnitTest < Test::Unit::TestCase
+
+  # The server end of a socket pair. Each request is parsed and answered
+  # from a block, and kept in +requests+.
+  class MockServer
+    attr_reader :requests, :socket
+
+    def initialize(&reply)
+      client, @io = UNIXSocket.pair
+      @socket     = MockSocket.new(client)
+      @requests   = []
+      @reply      = reply
+      @thread     = Thread.new { serve }
+    end
+
+    def serve
+      while header = @io.read(16)
+        size, request_id, _, opcode = header.unpack('VVVV')
+        data = @io.read(size - 16)
+        flags, body, sequences = Mongo::OpMsg.parse(data)
+        @requests << {:opcode => opcode, :flags => flags, :body => body, :sequences => sequences}
+        reply_opcode, reply_flags, reply = @reply.call(body, sequences)
+        message = [reply_flags].pack('V') + "\0" + BSON::BSON_CODER.serialize(reply).to_s
+        message << "\1\2\3\4" if reply_flags & Mongo::OpMsg::CHECKSUM_PRESENT != 0
+        @io.write([16 + message.size, 1, request_id, reply_opcode].pack('VVVV') + message)
+      end
+    rescue IOError, SystemCallError
+      # the client closed its end
+    end
+
+    def stop
+      @io.close
+      @thread.join
+    end
+  end
+
+  class MockSocket
+    attr_reader :pool
+
+    def initialize(io)
+      @io = io
+    end
+
+    def send(data)
+      @io.write(data)
+    end
+
+    def read(length, buffer)
+      @io.read(length, buffer)
+    end
+
+    def close
+      @io.close unless @io.closed?
+    end
+
+    def checkin; end
+  end
+
+  context "OpMsg" do
+    should "frame a body and a document sequence" do
+      msg = OpMsg.new(BSON::OrderedHash['insert', 'logs', '$db', 'test'])
+      msg.sequence('documents')
+      msg.push(BSON::BSON_CODER.serialize({'a' => 1}))
+      msg.push(BSON::RawDocument.new(BSON::BSON_CODER.serialize({'a' => 2})))
+      data = msg.finish!.to_s
+
+      body = BSON::BSON_CODER.serialize(BSON::OrderedHash['insert', 'logs', '$db', 'test']).to_s
+      assert_equal [0].pack('V') + "\0" + body, data[0, 5 + body.size]
+      sequence = data[5 + body.size..-1]
+      assert_equal "\1", sequence[0, 1]
+      assert_equal sequence.size - 1, sequence[1, 4].unpack('V')[0]
+      assert_equal "documents\0", sequence[5, 10]
+
+      flags, parsed, sequences = OpMsg.parse(data)
+      assert_equal 0, flags
+      assert_equal({'insert' => 'logs', '$db' => 'test'}, parsed)
+      assert_equal [{'a' => 1}, {'a' => 2}], sequences['documents']
+    end
+
+    should "require a sequence before documents" do
+      assert_raise MongoArgumentError do
+        OpMsg.new({'ping' => 1}).push(BSON::BSON_CODER.serialize({'a' => 1}))
+      end
+    end
+
+    should "skip a checksum and optional flag bits" do
+      flags = OpMsg::CHECKSUM_PRESENT | OpMsg::EXHAUST_ALLOWED
+      data = [flags].pack('V') + "\0" + BSON::BSON_CODER.serialize({'ok' => 1}).to_s + "\xAA\xBB\xCC\xDD"
+      assert_equal [flags, {'ok' => 1}, {}], OpMsg.parse(data)
+    end
+
+    should "reject unknown required flag bits" do
+      data = [1 << 5].pack('V') + "\0" + BSON::BSON_CODER.serialize({'ok' => 1}).to_s
+      assert_raise(ConnectionFailure) { OpMsg.parse(data) }
+    end
+  end
+
+  context "Write batches against a server taking OP_MSG" do
+    setup do
+      @client = MongoClient.new('localhost', 27017, :connect => false)
+      @client.stubs(:use_write_command?).returns(true)
+      @client.stubs(:use_op_msg?).returns(true)
+      @coll = @client['test']['logs']
+      @coll.command_writer.stubs(:log_operation)
+    end
+
+    teardown do
+      @server.stop if @server
+    end
+
+    should "send the documents as a sequence" do
+      @server = MockServer.new do |body, sequences|
+        [Mongo::Constants::OP_MSG, OpMsg::CHECKSUM_PRESENT, {'ok' => 1, 'n' => sequences['documents'].size}]
+      end
+      @client.stubs(:checkout_writer).returns(@server.socket)
+
+      ids = @coll.insert([{'a' => 1}, {'a' => 2}, {'a' => 3}])
+
+      assert_equal 1, @server.requests.size
+      request = @server.requests.first
+      assert_equal Mongo::Constants::OP_MSG, request[:opcode]
+      assert_equal 'logs', request[:body]['insert']
+      assert_equal 'test', request[:body]['$db']
+      assert_equal true, request[:body]['ordered']
+      assert !request[:body].has_key?('documents')
+      assert_equal [1, 2, 3], request[:sequences]['documents'].map { |doc| doc['a'] }
+      assert_equal ids, request[:sequences]['documents'].map { |doc| doc['_id'] }
+    end
+
+    should "send updates and deletes as sequences" do
+      @server = MockServer.new { |body, sequences| [Mongo::Constants::OP_MSG, 0, {'ok' => 1, 'n' => 1}] }
+      @client.stubs(:checkout_writer).returns(@server.socket)
+      @coll.command_writer.expects(:log_operation).with(:update, anything, anything)
+      @coll.command_writer.expects(:log_operation).with(:delete, anything, anything)
+
+      bulk = @coll.initialize_ordered_bulk_op
+      bulk.find({'a' => 1}).update({'$set' => {'b' => 1}})
+      bulk.find({'a' => 2}).remove_one
+      bulk.execute
+
+      assert_equal ['update', 'delete'], @server.requests.map { |request| request[:body].keys.first }
+      assert_equal({'$set' => {'b' => 1}}, @server.requests[0][:sequences]['updates'][0]['u'])
+      assert_equal({'a' => 2}, @server.requests[1][:sequences]['deletes'][0]['q'])
+    end
+
+    should "raise write errors from the reply" do
+      @server = MockServer.new do |body, sequences|
+        [Mongo::Constants::OP_MSG, 0, {'ok' => 1, 'n' => 0,
+          'writeErrors' => [{'index' => 0, 'code' => 11000, 'errmsg' => 'E11000 duplicate key'}]}]
+      end
+      @client.stubs(:checkout_writer).returns(@server.socket)
+
+      ex = assert_raise(OperationFailure) { @coll.insert([{'_id' => 1}]) }
+      assert_equal 11000, ex.error_code
+    end
+
+    should "fail the connection on a reply of another opcode" do
+      @server = MockServer.new { |body, sequences| [Mongo::Constants::OP_REPLY, 0, {'ok' => 1}] }
+      @client.stubs(:checkout_writer).returns(@server.socket)
+
+      assert_raise(ConnectionFailure) { @coll.insert([{'a' => 1}]) }
+    end
+  end
+end
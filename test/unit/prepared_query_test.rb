@@ -0,0 +1,79 @@
+# Copyright (C) 2009-2013 MongoDB, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+require 'test_helper'
+
+class PreparedQueryUnitTest < Test::Unit::TestCase
+
+  def param(name, type=nil)
+    PreparedQuery.param(name, type)
+  end
+
+  # The message Collection#find builds for the same selector and options.
+  def expected_message(selector, opts={})
+    @coll.find(selector, opts).send(:construct_query_message).to_s
+  end
+
+  context "Prepared queries" do
+    setup do
+      @client = MongoClient.new('localhost', 27017, :connect => false)
+      @coll   = @client[TEST_DB]['prepared-query-test']
+    end
+
+    should "patch fixed-width values in place" do
+      query = @coll.prepare({'_id' => param(:id), 'n' => param(:n)}, :fields => ['a'])
+      id = BSON::ObjectId.new
+      [[id, 7], [id, -2**31], [BSON::ObjectId.new, 2**31 - 1]].each do |oid, n|
+        assert_equal expected_message({'_id' => oid, 'n' => n}, :fields => ['a']), query.bind(:id => oid, :n => n)
+      end
+      assert_equal [:id, :n], query.params
+    end
+
+    should "relayout nested documents when sizes change" do
+      selector = {'a' => {'$in' => [param(:x), 'fixed']}, 'b' => {'$gt' => param(:y)}, 'c' => 1}
+      query = @coll.prepare(selector, :sort => [['c', 1]], :skip => 5)
+      [
+        ['a much longer string than the marker it replaces', 2**40],
+        [{'nested' => [1, 2]}, nil],
+        [true, 1.5]
+      ].each do |x, y|
+        concrete = {'a' => {'$in' => [x, 'fixed']}, 'b' => {'$gt' => y}, 'c' => 1}
+        assert_equal expected_message(concrete, :sort => [['c', 1]], :skip => 5), query.bind(:x => x, :y => y)
+      end
+    end
+
+    should "send the bound message" do
+      id = BSON::ObjectId.new
+      query = @coll.prepare('_id' => param(:id, BSON::ObjectId))
+      sent = nil
+      @client.expects(:checkout_reader).returns(new_mock_socket)
+      @client.expects(:receive_message).with { |op, message, *args| sent = message.to_s }.returns([[{'_id' => id}], 1, 0])
+      assert_equal({'_id' => id}, query.find_one(:id => id))
+      assert_equal expected_message({'_id' => id}, :limit => -1), sent
+    end
+
+    should "check parameters" do
+      query = @coll.prepare('_id' => param(:id, BSON::ObjectId))
+      assert_raise MongoArgumentError do
+        query.bind({})
+      end
+      assert_raise MongoArgumentError do
+        query.bind(:id => 'not an id')
+      end
+      assert_raise MongoArgumentError do
+        @coll.prepare(param(:x) => 1)
+      end
+    end
+  end
+end
@@ -0,0 +1,49 @@
+# Copyright (C) 2009-2013 MongoDB, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+require 'test_helper'
+
+class ProbesUnitTest < Test::Unit::TestCase
+
+  context "Probes" do
+    setup do
+      @client = MongoClient.new('localhost', 27017, :connect => false)
+      @socket = stub()
+    end
+
+    should "not be enabled without a tracer" do
+      assert !Probes.enabled?(:socket_send)
+      assert !Probes.enabled?(:socket_receive)
+      assert !Probes.enabled?(:pool_checkout)
+      assert_nil Probes.fire(:socket_send, 1, Time.now)
+    end
+
+    should "not time socket operations while disabled" do
+      Probes.expects(:fire).never
+      @socket.stubs(:send).returns(5)
+      assert_equal 5, @client.send(:send_message_on_socket, "hello", @socket)
+    end
+
+    should "fire with the bytes sent and received when enabled" do
+      Probes.stubs(:enabled?).returns(true)
+      fired = []
+      Probes.stubs(:fire).with { |name, value, started| fired << [name, value]; started.is_a?(Time) }
+      @socket.stubs(:send).returns(5)
+      @socket.stubs(:read).with { |length, buffer| buffer << "x" * length }
+      @client.send(:send_message_on_socket, "hello", @socket)
+      @client.send(:receive_message_on_socket, 3, @socket)
+      assert_equal [[:socket_send, 5], [:socket_receive, 3]], fired
+    end
+  end
+end
@@ -0,0 +1,143 @@
+# Copyright (C) 2009-2013 MongoDB, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+require 'test_helper'
+
+class QueryCacheUnitTest < Test::Unit::TestCase
+
+  context "QueryCache" do
+    setup do
+      @cache = QueryCache.new(:ttl => 10, :max_bytes => 3 * (100 + QueryCache::ENTRY_OVERHEAD))
+      @key = lambda { |n| 'k' * 10 + n.to_s }
+    end
+
+    should "return what was stored and count hits and misses" do
+      assert_nil @cache.fetch('a')
+      @cache.store('a', ['x'], 10, @cache.generation)
+      assert_equal ['x'], @cache.fetch('a')
+      assert_equal({:hits => 1, :misses => 1, :hit_rate => 0.5, :evictions => 0,
+                    :entries => 1, :bytes => 11 + QueryCache::ENTRY_OVERHEAD}, @cache.stats)
+    end
+
+    should "expire entries after the ttl" do
+      cache = QueryCache.new(:ttl => 0)
+      cache.store('a', 1, 8, cache.generation)
+      assert_nil cache.fetch('a')
+      assert_equal 0, cache.stats[:bytes]
+    end
+
+    should "evict the least recently used entries" do
+      (1..3).each { |n| @cache.store(@key.call(n), n, 89, @cache.generation) }
+      @cache.fetch(@key.call(1))
+      @cache.store(@key.call(4), 4, 89, @cache.generation)
+
+      assert_equal 1, @cache.fetch(@key.call(1))
+      assert_nil @cache.fetch(@key.call(2))
+      assert_equal 4, @cache.fetch(@key.call(4))
+      assert_equal 1, @cache.stats[:evictions]
+    end
+
+    should "not store replies that would not fit" do
+      @cache.store('a', 1, @cache.max_bytes, @cache.generation)
+      assert_nil @cache.fetch('a')
+    end
+
+    should "drop replies read before it was cleared" do
+      generation = @cache.generation
+      @cache.store('a', 1, 8, generation)
+      @cache.clear
+      @cache.store('b', 2, 8, generation)
+      assert_nil @cache.fetch('a')
+      assert_nil @cache.fetch('b')
+    end
+  end
+
+  context "A collection with a query cache" do
+    setup do
+      @client = MongoClient.new('localhost', 27017, :connect => false)
+      @coll = @client['test'].collection('countries', :query_cache => {:ttl => 60})
+      @coll.operation_writer.stubs(:log_operation)
+      @client.stubs(:checkout_reader).returns(stub(:pool => nil, :checkin => nil))
+      @reply = [BSON::BSON_CODER.serialize({'_id' => 1, 'code' => 'FR'}).to_s]
+    end
+
+    should "answer a repeated query from the cache" do
+      @client.expects(:receive_message).once.with { |*args| args[8] == true }.returns([@reply, 1, 0, 20])
+      first = @coll.find_one('code' => 'FR')
+      first['code'] = 'changed'
+
+      assert_equal({'_id' => 1, 'code' => 'FR'}, @coll.find_one('code' => 'FR'))
+      assert_equal 0.5, @coll.query_cache.stats[:hit_rate]
+    end
+
+    should "not share raw documents with the cache" do
+      @client.expects(:receive_message).once.returns([@reply.map { |bson| bson.dup }, 1, 0, 20])
+      @coll.find({'code' => 'FR'}, :raw => true).next << 'x'
+      hit = @coll.find({'code' => 'FR'}, :raw => true).next
+      assert !hit.frozen?
+      hit << 'y'
+
+      assert_equal @reply, @coll.find({'code' => 'FR'}, :raw => true).to_a
+    end
+
+    should "be shared by collections of the same name" do
+      assert @coll.query_cache.equal?(@client['test'].collection('countries', :query_cache => true).query_cache)
+      assert_nil @client['test']['countries'].find.instance_variable_get(:@query_cache)
+    end
+
+    should "key queries by their options and read preference" do
+      @client.expects(:receive_message).times(4).returns([@reply, 1, 0, 20])
+      @coll.find_one('code' => 'FR')
+      @coll.find_one({'code' => 'FR'}, :fields => ['code'])
+      @coll.find_one({'code' => 'FR'}, :read => :secondary_preferred)
+      @coll.find_one({'code' => 'FR'}, :query_cache => false)
+      assert_equal 3, @coll.query_cache.stats[:entries]
+    end
+
+    should "not cache replies leaving a cursor open" do
+      @client.expects(:receive_message).twice.returns([@reply, 1, 42, 20])
+      @coll.find('code' => 'FR').next
+      @coll.find('code' => 'FR').next
+      assert_equal 0, @coll.query_cache.stats[:entries]
+    end
+
+    should "cache counts" do
+      @coll.db.expects(:command).once.returns({'ok' => 1, 'n' => 7})
+      assert_equal 7, @coll.count(:query => {'code' => 'FR'})
+      assert_equal 7, @coll.count(:query => {'code' => 'FR'})
+    end
+
+    should "be emptied by writes through any collection of the same name" do
+      @client.expects(:receive_message).twice.returns([@reply, 1, 0, 20])
+      @client.expects(:send_message_with_gle).returns({'ok' => 1, 'n' => 1})
+      @coll.find_one('code' => 'FR')
+      @client['test']['countries'].update({'code' => 'FR'}, {'$set' => {'name' => 'France'}})
+      assert_equal 0, @coll.query_cache.stats[:entries]
+      @coll.find_one('code' => 'FR')
+    end
+
+    should "be emptied by unacknowledged writes once they are sent" do
+      @client.expects(:receive_message).twice.returns([@reply, 1, 0, 20])
+      @client.expects(:send_message).returns(true)
+      @coll.find_one('code' => 'FR')
+      @coll.update({'code' => 'FR'}, {'$set' => {'name' => 'France'}}, :w => 0)
+      assert_equal 0, @coll.query_cache.stats[:entries]
+
+      # The server may not have applied the update yet, but the reply is
+      # stored all the same.
+      @coll.find_one('code' => 'FR')
+      assert_equal 1, @coll.query_cache.stats[:entries]
+    end
+  end
+end
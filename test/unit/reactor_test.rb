@@ -0,0 +1,212 @@
+# Copyright (C) 2009-2013 MongoDB, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+require 'test_helper'
+
+class ReactorUnitTest < Test::Unit::TestCase
+
+  # Socket wrapper over one end of a socket pair; the test plays the
+  # server on the other end.
+  class PairSocket
+    include SocketUtil
+
+    def initialize(io, pool)
+      @socket = io
+      @pool   = pool
+      @pid    = Process.pid
+      @auths  = Set.new
+    end
+
+    def send(data)
+      @socket.write(data)
+    end
+
+    def read(maxlen, buffer)
+      @socket.readpartial(maxlen, buffer)
+    rescue SystemCallError, IOError => ex
+      raise Mongo::ConnectionFailure, ex
+    end
+  end
+
+  class PairPool
+    attr_reader :server_ends, :checked_in
+
+    def initialize
+      @server_ends = []
+      @checked_in  = []
+    end
+
+    def checkout_unpinned(wait=true)
+      client_end, server_end = Socket.pair(:UNIX, :STREAM, 0)
+      @server_ends << server_end
+      PairSocket.new(client_end, self)
+    end
+
+    def checkin(socket)
+      @checked_in << socket
+    end
+  end
+
+  def read_request(io)
+    size, request_id, _, _ = io.read(16).unpack('VVVV')
+    io.read(size - 16)
+    request_id
+  end
+
+  def write_reply(io, response_to, docs)
+    body = [0, 0, 0, 0, docs.size].pack('VVVVV')
+    docs.each { |doc| body << BSON::BSON_CODER.serialize(doc).to_s }
+    io.write([16 + body.bytesize, 0, response_to, Mongo::Constants::OP_REPLY].pack('VVVV') + body)
+  end
+
+  def query_message
+    message = BSON::ByteBuffer.new
+    message.put_int(0)
+    BSON::BSON_RUBY.serialize_cstr(message, "test.items")
+    message.put_int(0)
+    message.put_int(-1)
+    message.put_binary(BSON::BSON_CODER.serialize({}).to_s)
+    message
+  end
+
+  context "Reactor" do
+    setup do
+      @client  = MongoClient.new('localhost', 27017, :connect => false, :op_timeout => 5)
+      @pool    = PairPool.new
+      @reactor = Reactor.new(@client, :max_sockets_per_pool => 2)
+    end
+
+    should "keep several operations in flight and match replies out of order" do
+      futures = (1..2).map do |n|
+        @reactor.dispatch(@pool, Mongo::Constants::OP_QUERY, query_message) { |docs, _, _| docs.first['n'] }
+      end
+      assert_equal 2, @pool.server_ends.size
+      assert_equal 2, @reactor.pending
+
+      ids = @pool.server_ends.map { |io| read_request(io) }
+      write_reply(@pool.server_ends[1], ids[1], [{'n' => 2}])
+      write_reply(@pool.server_ends[0], ids[0], [{'n' => 1}])
+
+      assert_equal 2, futures[1].value
+      assert_equal 1, futures[0].value
+      assert_equal 0, @reactor.pending
+    end
+
+    should "pipeline on held sockets once the per-pool limit is reached" do
+      futures = (1..4).map do |n|
+        @reactor.dispatch(@pool, Mongo::Constants::OP_QUERY, query_message) { |docs, _, _| docs.first['n'] }
+      end
+      assert_equal 2, @pool.server_ends.size
+
+      @pool.server_ends.each_with_index do |io, i|
+        2.times do |j|
+          write_reply(io, read_request(io), [{'n' => i * 2 + j}])
+        end
+      end
+
+      assert_equal [0, 2, 1, 3], futures.map(&:value)
+    end
+
+    should "return sockets to the pool once their replies have been read" do
+      future = @reactor.dispatch(@pool, Mongo::Constants::OP_QUERY, query_message)
+      io = @pool.server_ends.first
+      write_reply(io, read_request(io), [{'ok' => 1}])
+      future.wait
+
+      assert_equal 1, @pool.checked_in.size
+      assert_equal [{'ok' => 1}], future.value[0]
+    end
+
+    should "fail every operation pipelined on a socket that drops" do
+      reactor = Reactor.new(@client, :max_sockets_per_pool => 1)
+      futures = (1..2).map do
+        reactor.dispatch(@pool, Mongo::Constants::OP_QUERY, query_message)
+      end
+      @pool.server_ends.first.close
+
+      futures.each do |future|
+        assert_raise ConnectionFailure do
+          future.value
+        end
+      end
+      assert_equal 0, reactor.pending
+    end
+
+    should "resolve writes that expect no reply immediately" do
+      future = @reactor.dispatch_and_forget(@pool, Mongo::Constants::OP_INSERT, query_message)
+      assert future.ready?
+      assert_equal true, future.value
+      assert_equal 1, @pool.checked_in.size
+    end
+
+    should "refuse to wait when nothing is in flight" do
+      future = Future.new(@reactor)
+      assert_raise InvalidOperation do
+        future.value
+      end
+    end
+  end
+
+  context "Client reactors" do
+    setup do
+      @client = MongoClient.new('localhost', 27017, :connect => false)
+    end
+
+    should "keep one reactor per thread and release them on close" do
+      reactor = @client.reactor
+      assert_same reactor, @client.reactor
+      assert_not_same reactor, Thread.new { @client.reactor }.value
+
+      reactor.expects(:close)
+      @client.close
+      assert_not_same reactor, @client.reactor
+    end
+  end
+
+  context "Unpinned checkout" do
+    should "time out when no socket becomes available" do
+      pool = Pool.new(stub(:connected? => true), 'localhost', 27017, :size => 0, :timeout => 0.1)
+      assert_raise ConnectionTimeoutError do
+        Timeout.timeout(5) { pool.checkout_unpinned }
+      end
+    end
+  end
+
+  context "Future" do
+    setup do
+      @reactor = mock('reactor')
+    end
+
+    should "chain values and propagate errors" do
+      future = Future.new(@reactor)
+      doubled = future.then { |value| value * 2 }
+      future.resolve(21)
+      assert_equal 42, doubled.value
+
+      failed = Future.new(@reactor)
+      chained = failed.then { |value| flunk "should not run" }
+      failed.reject(OperationFailure.new("boom"))
+      assert_raise OperationFailure do
+        chained.value
+      end
+    end
+
+    should "recover from errors" do
+      future = Future.new(@reactor)
+      recovered = future.recover { |ex| ex.message }
+      future.reject(OperationFailure.new("boom"))
+      assert_equal "boom", recovered.value
+    end
+  end
+end
@@ -70,6 +70,7 @@ class ShardingPoolManagerUnitTest < Test::Unit::TestCase
       seed = ['localhost:27017']
       manager = Mongo::ShardingPoolManager.new(@client, seed)
       @client.stubs(:local_manager).returns(manager)
+      manager.stubs(:start_probe_thread)
       manager.connect
 
       formatted_seed = ['localhost', 27017]
@@ -81,4 +82,94 @@ class ShardingPoolManagerUnitTest < Test::Unit::TestCase
       assert_equal 0, manager.min_wire_version
     end
   end
+
+  context "Mongos selection: " do
+
+    setup do
+      @client = stub("MongoShardedClient")
+      @client.stubs(:log)
+      @manager = Mongo::ShardingPoolManager.new(@client, [])
+      @fast = Mongo::Pool.new(@client, 'localhost', 27017)
+      @slow = Mongo::Pool.new(@client, 'localhost', 27018)
+      @fast.record_latency(1)
+      @slow.record_latency(50)
+      @manager.instance_variable_set(:@mongos_pools, [@fast, @slow])
+    end
+
+    should "prefer the pool with the lower load" do
+      10.times { assert_equal @fast, @manager.select_pool }
+    end
+
+    should "weigh round-trip time by operations in flight" do
+      @fast.checked_out.concat(Array.new(60) { Object.new })
+      assert_equal @slow, @manager.select_pool
+    end
+
+    should "keep an average of round-trip times" do
+      @fast.record_latency(11)
+      assert_in_delta 3.0, @fast.latency, 0.001
+    end
+
+    should "skip ejected and excluded pools" do
+      @manager.stubs(:start_probe_thread)
+      @manager.eject(@fast)
+      assert @manager.ejected?(@fast)
+      assert_equal @slow, @manager.select_pool
+      assert_equal @fast, @manager.select_pool([@slow])
+    end
+
+    should "consider ejected pools when nothing else is left" do
+      @manager.stubs(:start_probe_thread)
+      @manager.eject(@fast)
+      @manager.eject(@slow)
+      assert [@fast, @slow].include?(@manager.select_pool)
+    end
+
+    should "re-admit ejected pools once they are reachable" do
+      @manager.stubs(:start_probe_thread)
+      @manager.eject(@fast)
+      @manager.send(:readmit, @fast)
+      assert !@manager.ejected?(@fast)
+      assert_equal 50, @fast.latency
+      assert_equal 0, @fast.latency_sample_count
+    end
+
+    should "time pings to measure latency" do
+      @manager.stubs(:ping).returns(4)
+      @manager.send(:probe, @fast)
+      assert_in_delta 1.6, @fast.latency, 0.001
+      assert_equal 2, @fast.latency_sample_count
+    end
+
+    should "eject a mongos that does not answer a ping" do
+      @manager.stubs(:start_probe_thread)
+      @manager.stubs(:ping).returns(nil)
+      @manager.send(:probe, @slow)
+      assert @manager.ejected?(@slow)
+    end
+
+    should "seed pools without a round-trip time from their peers" do
+      fresh = Mongo::Pool.new(@client, 'localhost', 27019)
+      @manager.instance_variable_set(:@mongos_pools, [@fast, @slow, fresh])
+      @manager.send(:seed_latencies)
+      assert_equal 50, fresh.latency
+    end
+
+    should "eject pools whose latency is an outlier" do
+      @manager.stubs(:start_probe_thread)
+      4.times { @slow.record_latency(50) }
+      @manager.check_latency(@fast)
+      assert !@manager.ejected?(@fast)
+
+      4.times { @fast.record_latency(1) }
+      @manager.check_latency(@slow)
+      assert @manager.ejected?(@slow)
+    end
+
+    should "not judge pools on too few round trips" do
+      @manager.stubs(:start_probe_thread)
+      @manager.check_latency(@slow)
+      assert !@manager.ejected?(@slow)
+    end
+  end
 end